@@ -15,6 +15,12 @@
 #include "9_Serial2Net.h"
 #include "10_Wifi.h"
 #include "12_Portal.h"
+#include "14_TX.h"
+#include "15_Messages.h"
+#include "16_Binary.h"
+#include "17_Cache.h"
+#include "18_Outbox.h"
+#include "19_Events.h"
 
 #if defined(DEBUG) || defined(RFLINK_DEBUG)
 #define DEBUG_RFLINK_CONFIG
@@ -43,6 +49,12 @@ namespace RFLink
             "signal",
             "radio",
             "serial2net",
+            "tx",
+            "messages",
+            "binary",
+            "cache",
+            "outbox",
+            "events",
             "root" // this is always the last one and matches index SectionId::EOF_id
     };
 
@@ -55,18 +67,25 @@ namespace RFLink
             &RFLink::Wifi::configItems[0],
             #ifndef RFLINK_MQTT_DISABLED
             &RFLink::Mqtt::configItems[0],
+            &RFLink::Outbox::configItems[0],
             #endif // RFLINK_MQTT_DISABLED
             &RFLink::Serial2Net::configItems[0],
             #ifndef RFLINK_PORTAL_DISABLED
             &RFLink::Portal::configItems[0],
+            &RFLink::Events::configItems[0],
             #endif // RFLINK_PORTAL_DISABLED
 #endif
             &RFLink::Signal::configItems[0],
             &RFLink::Radio::configItems[0],
+            &RFLink::TX::configItems[0],
+            &RFLink::Messages::configItems[0],
+            &RFLink::Binary::configItems[0],
+            &RFLink::Cache::configItems[0],
     };
 #define configItemListsSize (sizeof(configItemLists) / sizeof(ConfigItem *))
 
     StaticJsonDocument<4096> doc;
+    uint16_t generation = 0;
 
     void resetConfig()
     {
@@ -637,6 +656,20 @@ namespace RFLink
       serializeJsonPretty(doc, destination);
     }
 
+    size_t printConfigSection(uint8_t index, Print &destination)
+    {
+      for (JsonPair section : doc.as<JsonObject>())
+      {
+        if (index-- > 0)
+          continue;
+        size_t length = destination.print('"');
+        length += destination.print(section.key().c_str());
+        length += destination.print(F("\":"));
+        return length + serializeJson(section.value(), destination);
+      }
+      return 0;
+    }
+
     void dumpConfigToSerial()
     {
       serializeJson(doc, Serial);
@@ -658,6 +691,7 @@ namespace RFLink
     JsonVariant createElementInSection(SectionId section, const char *name)
     {
       JsonVariant ret = doc.getMember(jsonSections[section]).getOrAddMember((char*)name); // casting to char* forces a copy! avoids crash!
+      generation++;
       return ret;
     }
 
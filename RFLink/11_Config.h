@@ -9,6 +9,8 @@ namespace RFLink
     namespace Config
     {
 
+        extern uint16_t generation; // changes with every value written to the config, for readers spanning several loops
+
         void setup();
 
         enum ConfigItemType
@@ -29,6 +31,12 @@ namespace RFLink
             Signal_id,
             Radio_id,
             Serial2Net_id,
+            TX_id,
+            Messages_id,
+            Binary_id,
+            Cache_id,
+            Outbox_id,
+            Events_id,
             EOF_id // must always be the last!
         };
 
@@ -102,6 +110,7 @@ namespace RFLink
             inline void setCharValue(const char *newValue)
             {
               this->jsonRef.set((char *)newValue);
+              generation++;
             }
 
             inline long int getLongIntValue()
@@ -115,6 +124,7 @@ namespace RFLink
             inline void setLongIntValue(long int newValue)
             {
                 this->jsonRef.set(newValue);
+                generation++;
             }
 
             inline bool getBoolValue()
@@ -128,11 +138,17 @@ namespace RFLink
             inline void setBoolValue(bool newValue)
             {
                 this->jsonRef.set(newValue);
+                generation++;
             }
         };
 
         ConfigItem *findConfigItem(const char *name, SectionId section);
         void dumpConfigToString(String &destination);
+        /**
+         * Prints "name":{...} of the section at this position in the config, as compact JSON
+         * @return number of bytes printed, 0 past the last section
+         * */
+        size_t printConfigSection(uint8_t index, Print &destination);
         void dumpConfigToSerial();
         bool pushNewConfiguration(const JsonObject &data, String &message, bool escapeNewLine, bool triggerUpdateCallbacks = true);
 
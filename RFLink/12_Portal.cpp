@@ -2,6 +2,7 @@
 
 #ifndef RFLINK_PORTAL_DISABLED
 
+#include <memory>
 #include <ESPAsyncWebServer.h>
 #include <AsyncJson.h>
 #include <index.html.gz.h>
@@ -13,6 +14,13 @@
 #include "12_Portal.h"
 #include "10_Wifi.h"
 #include "13_OTA.h"
+#include "14_TX.h"
+#include "15_Messages.h"
+#include "16_Binary.h"
+#include "17_Cache.h"
+#include "18_Outbox.h"
+#include "19_Events.h"
+#include "20_Metrics.h"
 
 #if defined(ESP8266)
 #include "ESP8266WiFi.h"
@@ -63,37 +71,240 @@ namespace RFLink { namespace Portal {
           request->send(404, F("text/plain"), F("Not found"));
         }
 
+        /**
+         * Print keeping only the bytes [from, to) of what is printed to it, and no more than room of them.
+         * A section is serialized again for every chunk it spans, so its text is never held in memory as a whole.
+         * */
+        class ChunkPrint : public Print {
+          public:
+            ChunkPrint(uint8_t *buffer, size_t room, size_t from, size_t to = SIZE_MAX)
+                    : buffer(buffer), room(room), from(from), to(to) {}
+
+            size_t write(uint8_t c) override {
+              if (position >= from && position < to && written < room)
+                buffer[written++] = c;
+              position++;
+              return 1;
+            }
+
+            size_t write(const uint8_t *data, size_t size) override {
+              for (size_t i = 0; i < size; i++)
+                write(data[i]);
+              return size;
+            }
+
+            size_t written = 0;
+
+          private:
+            uint8_t *buffer;
+            size_t room;
+            size_t from;
+            size_t to;
+            size_t position = 0;
+        };
+
+        /**
+         * /api/config being sent: it is read from the config document one section at a time, a section spanning
+         * several chunks being serialized again for each of them. If the config changes in between, the response ends
+         * right away: its JSON is left incomplete rather than made of two versions.
+         * */
+        struct ConfigStream {
+          uint16_t generation = Config::generation;
+          uint8_t next = 0;   // index of the next section
+          size_t length = 0;  // bytes of the current section
+          size_t sent = 0;    // bytes of it already sent
+          bool opened = false;
+          bool closed = false;
+
+          size_t fill(uint8_t *buffer, size_t maxLen) {
+            if (generation != Config::generation) {
+              if (!closed)
+                Serial.println(F("Portal: config changed while /api/config was sent, response ended"));
+              closed = true;
+              return 0;
+            }
+
+            size_t written = 0;
+            while (written < maxLen && !closed) {
+              if (!opened) {
+                buffer[written++] = '{';
+                opened = true;
+                continue;
+              }
+
+              if (sent == length) {
+                ChunkPrint measure(nullptr, 0, 0);
+                size_t sectionLength = Config::printConfigSection(next, measure);
+                if (sectionLength == 0) {
+                  buffer[written++] = '}';
+                  closed = true;
+                  continue;
+                }
+                if (next++ > 0)
+                  buffer[written++] = ',';
+                length = sectionLength;
+                sent = 0;
+                continue;
+              }
+
+              ChunkPrint chunk(&buffer[written], maxLen - written, sent, length);
+              Config::printConfigSection(next - 1, chunk);
+              sent += chunk.written;
+              written += chunk.written;
+            }
+
+            return written;
+          }
+        };
+
         void serverApiConfigGet(AsyncWebServerRequest *request) {
           if(!checkHttpAuthentication(request))
             return;
 
-          String dump;
-          Config::dumpConfigToString(dump);
-          request->send(200, F("application/json"), dump);
+          std::shared_ptr<ConfigStream> stream(new ConfigStream());
+          request->send(request->beginChunkedResponse(F("application/json"), [stream](uint8_t *buffer, size_t maxLen, size_t index) -> size_t {
+            return stream->fill(buffer, maxLen);
+          }));
         }
 
+        typedef void (*StatusSection)(JsonObject &output);
+
+        // each of them adds its own members to the root object of /api/status
+        const StatusSection statusSections[] = {
+                RFLink::getStatusJsonString,
+                RFLink::Wifi::getStatusJsonString,
+                #ifndef RFLINK_MQTT_DISABLED
+                RFLink::Mqtt::getStatusJsonString,
+                RFLink::Outbox::getStatusJsonString,
+                #endif // RFLINK_MQTT_DISABLED
+                RFLink::Signal::getStatusJsonString,
+                RFLink::Serial2Net::getStatusJsonString,
+                RFLink::TX::getStatusJsonString,
+                RFLink::Messages::getStatusJsonString,
+                RFLink::Binary::getStatusJsonString,
+                RFLink::Cache::getStatusJsonString,
+                RFLink::Events::getStatusJsonString,
+        };
+        const uint8_t statusSectionsCount = sizeof(statusSections) / sizeof(statusSections[0]);
+
+        /**
+         * /api/status being sent: one section is rendered at a time and its members copied into as many chunks as needed,
+         * so a request never holds more than PORTAL_STATUS_SECTION_SIZE of JSON whatever the number of modules
+         * */
+        struct StatusStream {
+          StaticJsonDocument<PORTAL_STATUS_SECTION_SIZE> section;
+          uint8_t next = 0;     // index of the next section to render
+          size_t length = 0;    // bytes of the members of the current section, without its braces
+          size_t sent = 0;      // bytes of them already sent
+          bool opened = false;
+          bool closed = false;
+          bool comma = false;   // a ',' must go before the members of the current section
+          bool empty = true;    // no member was sent yet
+
+          size_t fill(uint8_t *buffer, size_t maxLen) {
+            size_t written = 0;
+
+            while (written < maxLen && !closed) {
+              if (!opened) {
+                buffer[written++] = '{';
+                opened = true;
+                continue;
+              }
+
+              if (sent == length) {
+                if (next == statusSectionsCount) {
+                  buffer[written++] = '}';
+                  closed = true;
+                  continue;
+                }
+                section.clear();
+                JsonObject obj = section.to<JsonObject>();
+                statusSections[next++](obj);
+                if (section.overflowed())
+                  Serial.printf_P(PSTR("Portal: status section %u truncated, PORTAL_STATUS_SECTION_SIZE is too small\r\n"), (unsigned int) next - 1);
+                length = measureJson(section) - 2;
+                sent = 0;
+                comma = length > 0 && !empty;
+                empty = empty && length == 0;
+                continue;
+              }
+
+              if (comma) {
+                buffer[written++] = ',';
+                comma = false;
+                continue;
+              }
+
+              ChunkPrint chunk(&buffer[written], maxLen - written, 1 + sent, 1 + length);
+              serializeJson(section, chunk);
+              sent += chunk.written;
+              written += chunk.written;
+            }
+
+            return written;
+          }
+        };
+
         void serveApiStatusGet(AsyncWebServerRequest *request) {
           if(!checkHttpAuthentication(request))
             return;
 
-          DynamicJsonDocument output(3000);
-
-          auto && obj = output.to<JsonObject>();
+          // released with the response, when the last chunk was sent or the client went away
+          std::shared_ptr<StatusStream> stream(new StatusStream());
+          request->send(request->beginChunkedResponse(F("application/json"), [stream](uint8_t *buffer, size_t maxLen, size_t index) -> size_t {
+            return stream->fill(buffer, maxLen);
+          }));
+        }
 
-          RFLink::getStatusJsonString(obj);
+        /**
+         * /metrics being sent: one group of lines is rendered at a time, then copied into as many chunks as needed
+         * */
+        struct MetricsStream {
+          char section[METRICS_SECTION_SIZE];
+          uint16_t next = 0;  // next group of lines to render
+          size_t length = 0;  // bytes of the current group
+          size_t sent = 0;    // bytes of it already sent
+          bool done = false;
+
+          size_t fill(uint8_t *buffer, size_t maxLen) {
+            size_t written = 0;
+
+            while (written < maxLen && !done) {
+              if (sent == length) {
+                ChunkPrint unit((uint8_t *) section, sizeof(section), 0);
+                if (!Metrics::printUnit(unit, next++)) {
+                  done = true;
+                  continue;
+                }
+                length = unit.written;
+                if (length == sizeof(section)) {
+                  // a cut line would make the whole page invalid, the lines which did not fit are left out
+                  Serial.printf_P(PSTR("Portal: metrics group %u truncated, METRICS_SECTION_SIZE is too small\r\n"), (unsigned int) next - 1);
+                  while (length > 0 && section[length - 1] != '\n')
+                    length--;
+                }
+                sent = 0;
+                continue;
+              }
+
+              size_t count = length - sent < maxLen - written ? length - sent : maxLen - written;
+              memcpy(&buffer[written], &section[sent], count);
+              sent += count;
+              written += count;
+            }
 
-          RFLink::Wifi::getStatusJsonString(obj);
-          #ifndef RFLINK_MQTT_DISABLED
-          RFLink::Mqtt::getStatusJsonString(obj);
-          #endif // RFLINK_MQTT_DISABLED
-          RFLink::Signal::getStatusJsonString(obj);
-          RFLink::Serial2Net::getStatusJsonString(obj);
+            return written;
+          }
+        };
 
-          String buffer;
-          buffer.reserve(512);
-          serializeJson(output, buffer);
+        void serveMetricsGet(AsyncWebServerRequest *request) {
+          if(!checkHttpAuthentication(request))
+            return;
 
-          request->send(200, "application/json", buffer);
+          std::shared_ptr<MetricsStream> stream(new MetricsStream());
+          request->send(request->beginChunkedResponse(F("text/plain; version=0.0.4"), [stream](uint8_t *buffer, size_t maxLen, size_t index) -> size_t {
+            return stream->fill(buffer, maxLen);
+          }));
         }
 
         void serveApiReboot(AsyncWebServerRequest *request) {
@@ -173,27 +384,23 @@ namespace RFLink { namespace Portal {
           String message;
           message.reserve(256); // reserve 256 to avoid fragmentation
 
-          String response;
-          response.reserve(256);
-
-          if( !Config::pushNewConfiguration(data, message, true) ) {
-            response = F("{ \"success\": false, \"message\": ");
-          }
-          else {
-            response = F("{ \"success\": true, \"message\": ");
-          }
-
-          if( message.length() > 0 ) {
-            response += '"';
-            response += message + "\"}";
-          } else {
-            response += F(" null }");
-          }
+          StaticJsonDocument<64> reply;
+          reply[F("success")] = Config::pushNewConfiguration(data, message, true);
+          if( message.length() > 0 )
+            reply[F("message")] = message.c_str(); // not copied, message outlives the reply
+          else
+            reply[F("message")] = nullptr;
 
-          request->send(200, F("application/json"), response);
+          AsyncResponseStream *response = request->beginResponseStream(F("application/json"), measureJson(reply) + 1);
+          serializeJson(reply, *response);
+          request->send(response);
         }
 
 
+        // compared only, never dereferenced: the request may be gone
+        AsyncWebServerRequest *firmwareUploader = nullptr; // upload writing to flash right now
+        AsyncWebServerRequest *firmwareUploaded = nullptr; // last upload which completed
+
 // Taken from of https://github.com/ayushsharma82/AsyncElegantOTA
         void handleFirmwareUpdateFinalResponse(AsyncWebServerRequest *request) {
           if(!checkHttpAuthentication(request))
@@ -201,9 +408,10 @@ namespace RFLink { namespace Portal {
 
           // the request handler is triggered after the upload has finished...
           // create the response, add header, and send response
+          bool success = request == firmwareUploaded && !Update.hasError();
           AsyncWebServerResponse *response = request->beginResponse(
-                  (Update.hasError()) ? 500 : 200, "text/plain",
-                  (Update.hasError()) ? "FAIL" : "OK"
+                  success ? 200 : 500, "text/plain",
+                  success ? "OK" : "FAIL"
           );
           response->addHeader(F("Connection"), F("close"));
           response->addHeader(F("Access-Control-Allow-Origin"), "*");
@@ -218,6 +426,12 @@ namespace RFLink { namespace Portal {
           if (!index) {
             Serial.println(F("OTA via Portal Requested"));
 
+            if (OTA::currentHttpUpdateStatus == OTA::statusEnum::Scheduled ||
+                OTA::currentHttpUpdateStatus == OTA::statusEnum::InProgress || Update.isRunning()) {
+              Serial.println(F("OTA via Portal refused, another firmware update is running"));
+              return request->send(400, F("text/plain"), F("Another firmware update is running"));
+            }
+
             //if(!request->hasParam("MD5", true)) {
             //    return request->send(400, "text/plain", "MD5 parameter missing");
             //}
@@ -239,20 +453,35 @@ namespace RFLink { namespace Portal {
               Update.printError(Serial);
               return request->send(400, F("text/plain"), F("OTA could not begin"));
             }
+            firmwareUploader = request;
+            request->onDisconnect([request]() {
+              if (firmwareUploader == request) { // went away before the last chunk
+                Update.end(false);
+                firmwareUploader = nullptr;
+              }
+            });
           }
 
+          // chunks of a refused or failed upload are not written, flash may belong to an HttpUpdate
+          if (request != firmwareUploader)
+            return;
+
           // Write chunked data to the free sketch space
           if(len){
             if (Update.write(data, len) != len) {
+              Update.end(false);
+              firmwareUploader = nullptr;
               return request->send(400, F("text/plain"), F("OTA could not begin"));
             }
           }
 
           if (final) { // if the final flag is set then this is the last frame of data
+            firmwareUploader = nullptr;
             if (!Update.end(true)) { //true to set the size to the current progress
               Update.printError(Serial);
               return request->send(400, F("text/plain"), F("Could not end OTA"));
             }
+            firmwareUploaded = request;
             Serial.println(F("OTA via Portal is a success. You are one reboot away your new shiny release! See you in 5 seconds..."));
             RFLink::scheduleReboot(5);
           }else{
@@ -261,31 +490,89 @@ namespace RFLink { namespace Portal {
           return;
         }
 
+        // "<fnv1a of the bundle>-<size>", quotes included as sent in ETag
+        char indexHtmlETag[24];
+
+        void computeIndexHtmlETag() {
+          uint32_t hash = 2166136261UL;
+          uint8_t block[64];
+          for (size_t offset = 0; offset < index_html_gz_size; offset += sizeof(block)) {
+            size_t length = index_html_gz_size - offset < sizeof(block) ? index_html_gz_size - offset : sizeof(block);
+            memcpy_P(block, &index_html_gz_start[offset], length);
+            for (size_t i = 0; i < length; i++) {
+              hash ^= block[i];
+              hash *= 16777619UL;
+            }
+          }
+          snprintf_P(indexHtmlETag, sizeof(indexHtmlETag), PSTR("\"%08x-%x\""), (unsigned int) hash, (unsigned int) index_html_gz_size);
+        }
+
+        // a list of tags or "*", weak ones (W/"...") match too
+        bool indexHtmlETagMatches(AsyncWebServerRequest *request) {
+          if (!request->hasHeader(F("If-None-Match")))
+            return false;
+          const String &tags = request->getHeader(F("If-None-Match"))->value();
+          return strcmp(tags.c_str(), "*") == 0 || strstr(tags.c_str(), indexHtmlETag) != nullptr;
+        }
+
         void serveIndexHtml(AsyncWebServerRequest *request) {
           if(!checkHttpAuthentication(request))
             return;
-          AsyncWebServerResponse *response = request->beginResponse_P(200, F("text/html"), index_html_gz_start, index_html_gz_size);
-          response->addHeader(F("Content-Encoding"), F("gzip"));
+
+          AsyncWebServerResponse *response;
+          if (indexHtmlETagMatches(request))
+            response = request->beginResponse(304);
+          else {
+            response = request->beginResponse_P(200, F("text/html"), index_html_gz_start, index_html_gz_size);
+            response->addHeader(F("Content-Encoding"), F("gzip"));
+          }
+          // every route serves the same bundle, which changes with the firmware: browsers keep it but ask whether
+          // it is still current, which costs a 304 without body
+          response->addHeader(F("ETag"), indexHtmlETag);
+          response->addHeader(F("Cache-Control"), F("no-cache"));
           request->send(response);
         }
 
+        const char *const indexHtmlRoutes[] PROGMEM = {
+                "/", "/index.html", "/wifi", "/home", "/radio", "/signal", "/firmware", "/services",
+        };
+
+        /**
+         * Serves the web UI on its routes. Unlike server.on() callbacks, a handler can ask for If-None-Match
+         * before the request headers not asked for are discarded.
+         * */
+        class IndexHtmlHandler : public AsyncWebHandler {
+          public:
+            bool canHandle(AsyncWebServerRequest *request) override {
+              if (request->method() != HTTP_GET)
+                return false;
+              for (auto route : indexHtmlRoutes) {
+                if (strcmp(request->url().c_str(), route) == 0) {
+                  request->addInterestingHeader(F("If-None-Match"));
+                  return true;
+                }
+              }
+              return false;
+            }
+
+            void handleRequest(AsyncWebServerRequest *request) override {
+              serveIndexHtml(request);
+            }
+        };
+
 
         void init() {
 
           refreshParametersFromConfig(false);
 
+          computeIndexHtmlETag();
+
           server.onNotFound(notFound);
-          server.on(PSTR("/"), HTTP_GET, serveIndexHtml);
-          server.on(PSTR("/index.html"), HTTP_GET, serveIndexHtml);
-          server.on(PSTR("/wifi"), HTTP_GET, serveIndexHtml);
-          server.on(PSTR("/home"), HTTP_GET, serveIndexHtml);
-          server.on(PSTR("/radio"), HTTP_GET, serveIndexHtml);
-          server.on(PSTR("/signal"), HTTP_GET, serveIndexHtml);
-          server.on(PSTR("/firmware"), HTTP_GET, serveIndexHtml);
-          server.on(PSTR("/services"), HTTP_GET, serveIndexHtml);
+          server.addHandler(new IndexHtmlHandler());
 
           server.on(PSTR("/api/config"), HTTP_GET, serverApiConfigGet);
           server.on(PSTR("/api/status"), HTTP_GET, serveApiStatusGet);
+          server.on(PSTR("/metrics"), HTTP_GET, serveMetricsGet);
 
           server.on(PSTR("/api/reboot"), HTTP_GET, serveApiReboot);
 
@@ -298,6 +585,8 @@ namespace RFLink { namespace Portal {
           handler = new AsyncCallbackJsonWebHandler(PSTR("/api/firmware/update_from_url"), serveApiFirmwareUpdateFromUrl, 1000);
           server.addHandler(handler);
 
+          Events::init(server);
+
         }
 
         void start() {
@@ -346,6 +635,11 @@ namespace RFLink { namespace Portal {
           params::auth_password = item->getCharValue();
         }
 
+        if(params::auth_enabled)
+          Events::setAuthentication(params::auth_user.c_str(), params::auth_password.c_str());
+        else
+          Events::setAuthentication("", "");
+
         if (triggerChanges && changesDetected) {
           if(params::enabled)
             server.begin();
@@ -7,6 +7,9 @@
 
 #include "11_Config.h"
 
+// JSON memory of the largest module section of /api/status, which is sent one section at a time
+#define PORTAL_STATUS_SECTION_SIZE 1024
+
 namespace RFLink {
     namespace Portal {
 
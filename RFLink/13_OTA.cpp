@@ -4,70 +4,157 @@
 
 #ifdef ESP32
 #include <HTTPClient.h>
-#include <HTTPUpdate.h>
+#include <WiFiClientSecure.h>
+#include <Update.h>
 #elif defined(ESP8266)
 #include <ESP8266HTTPClient.h>
-#include <ESP8266httpUpdate.h>
-#define httpUpdate ESPhttpUpdate
+#include <WiFiClientSecure.h>
+#include <Updater.h>
 #endif
 
-#include <asyncHTTPrequest.h>
-#include <Ticker.h>
-
-asyncHTTPrequest request;
-Ticker ticker;
-
 namespace RFLink
 {
   namespace OTA
   {
-    unsigned bytesReceived;
     String currentHttpUpdateUrl;
     String currentHttpUpdateErrorMsg;
 
     statusEnum currentHttpUpdateStatus = statusEnum::Idle;
 
-    void sendRequest(){
-      if(request.readyState() == 0 || request.readyState() == 4){
-        request.open("GET", currentHttpUpdateUrl.c_str());
-        request.send();
+    namespace runtime {
+      WiFiClient *client = nullptr; // a WiFiClientSecure for https URLs
+      HTTPClient *http = nullptr;
+      size_t totalBytes = 0;
+      size_t writtenBytes = 0;
+      unsigned long lastDataTime = 0;
+      uint8_t chunk[OTA_CHUNK_SIZE];
+    }
+
+    void releaseHttpUpdate() {
+      if (runtime::http != nullptr) {
+        runtime::http->end();
+        delete runtime::http;
+        runtime::http = nullptr;
       }
+      delete runtime::client;
+      runtime::client = nullptr;
     }
 
-    void requestStateChangedCallback(void* optParm, asyncHTTPrequest* request, int readyState){
-      /*
-       *     enum    readyStates {
-          readyStateUnsent = 0,           // Client created, open not yet called
-          readyStateOpened =  1,          // open() has been called, connected
-          readyStateHdrsRecvd = 2,        // send() called, response headers available
-          readyStateLoading = 3,          // receiving, partial data available
-          readyStateDone = 4} _readyState; // Request complete, all data available
-       */
-      Serial.println(F("Request has changed state : %i\r\n"));
-      if(readyState == 4){
-        Serial.println(request->responseText());
-        Serial.println();
-        request->setDebug(false);
+    void failHttpUpdate(const String &message) {
+      if (Update.isRunning())
+        Update.end(false); // leaves the running firmware as the boot one
+      releaseHttpUpdate();
+      currentHttpUpdateErrorMsg = message;
+      currentHttpUpdateStatus = statusEnum::Failed;
+      Serial.printf_P(PSTR("HttpUpdate error: %s\r\n"), currentHttpUpdateErrorMsg.c_str());
+    }
+
+    String updateErrorString() {
+#ifdef ESP32
+      return Update.errorString();
+#else
+      return Update.getErrorString();
+#endif
+    }
+
+    void startHttpUpdate() {
+      if (Update.isRunning()) { // uploaded through the portal since it was scheduled, that one is not ours to abort
+        currentHttpUpdateErrorMsg = F("A firmware upload is already running");
+        currentHttpUpdateStatus = statusEnum::Failed;
+        return;
+      }
+
+      Serial.print(F("HttpUpdate started ... "));
+      currentHttpUpdateStatus = statusEnum::InProgress;
+
+      if (currentHttpUpdateUrl.startsWith("https")) {
+        auto secureClient = new WiFiClientSecure();
+        secureClient->setInsecure();
+        runtime::client = secureClient;
+      }
+      else
+        runtime::client = new WiFiClient();
+
+      runtime::http = new HTTPClient();
+      runtime::http->setFollowRedirects(HTTPC_FORCE_FOLLOW_REDIRECTS);
+      if (!runtime::http->begin(*runtime::client, currentHttpUpdateUrl)) {
+        failHttpUpdate(F("Invalid URL"));
+        return;
+      }
+
+      // only the request and the response headers are waited for, the body is read by the next main loops
+      int code = runtime::http->GET();
+      if (code != HTTP_CODE_OK) {
+        if (code == HTTP_CODE_NOT_MODIFIED || code == HTTP_CODE_NO_CONTENT)
+          failHttpUpdate(F("No update found at provided URL"));
+        else if (code < 0)
+          failHttpUpdate(HTTPClient::errorToString(code));
+        else
+          failHttpUpdate(String(F("Server replied with HTTP code ")) + code);
+        return;
+      }
+
+      int size = runtime::http->getSize();
+      if (size <= 0) {
+        failHttpUpdate(F("Server did not send the firmware size (Content-Length)"));
+        return;
+      }
+
+      if (!Update.begin(size, U_FLASH)) {
+        failHttpUpdate(updateErrorString());
+        return;
       }
+
+      runtime::totalBytes = size;
+      runtime::writtenBytes = 0;
+      runtime::lastDataTime = millis();
+      Serial.printf_P(PSTR("%u bytes to download\r\n"), (unsigned int) runtime::totalBytes);
     }
 
-    void dataReceived(void* optParm, asyncHTTPrequest *req, size_t byteCount) {
-      uint8_t buff[256];
+    void continueHttpUpdate() {
+      WiFiClient *stream = runtime::http->getStreamPtr();
+      unsigned long started = millis();
 
-      auto remaining = request.available();
-      size_t amountToRead = 0;
+      while (runtime::writtenBytes < runtime::totalBytes && millis() - started < OTA_LOOP_BUDGET_MS) {
+        size_t available = stream->available();
+        if (available == 0)
+          break;
 
-      while( remaining > 0) {
-        amountToRead = sizeof(buff);
+        size_t length = runtime::totalBytes - runtime::writtenBytes;
+        if (length > available)
+          length = available;
+        if (length > sizeof(runtime::chunk))
+          length = sizeof(runtime::chunk);
 
-        if( remaining < sizeof(buff) )
-          amountToRead = remaining;
+        int read = stream->read(runtime::chunk, length);
+        if (read <= 0)
+          break;
+        length = read;
+        if (Update.write(runtime::chunk, length) != length) {
+          failHttpUpdate(updateErrorString());
+          return;
+        }
+        runtime::writtenBytes += length;
+        runtime::lastDataTime = millis();
+      }
+
+      if (runtime::writtenBytes < runtime::totalBytes) {
+        if (!stream->connected() && stream->available() == 0)
+          failHttpUpdate(F("Connection closed before the end of the firmware"));
+        else if (millis() - runtime::lastDataTime > OTA_STALL_TIMEOUT_MS)
+          failHttpUpdate(F("Download stalled"));
+        return;
+      }
 
-        request.responseRead(buff, sizeof(buff));
-        bytesReceived += amountToRead;
-        remaining = request.available();
+      if (!Update.end()) {
+        failHttpUpdate(updateErrorString());
+        return;
       }
-      Serial.printf_P(PSTR("Total read so far %u\r\n"), bytesReceived);
+
+      releaseHttpUpdate();
+      currentHttpUpdateStatus = statusEnum::PendingReboot;
+      Serial.println(F("HttpUpdate successful! Reboot is scheduled in 10 seconds"));
+      RFLink::scheduleReboot(10);
     }
 
     bool scheduleHttpUpdate(const char *url, String &errmsg) {
@@ -79,6 +166,10 @@ namespace RFLink
         errmsg = F("Another OTA update has been applied and requires a reboot");
         return false;
       }
+      if(Update.isRunning()){
+        errmsg = F("A firmware upload is already running");
+        return false;
+      }
 
       currentHttpUpdateStatus = statusEnum::Scheduled;
       currentHttpUpdateUrl = url;
@@ -90,42 +181,10 @@ namespace RFLink
     }
 
     void mainLoop() {
-      if(currentHttpUpdateStatus != statusEnum::Scheduled)
-        return;
-
-      WiFiClient client;
-      WiFiClientSecure clientS;
-      clientS.setInsecure();
-
-      currentHttpUpdateStatus = statusEnum::InProgress;
-
-      t_httpUpdate_return ret;
-      Serial.print(F("HttpUpdate started ... "));
-      httpUpdate.rebootOnUpdate(false);
-      httpUpdate.setFollowRedirects(HTTPC_FORCE_FOLLOW_REDIRECTS);
-      if(currentHttpUpdateUrl.startsWith("https"))
-        ret = httpUpdate.update(clientS, currentHttpUpdateUrl);
-      else
-        ret = httpUpdate.update(client, currentHttpUpdateUrl);
-
-      switch (ret)
-      {
-        case HTTP_UPDATE_FAILED:
-          currentHttpUpdateErrorMsg =  httpUpdate.getLastError() + httpUpdate.getLastErrorString();
-          Serial.printf_P(PSTR("HttpUpdate error: %s\r\n"), currentHttpUpdateErrorMsg.c_str());
-          currentHttpUpdateStatus = statusEnum::Failed;
-          break;
-        case HTTP_UPDATE_NO_UPDATES:
-          currentHttpUpdateErrorMsg = F("No update found at provided URL");
-          Serial.println(currentHttpUpdateUrl.c_str());
-          currentHttpUpdateStatus = statusEnum::Failed;
-          break;
-        case HTTP_UPDATE_OK:
-          currentHttpUpdateStatus = statusEnum::PendingReboot;
-          Serial.println(F("HttpUpdate successful! Reboot is scheduled in 10 seconds"));
-          RFLink::scheduleReboot(10);
-          break;
-      }
+      if(currentHttpUpdateStatus == statusEnum::Scheduled)
+        startHttpUpdate();
+      else if(currentHttpUpdateStatus == statusEnum::InProgress)
+        continueHttpUpdate();
     }
 
     void getHttpUpdateStatus(JsonObject &json) {
@@ -137,6 +196,9 @@ namespace RFLink
         }
         case InProgress: {
           json[F("status")] = F("in_progress");
+          json[F("written_bytes")] = runtime::writtenBytes;
+          json[F("total_bytes")] = runtime::totalBytes;
+          json[F("progress")] = runtime::totalBytes > 0 ? (int) (runtime::writtenBytes * 100ULL / runtime::totalBytes) : 0;
           break;
         }
         case Scheduled: {
@@ -4,6 +4,12 @@
 #include <WString.h>
 #include <ArduinoJson.h>
 
+// An HttpUpdate is downloaded and written to flash a little at every main loop, so signals are still received and
+// published while it runs
+#define OTA_LOOP_BUDGET_MS 10      // time spent downloading per main loop, a flash sector erase may exceed it
+#define OTA_CHUNK_SIZE 1024        // bytes read from the network and written to flash at once
+#define OTA_STALL_TIMEOUT_MS 30000 // the update fails if no byte arrived for that long
+
 namespace RFLink
 {
   namespace OTA
@@ -24,8 +30,12 @@ namespace RFLink
      **/
     bool scheduleHttpUpdate(const char *url, String &errmsg);
 
-    void getHttpUpdateStatus(JsonObject &json);
+    void getHttpUpdateStatus(JsonObject &json); // progress included while in progress
 
+    /*
+     * Starts a scheduled HttpUpdate (request and response headers) or goes on with the one in progress
+     * for at most OTA_LOOP_BUDGET_MS
+     **/
     void mainLoop();
 
   }
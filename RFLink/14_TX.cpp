@@ -0,0 +1,1100 @@
+#include <Arduino.h>
+#include "RFLink.h"
+#include "1_Radio.h"
+#include "2_Signal.h"
+#include "3_Serial.h"
+#include "4_Display.h"
+#include "5_Plugin.h"
+#include "14_TX.h"
+#include "15_Messages.h"
+
+namespace RFLink {
+  namespace TX {
+
+    namespace commands {
+      const char calibrate[] PROGMEM = "calibrate";
+      const char resetCalibration[] PROGMEM = "resetCalibration";
+      const char showCalibration[] PROGMEM = "showCalibration";
+      const char batch[] PROGMEM = "batch";
+      const char showCache[] PROGMEM = "showCache";
+      const char clearCache[] PROGMEM = "clearCache";
+    }
+
+    namespace params {
+      String corrections;
+      bool cacheEnabled = true;
+    }
+
+    namespace runtime {
+      int16_t corrections[2][TX_CORRECTION_BUCKETS];
+      bool calibrated = false;
+      float residualError_us = 0.0F;
+      uint8_t lastLevel = LOW;
+    }
+
+    namespace counters {
+      unsigned long int cacheHits = 0;
+      unsigned long int cacheMisses = 0;
+      unsigned long int cacheTimeSaved_us = 0;
+      unsigned long int requestsQueued = 0;
+      unsigned long int requestsSent = 0;
+      unsigned long int requestsRejected = 0;
+      unsigned long int requestMaxWait_ms = 0;
+    }
+
+    namespace queue {
+      Request requests[TX_QUEUE_SIZE];
+      uint8_t head = 0; // next free slot
+      uint8_t count = 0;
+    }
+
+    const uint16_t correctionBucketLimits[TX_CORRECTION_BUCKETS] = {400, 800, 1600, 0xFFFF};
+    // pulse length used to measure each class during calibration
+    const uint16_t calibrationReferences_us[TX_CORRECTION_BUCKETS] = {300, 600, 1200, 2400};
+
+    const char json_name_corrections[] = "corrections";
+    const char json_name_cache_enabled[] = "cache_enabled";
+
+    Config::ConfigItem configItems[] = {
+            Config::ConfigItem(json_name_corrections, Config::SectionId::TX_id, "", paramsUpdatedCallback),
+            Config::ConfigItem(json_name_cache_enabled, Config::SectionId::TX_id, true, paramsUpdatedCallback),
+            Config::ConfigItem()};
+
+    namespace capture {
+      const uint16_t maxEdges = TX_CALIBRATION_PULSES_PER_BUCKET * 2 + 4;
+      volatile unsigned long edges_us[maxEdges];
+      volatile uint8_t levels[maxEdges];
+      volatile uint16_t count = 0;
+
+      void IRAM_ATTR onEdge() {
+        if (count < maxEdges) {
+          edges_us[count] = micros();
+          levels[count] = digitalRead(Radio::pins::RX_DATA);
+          count++;
+        }
+      }
+    }
+
+    namespace cache {
+      void clear();
+    }
+
+    void clearCorrections() {
+      cache::clear(); // cached pulses were computed with the previous corrections
+      for (auto &levelCorrections : runtime::corrections)
+        for (auto &correction : levelCorrections)
+          correction = 0;
+      runtime::calibrated = false;
+    }
+
+    /**
+     * @return false if string is malformed, in which case corrections are left to 0
+     * */
+    bool parseCorrections(const char *str) {
+      clearCorrections();
+
+      if (str == nullptr || str[0] == 0)
+        return true;
+
+      const char *ptr = str;
+      char *end;
+
+      for (int level = 0; level < 2; level++) {
+        for (int bucket = 0; bucket < TX_CORRECTION_BUCKETS; bucket++) {
+          long value = strtol(ptr, &end, 10);
+          if (end == ptr || value < -1000 || value > 1000) {
+            clearCorrections();
+            return false;
+          }
+          runtime::corrections[level][bucket] = (int16_t) value;
+          ptr = end;
+          if (bucket < TX_CORRECTION_BUCKETS - 1) {
+            if (*ptr != ',') {
+              clearCorrections();
+              return false;
+            }
+            ptr++;
+          }
+        }
+        if (level == 0) {
+          if (*ptr != ';') {
+            clearCorrections();
+            return false;
+          }
+          ptr++;
+        }
+      }
+
+      runtime::calibrated = true;
+      return true;
+    }
+
+    void correctionsToString(String &destination) {
+      char buffer[8];
+      destination = "";
+      for (int level = 0; level < 2; level++) {
+        for (int bucket = 0; bucket < TX_CORRECTION_BUCKETS; bucket++) {
+          itoa(runtime::corrections[level][bucket], buffer, 10);
+          destination += buffer;
+          if (bucket < TX_CORRECTION_BUCKETS - 1)
+            destination += ',';
+        }
+        if (level == 0)
+          destination += ';';
+      }
+    }
+
+    void paramsUpdatedCallback() {
+      refreshParametersFromConfig();
+    }
+
+    void refreshParametersFromConfig(bool triggerChanges) {
+      Config::ConfigItem *item;
+
+      item = Config::findConfigItem(json_name_corrections, Config::SectionId::TX_id);
+      if (params::corrections != item->getCharValue()) {
+        params::corrections = item->getCharValue();
+        if (!parseCorrections(params::corrections.c_str()))
+          Serial.println(F("Invalid TX corrections table found in config, transmitter timings will not be compensated"));
+        else if (triggerChanges)
+          Serial.println(F("TX timing corrections have changed."));
+      }
+
+      item = Config::findConfigItem(json_name_cache_enabled, Config::SectionId::TX_id);
+      if (params::cacheEnabled != item->getBoolValue()) {
+        params::cacheEnabled = item->getBoolValue();
+        if (!params::cacheEnabled)
+          cache::clear();
+        if (triggerChanges)
+          Serial.println(F("TX cache settings have changed."));
+      }
+    }
+
+    void setup() {
+      clearCorrections();
+      refreshParametersFromConfig(false);
+    }
+
+    /**
+     * Sends a train of HIGH/LOW pulses of the given length and computes the average error
+     * seen by the RX pin for each level.
+     * */
+    bool measureBucket(uint8_t bucket, float &highError_us, float &lowError_us) {
+      unsigned long reference_us = calibrationReferences_us[bucket];
+
+      digitalWrite(Radio::pins::TX_DATA, LOW);
+      runtime::lastLevel = LOW;
+      delay(5); // let the receiver settle on a steady LOW
+
+      capture::count = 0;
+      attachInterrupt(digitalPinToInterrupt(Radio::pins::RX_DATA), capture::onEdge, CHANGE);
+
+      for (int i = 0; i < TX_CALIBRATION_PULSES_PER_BUCKET; i++) {
+        sendPulse(HIGH, reference_us);
+        sendPulse(LOW, reference_us);
+      }
+      sendPulse(HIGH, reference_us); // terminates the last LOW pulse
+      digitalWrite(Radio::pins::TX_DATA, LOW);
+      delayMicroseconds(reference_us);
+
+      detachInterrupt(digitalPinToInterrupt(Radio::pins::RX_DATA));
+
+      uint16_t edgesCount = capture::count;
+      if (edgesCount < TX_CALIBRATION_PULSES_PER_BUCKET)
+        return false;
+
+      // a receiver may invert the signal, the first captured edge tells us which level is the "mark"
+      uint8_t markLevel = capture::levels[0];
+      long highErrorTotal = 0, lowErrorTotal = 0;
+      int highCount = 0, lowCount = 0;
+
+      // first pulse pair is skipped as it includes receiver wake up time
+      for (uint16_t i = 2; i + 1 < edgesCount; i++) {
+        long error = (long) (capture::edges_us[i + 1] - capture::edges_us[i]) - (long) reference_us;
+        if (capture::levels[i] == markLevel) {
+          highErrorTotal += error;
+          highCount++;
+        } else {
+          lowErrorTotal += error;
+          lowCount++;
+        }
+      }
+
+      if (highCount == 0 || lowCount == 0)
+        return false;
+
+      highError_us = (float) highErrorTotal / highCount;
+      lowError_us = (float) lowErrorTotal / lowCount;
+      return true;
+    }
+
+    bool measureAll(float errors[2][TX_CORRECTION_BUCKETS]) {
+      for (uint8_t bucket = 0; bucket < TX_CORRECTION_BUCKETS; bucket++) {
+        if (!measureBucket(bucket, errors[0][bucket], errors[1][bucket]))
+          return false;
+        yield();
+      }
+      return true;
+    }
+
+    bool calibrate(bool saveToFlash) {
+      if (Radio::pins::TX_DATA == NOT_A_PIN || Radio::pins::RX_DATA == NOT_A_PIN) {
+        sendRawPrint(F("20;XX;DEBUG;TXCAL;ERROR=TX_DATA and RX_DATA pins are required;"), true);
+        return false;
+      }
+
+      bool asyncWasRunning = Signal::AsyncSignalScanner::isEnabled() && !Signal::AsyncSignalScanner::isStopped();
+      if (asyncWasRunning)
+        Signal::AsyncSignalScanner::stopScanning();
+
+      Radio::set_Radio_mode(Radio::States::Radio_TX);
+      pinMode(Radio::pins::RX_DATA, INPUT);
+
+      float errors[2][TX_CORRECTION_BUCKETS];
+      bool success = measureAll(errors);
+
+      if (success) {
+        // errors were measured with current corrections applied, so they are residuals to add up
+        for (int level = 0; level < 2; level++)
+          for (int bucket = 0; bucket < TX_CORRECTION_BUCKETS; bucket++)
+            runtime::corrections[level][bucket] += (int16_t) lroundf(errors[level][bucket]);
+        cache::clear();
+
+        success = measureAll(errors); // verification pass
+      }
+
+      Radio::set_Radio_mode(Radio::States::Radio_RX);
+      if (asyncWasRunning)
+        Signal::AsyncSignalScanner::startScanning();
+
+      if (!success) {
+        sendRawPrint(F("20;XX;DEBUG;TXCAL;ERROR=no loopback signal captured on RX pin, check wiring;"), true);
+        parseCorrections(params::corrections.c_str()); // restore previous table
+        return false;
+      }
+
+      float totalError = 0;
+      for (int bucket = 0; bucket < TX_CORRECTION_BUCKETS; bucket++) {
+        sprintf_P(printBuf, PSTR("20;XX;DEBUG;TXCAL;PULSE=%u;HIGH_CORR=%i;LOW_CORR=%i;HIGH_ERR=%.1f;LOW_ERR=%.1f;"),
+                  calibrationReferences_us[bucket],
+                  runtime::corrections[0][bucket], runtime::corrections[1][bucket],
+                  errors[0][bucket], errors[1][bucket]);
+        sendRawPrint(printBuf, true);
+        totalError += fabsf(errors[0][bucket]) + fabsf(errors[1][bucket]);
+      }
+      runtime::residualError_us = totalError / (2 * TX_CORRECTION_BUCKETS);
+      runtime::calibrated = true;
+
+      sprintf_P(printBuf, PSTR("20;XX;DEBUG;TXCAL;RESIDUAL_ERR=%.1f;"), runtime::residualError_us);
+      sendRawPrint(printBuf, true);
+
+      correctionsToString(params::corrections);
+
+      if (saveToFlash) {
+        Config::ConfigItem *item = Config::findConfigItem(json_name_corrections, Config::SectionId::TX_id);
+        item->setCharValue(params::corrections.c_str());
+        Config::saveConfigToFlash();
+      }
+
+      return true;
+    }
+
+    void resetCalibration() {
+      clearCorrections();
+      runtime::residualError_us = 0.0F;
+      params::corrections = "";
+      Config::ConfigItem *item = Config::findConfigItem(json_name_corrections, Config::SectionId::TX_id);
+      item->setCharValue("");
+      Config::saveConfigToFlash();
+    }
+
+    namespace recorder {
+
+      struct Frame {
+        uint16_t firstPulse;
+        uint16_t pulsesCount;
+        uint16_t repeats;        // identical consecutive frames are stored once
+        uint32_t minGapAfter_us; // silence required before the next frame of the same item
+        int32_t frequency;       // 0 when the encoder did not ask for a specific one
+      };
+
+      enum ItemStatus : uint8_t {
+        Item_Unknown,  // no plugin accepted the command
+        Item_Full,     // batch buffers exhausted
+        Item_Recorded, // waiting for playback
+        Item_Sent      // nothing recorded, the plugin transmitted it by itself
+      };
+
+      struct Item {
+        uint16_t firstFrame;
+        uint16_t framesCount;
+        ItemStatus status;
+        // playback cursor
+        uint16_t currentFrame;
+        uint16_t repeatsDone;
+        uint32_t gap_us;
+        unsigned long lastEnd_us;
+      };
+
+      struct Buffers {
+        uint16_t pulses[TX_BATCH_MAX_PULSES]; // bit 15 is the level, the rest is the duration in us
+        Frame frames[TX_BATCH_MAX_FRAMES];
+        Item items[TX_BATCH_MAX_ITEMS];
+      };
+
+      bool active = false;
+      bool tap = false;
+      bool volatileOutput;
+      Buffers *buffers = nullptr;
+
+      // where pulses and frames are being recorded to
+      uint16_t *pulses;
+      uint16_t maxPulses;
+      Frame *frames;
+      uint16_t maxFrames;
+
+      uint16_t pulsesCount;
+      uint16_t framesCount;
+      uint16_t frameStart;    // first pulse of the frame being recorded
+      uint16_t itemFirstPulse;
+      uint16_t itemFirstFrame;
+      int32_t frequency;
+      int32_t baseFrequency; // radio frequency when the item started
+      bool overflow;
+
+      const uint16_t levelBit = 0x8000;
+      const uint16_t durationMask = 0x7FFF;
+
+      void setTarget(uint16_t *pulsesBuffer, uint16_t pulsesSize, Frame *framesBuffer, uint16_t framesSize) {
+        pulses = pulsesBuffer;
+        maxPulses = pulsesSize;
+        frames = framesBuffer;
+        maxFrames = framesSize;
+        pulsesCount = 0;
+        framesCount = 0;
+      }
+
+      void addPulse(uint8_t level, unsigned long duration_us) {
+        while (duration_us > 0 && !overflow) {
+          // longer pulses are split in consecutive chunks of the same level
+          uint16_t chunk = duration_us > durationMask ? durationMask : duration_us;
+          if (pulsesCount >= maxPulses) {
+            overflow = true;
+            return;
+          }
+          pulses[pulsesCount++] = (level == HIGH ? levelBit : 0) | chunk;
+          duration_us -= chunk;
+        }
+      }
+
+      void beginItem() {
+        runtime::lastLevel = LOW;
+        frameStart = pulsesCount;
+        itemFirstPulse = pulsesCount;
+        itemFirstFrame = framesCount;
+        frequency = 0;
+        baseFrequency = Radio::getFrequency();
+        overflow = false;
+        volatileOutput = false;
+      }
+
+      void closeFrame(unsigned long minGapAfter_us) {
+        if (overflow)
+          return;
+
+        uint16_t count = pulsesCount - frameStart;
+
+        if (count == 0) {
+          if (framesCount > itemFirstFrame && frames[framesCount - 1].minGapAfter_us < minGapAfter_us)
+            frames[framesCount - 1].minGapAfter_us = minGapAfter_us;
+          return;
+        }
+
+        if (framesCount > itemFirstFrame) {
+          Frame &previous = frames[framesCount - 1];
+          if (previous.pulsesCount == count && previous.frequency == frequency && previous.minGapAfter_us == minGapAfter_us &&
+              memcmp(&pulses[previous.firstPulse], &pulses[frameStart], count * sizeof(uint16_t)) == 0) {
+            previous.repeats++;
+            pulsesCount = frameStart;
+            return;
+          }
+        }
+
+        if (framesCount >= maxFrames) {
+          overflow = true;
+          return;
+        }
+
+        Frame &frame = frames[framesCount++];
+        frame.firstPulse = frameStart;
+        frame.pulsesCount = count;
+        frame.repeats = 1;
+        frame.minGapAfter_us = minGapAfter_us;
+        frame.frequency = frequency;
+        frameStart = pulsesCount;
+      }
+
+      /**
+       * Copies already encoded frames (from the cache) as the current item
+       * */
+      void appendFrames(const uint16_t *sourcePulses, const Frame *sourceFrames, uint16_t sourceFramesCount) {
+        for (uint16_t i = 0; i < sourceFramesCount && !overflow; i++) {
+          const Frame &source = sourceFrames[i];
+          if (framesCount >= maxFrames || pulsesCount + source.pulsesCount > maxPulses) {
+            overflow = true;
+            return;
+          }
+          Frame &frame = frames[framesCount++];
+          frame = source;
+          frame.firstPulse = pulsesCount;
+          memcpy(&pulses[pulsesCount], &sourcePulses[source.firstPulse], source.pulsesCount * sizeof(uint16_t));
+          pulsesCount += source.pulsesCount;
+        }
+        frameStart = pulsesCount;
+      }
+
+      void endItem(Item &item, bool accepted) {
+        closeFrame(0); // encoders which do not call endFrame() are recorded as a single frame
+
+        if (!accepted || overflow) {
+          // drop whatever was recorded for this item
+          pulsesCount = itemFirstPulse;
+          framesCount = itemFirstFrame;
+          item.status = accepted ? Item_Full : Item_Unknown;
+          item.framesCount = 0;
+          return;
+        }
+
+        item.firstFrame = itemFirstFrame;
+        item.framesCount = framesCount - itemFirstFrame;
+        item.status = item.framesCount > 0 ? Item_Recorded : Item_Sent;
+        item.currentFrame = 0;
+        item.repeatsDone = 0;
+        item.gap_us = 0;
+        item.lastEnd_us = 0;
+      }
+
+      void playFrame(const uint16_t *framePulses, const Frame &frame) {
+        const uint16_t *pulse = &framePulses[frame.firstPulse];
+        const uint16_t *end = pulse + frame.pulsesCount;
+        noInterrupts(); // as RawSendRF(), WiFi and timer interrupts would stretch pulses
+        for (; pulse < end; pulse++) {
+          digitalWrite(Radio::pins::TX_DATA, (*pulse & levelBit) ? HIGH : LOW);
+          delayMicroseconds(*pulse & durationMask);
+        }
+        digitalWrite(Radio::pins::TX_DATA, LOW);
+        interrupts();
+      }
+
+      void waitGap(unsigned long lastEnd_us, uint32_t gap_us) {
+        unsigned long elapsed = micros() - lastEnd_us;
+        if (elapsed < gap_us) {
+          unsigned long remaining = gap_us - elapsed;
+          if (remaining >= 1000)
+            delay(remaining / 1000);
+          delayMicroseconds(remaining % 1000);
+        }
+      }
+
+      void selectFrequency(const Frame &frame, int32_t defaultFrequency, int32_t &currentFrequency) {
+        int32_t wanted = frame.frequency != 0 ? frame.frequency : defaultFrequency;
+        if (wanted != currentFrequency) {
+          Radio::setFrequency(wanted);
+          currentFrequency = wanted;
+        }
+      }
+
+      /**
+       * Plays frames of a single item in order, with their repeats and gaps
+       * */
+      void playFrames(const uint16_t *framePulses, const Frame *framesList, uint16_t count) {
+        int32_t originalFrequency = Radio::getFrequency();
+        int32_t currentFrequency = originalFrequency;
+        unsigned long lastEnd_us = 0;
+        uint32_t gap_us = 0;
+
+        for (uint16_t i = 0; i < count; i++) {
+          const Frame &frame = framesList[i];
+          selectFrequency(frame, originalFrequency, currentFrequency);
+          for (uint16_t repeat = 0; repeat < frame.repeats; repeat++) {
+            if (lastEnd_us != 0)
+              waitGap(lastEnd_us, gap_us);
+            playFrame(framePulses, frame);
+            lastEnd_us = micros() | 1;
+            gap_us = frame.minGapAfter_us;
+          }
+        }
+
+        if (currentFrequency != originalFrequency)
+          Radio::setFrequency(originalFrequency);
+      }
+
+      /**
+       * @return time the frames keep the transmitter busy, including gaps between them
+       * */
+      unsigned long airtime_us(const uint16_t *framePulses, const Frame *framesList, uint16_t count) {
+        unsigned long total = 0;
+        for (uint16_t i = 0; i < count; i++) {
+          const Frame &frame = framesList[i];
+          unsigned long frameDuration = 0;
+          for (uint16_t p = 0; p < frame.pulsesCount; p++)
+            frameDuration += framePulses[frame.firstPulse + p] & durationMask;
+          total += (frameDuration + frame.minGapAfter_us) * frame.repeats;
+        }
+        if (count > 0) // no gap after the very last frame
+          total -= framesList[count - 1].minGapAfter_us;
+        return total;
+      }
+
+      /**
+       * Round-robin over items: each pass sends the next frame of every item still having some,
+       * so the silence an item needs between its repeats is spent sending the others.
+       * */
+      void playAll(uint8_t itemsCount) {
+        int32_t originalFrequency = Radio::getFrequency();
+        int32_t currentFrequency = originalFrequency;
+        bool pending = true;
+
+        while (pending) {
+          pending = false;
+
+          for (uint8_t i = 0; i < itemsCount; i++) {
+            Item &item = buffers->items[i];
+            if (item.status != Item_Recorded || item.currentFrame >= item.framesCount)
+              continue;
+
+            const Frame &frame = buffers->frames[item.firstFrame + item.currentFrame];
+
+            if (item.lastEnd_us != 0)
+              waitGap(item.lastEnd_us, item.gap_us);
+
+            selectFrequency(frame, originalFrequency, currentFrequency);
+
+            playFrame(buffers->pulses, frame);
+            item.lastEnd_us = micros() | 1; // 0 means 'never sent'
+            item.gap_us = frame.minGapAfter_us;
+
+            if (++item.repeatsDone >= frame.repeats) {
+              item.currentFrame++;
+              item.repeatsDone = 0;
+            }
+            if (item.currentFrame < item.framesCount)
+              pending = true;
+          }
+          yield();
+        }
+
+        if (currentFrequency != originalFrequency)
+          Radio::setFrequency(originalFrequency);
+      }
+    }
+
+    namespace cache {
+
+      struct Entry {
+        char *key;        // normalised command, nullptr when the slot is free
+        uint32_t hash;
+        uint32_t timing;  // see timing()
+        recorder::Frame *frames; // frames are followed by their pulses in the same allocation
+        uint16_t *pulses;
+        uint16_t framesCount;
+        uint16_t pulsesCount;
+        uint32_t encodeTime_us; // what it cost to produce this entry from the plugin
+        uint32_t lastUse;
+      };
+
+      Entry entries[TX_CACHE_MAX_ENTRIES];
+      uint16_t totalPulses = 0;
+      uint32_t useClock = 0;
+
+      /**
+       * Upper case, no blanks, always ending with ';' so "10;newkaku;00c142;1;on" and "10;NewKaku;00c142;1;ON;" match
+       * @return false if the command does not fit in a key
+       * */
+      bool makeKey(const char *cmd, char *key, uint32_t &hash) {
+        uint16_t length = 0;
+        hash = 2166136261UL; // FNV-1a
+
+        for (const char *c = cmd; *c != 0; c++) {
+          if (*c == ' ' || *c == '\r' || *c == '\n' || *c == '\t')
+            continue;
+          if (length >= TX_CACHE_KEY_SIZE - 2)
+            return false;
+          key[length] = toupper(*c);
+          hash = (hash ^ (uint8_t) key[length]) * 16777619UL;
+          length++;
+        }
+
+        if (length == 0)
+          return false;
+        if (key[length - 1] != ';') {
+          key[length++] = ';';
+          hash = (hash ^ (uint8_t) ';') * 16777619UL;
+        }
+        key[length] = 0;
+        return true;
+      }
+
+      Entry *find(const char *key, uint32_t hash, uint32_t timing) {
+        for (auto &entry : entries) {
+          if (entry.key != nullptr && entry.hash == hash && entry.timing == timing && strcmp(entry.key, key) == 0) {
+            entry.lastUse = ++useClock;
+            return &entry;
+          }
+        }
+        return nullptr;
+      }
+
+      void release(Entry &entry) {
+        if (entry.key == nullptr)
+          return;
+        totalPulses -= entry.pulsesCount;
+        free(entry.key);
+        free(entry.frames);
+        entry.key = nullptr;
+        entry.frames = nullptr;
+        entry.pulses = nullptr;
+      }
+
+      void clear() {
+        for (auto &entry : entries)
+          release(entry);
+      }
+
+      uint16_t sampleRate = 0; // sample rate the entries were encoded with
+
+      /**
+       * What encoders derive pulse lengths from besides the command: the sample rate, and the Multiply RawSignal holds
+       * when they start. Entries are only played with the timing they were encoded with, all of them go when the
+       * sample rate changes.
+       * */
+      uint32_t timing() {
+        if (sampleRate != Signal::params::sample_rate) {
+          clear();
+          sampleRate = Signal::params::sample_rate;
+        }
+        return ((uint32_t) Signal::params::sample_rate << 8) | Signal::RawSignal.Multiply;
+      }
+
+      Entry *leastRecentlyUsed() {
+        Entry *oldest = nullptr;
+        for (auto &entry : entries) {
+          if (entry.key == nullptr)
+            return &entry;
+          if (oldest == nullptr || entry.lastUse < oldest->lastUse)
+            oldest = &entry;
+        }
+        return oldest;
+      }
+
+      /**
+       * Stores frames recorded from a plugin, their pulses must be contiguous in framePulses
+       * */
+      void store(const char *key, uint32_t hash, uint32_t timing, const uint16_t *framePulses,
+                 const recorder::Frame *framesList, uint16_t count, uint32_t encodeTime_us) {
+        if (count == 0)
+          return;
+
+        uint16_t firstPulse = framesList[0].firstPulse;
+        const recorder::Frame &last = framesList[count - 1];
+        uint16_t pulsesCount = last.firstPulse + last.pulsesCount - firstPulse;
+
+        if (pulsesCount > TX_CACHE_MAX_PULSES)
+          return;
+
+        // make room, least recently used entries go first
+        Entry *slot = leastRecentlyUsed();
+        release(*slot);
+        while (totalPulses + pulsesCount > TX_CACHE_MAX_PULSES) {
+          Entry *victim = nullptr;
+          for (auto &entry : entries)
+            if (entry.key != nullptr && (victim == nullptr || entry.lastUse < victim->lastUse))
+              victim = &entry;
+          if (victim == nullptr)
+            break;
+          release(*victim);
+        }
+
+        size_t framesSize = count * sizeof(recorder::Frame);
+        auto *block = (uint8_t *) malloc(framesSize + pulsesCount * sizeof(uint16_t));
+        char *keyCopy = strdup(key);
+        if (block == nullptr || keyCopy == nullptr) {
+          free(block);
+          free(keyCopy);
+          return;
+        }
+
+        slot->key = keyCopy;
+        slot->hash = hash;
+        slot->timing = timing;
+        slot->frames = (recorder::Frame *) block;
+        slot->pulses = (uint16_t *) (block + framesSize);
+        slot->framesCount = count;
+        slot->pulsesCount = pulsesCount;
+        slot->encodeTime_us = encodeTime_us;
+        slot->lastUse = ++useClock;
+
+        memcpy(slot->pulses, &framePulses[firstPulse], pulsesCount * sizeof(uint16_t));
+        for (uint16_t i = 0; i < count; i++) {
+          slot->frames[i] = framesList[i];
+          slot->frames[i].firstPulse -= firstPulse;
+        }
+        totalPulses += pulsesCount;
+      }
+
+      uint8_t entriesCount() {
+        uint8_t count = 0;
+        for (auto &entry : entries)
+          if (entry.key != nullptr)
+            count++;
+        return count;
+      }
+
+      void recordHit(const Entry &entry, unsigned long lookup_us) {
+        counters::cacheHits++;
+        if (entry.encodeTime_us > lookup_us)
+          counters::cacheTimeSaved_us += entry.encodeTime_us - lookup_us;
+      }
+    }
+
+    void endFrame(unsigned long minGapAfter_us) {
+      runtime::lastLevel = LOW; // frames are played on their own, the pin is LOW before each of them
+      if (recorder::active || recorder::tap)
+        recorder::closeFrame(minGapAfter_us);
+    }
+
+    void markVolatile() {
+      recorder::volatileOutput = true;
+    }
+
+    int32_t setFrequency(int32_t newFrequency) {
+      if (recorder::active || recorder::tap) {
+        int32_t previous = recorder::frequency != 0 ? recorder::frequency : recorder::baseFrequency;
+        // going back to the usual frequency is stored as 'no specific frequency'
+        recorder::frequency = (newFrequency == recorder::baseFrequency) ? 0 : newFrequency;
+        if (recorder::active)
+          return previous;
+      }
+      return Radio::setFrequency(newFrequency);
+    }
+
+    bool sendCommand(const char *cmd) {
+      char key[TX_CACHE_KEY_SIZE];
+      uint32_t hash;
+
+      runtime::lastLevel = LOW;
+
+      if (!params::cacheEnabled || !cache::makeKey(cmd, key, hash))
+        return PluginTXCall(0, cmd);
+
+      unsigned long start_us = micros();
+      uint32_t timing = cache::timing();
+      cache::Entry *entry = cache::find(key, hash, timing);
+      if (entry != nullptr) {
+        cache::recordHit(*entry, micros() - start_us);
+        recorder::playFrames(entry->pulses, entry->frames, entry->framesCount);
+        return true;
+      }
+      counters::cacheMisses++;
+
+      // transmit as usual while recording what the plugin sends
+      auto *scratchFrames = (recorder::Frame *) malloc(TX_CACHE_MAX_ENTRY_FRAMES * sizeof(recorder::Frame));
+      auto *scratchPulses = (uint16_t *) malloc(TX_CACHE_MAX_ENTRY_PULSES * sizeof(uint16_t));
+      if (scratchFrames == nullptr || scratchPulses == nullptr) {
+        free(scratchFrames);
+        free(scratchPulses);
+        return PluginTXCall(0, cmd);
+      }
+
+      recorder::setTarget(scratchPulses, TX_CACHE_MAX_ENTRY_PULSES, scratchFrames, TX_CACHE_MAX_ENTRY_FRAMES);
+      recorder::beginItem();
+      recorder::tap = true;
+      start_us = micros();
+      bool accepted = PluginTXCall(0, cmd);
+      unsigned long elapsed_us = micros() - start_us;
+      recorder::tap = false;
+      recorder::closeFrame(0);
+
+      if (accepted && !recorder::overflow && !recorder::volatileOutput && recorder::framesCount > 0) {
+        unsigned long air_us = recorder::airtime_us(scratchPulses, scratchFrames, recorder::framesCount);
+        cache::store(key, hash, timing, scratchPulses, scratchFrames, recorder::framesCount, elapsed_us > air_us ? elapsed_us - air_us : 0);
+      }
+
+      free(scratchFrames);
+      free(scratchPulses);
+      return accepted;
+    }
+
+    void acknowledgeBatchItem(uint8_t index, recorder::ItemStatus status) {
+      char name[32];
+      const char *result;
+
+      switch (status) {
+        case recorder::Item_Recorded:
+        case recorder::Item_Sent:
+          result = PSTR("OK");
+          break;
+        case recorder::Item_Full:
+          result = PSTR("BATCH FULL");
+          break;
+        default:
+          result = PSTR("CMD UNKNOWN");
+      }
+
+      sprintf_P(name, PSTR("%s;BATCH_ITEM=%u"), result, index + 1);
+      display_Header();
+      display_Name(name);
+      display_Footer();
+      sendMsgFromBuffer();
+    }
+
+    /**
+     * Records one batch item, from the cache when possible
+     * */
+    void encodeBatchItem(recorder::Item &item) {
+      char key[TX_CACHE_KEY_SIZE];
+      uint32_t hash;
+      bool cacheable = params::cacheEnabled && cache::makeKey(InputBuffer_Serial, key, hash);
+      uint32_t timing = cacheable ? cache::timing() : 0;
+
+      recorder::beginItem();
+
+      if (cacheable) {
+        unsigned long start_us = micros();
+        cache::Entry *entry = cache::find(key, hash, timing);
+        if (entry != nullptr) {
+          recorder::appendFrames(entry->pulses, entry->frames, entry->framesCount);
+          cache::recordHit(*entry, micros() - start_us);
+          recorder::endItem(item, true);
+          return;
+        }
+        counters::cacheMisses++;
+      }
+
+      unsigned long start_us = micros();
+      bool accepted = PluginTXCall(0, InputBuffer_Serial);
+      unsigned long elapsed_us = micros() - start_us;
+      bool storable = cacheable && !recorder::volatileOutput;
+
+      recorder::endItem(item, accepted);
+
+      if (storable && item.status == recorder::Item_Recorded)
+        cache::store(key, hash, timing, recorder::pulses, &recorder::frames[item.firstFrame], item.framesCount, elapsed_us);
+    }
+
+    bool sendBatch(const char *commands) {
+      if (Radio::pins::TX_DATA == NOT_A_PIN) {
+        sendRawPrint(F("20;XX;DEBUG;BATCH;ERROR=no TX_DATA pin;"), true);
+        return false;
+      }
+
+      // plugins parse InputBuffer_Serial, which may be where our list lives
+      char *list = strdup(commands);
+      recorder::buffers = (recorder::Buffers *) malloc(sizeof(recorder::Buffers));
+
+      if (list == nullptr || recorder::buffers == nullptr) {
+        free(list);
+        free(recorder::buffers);
+        recorder::buffers = nullptr;
+        sendRawPrint(F("20;XX;DEBUG;BATCH;ERROR=not enough memory;"), true);
+        return false;
+      }
+
+      unsigned long startTime = millis();
+      uint8_t itemsCount = 0;
+      uint8_t sentCount = 0;
+
+      recorder::setTarget(recorder::buffers->pulses, TX_BATCH_MAX_PULSES, recorder::buffers->frames, TX_BATCH_MAX_FRAMES);
+
+      // one TX session for the whole batch, plugins which bit-bang by themselves still transmit right away
+      Radio::set_Radio_mode(Radio::States::Radio_TX);
+      recorder::active = true;
+
+      char *item = list;
+      while (item != nullptr && *item != 0) {
+        char *next = strchr(item, TX_BATCH_SEPARATOR);
+        if (next != nullptr)
+          *next++ = 0;
+
+        while (*item == ' ')
+          item++;
+
+        if (*item != 0) {
+          if (itemsCount >= TX_BATCH_MAX_ITEMS) {
+            Serial.printf_P(PSTR("Batch: only %u items are supported, remaining ones are ignored\r\n"), TX_BATCH_MAX_ITEMS);
+            break;
+          }
+
+          if (strncmp(item, "10;", 3) == 0)
+            snprintf(InputBuffer_Serial, INPUT_COMMAND_SIZE, "%s", item);
+          else
+            snprintf(InputBuffer_Serial, INPUT_COMMAND_SIZE, "10;%s", item);
+
+          encodeBatchItem(recorder::buffers->items[itemsCount]);
+          itemsCount++;
+        }
+        item = next;
+      }
+
+      recorder::active = false;
+      recorder::playAll(itemsCount);
+
+      Radio::set_Radio_mode(Radio::States::Radio_RX);
+
+      // acks are only sent once everything went out so publishing them cannot stretch the interleaved frames
+      for (uint8_t i = 0; i < itemsCount; i++) {
+        acknowledgeBatchItem(i, recorder::buffers->items[i].status);
+        if (recorder::buffers->items[i].status >= recorder::Item_Recorded)
+          sentCount++;
+      }
+
+      sprintf_P(printBuf, PSTR("20;XX;DEBUG;BATCH;ITEMS=%u;SENT=%u;PULSES=%u;FRAMES=%u;DURATION_MS=%lu;"),
+                itemsCount, sentCount, recorder::pulsesCount, recorder::framesCount, millis() - startTime);
+      sendRawPrint(printBuf, true);
+
+      free(recorder::buffers);
+      recorder::buffers = nullptr;
+      free(list);
+      InputBuffer_Serial[0] = 0;
+
+      return sentCount > 0;
+    }
+
+    // letters, digits and the few characters used in IDs and protocol names, nothing which splits a command
+    bool isValidField(const char *field, bool required) {
+      if (*field == 0)
+        return !required;
+      for (; *field != 0; field++) {
+        if (!isalnum(*field) && *field != '_' && *field != '-' && *field != '.')
+          return false;
+      }
+      return true;
+    }
+
+    bool queueRequest(const Request &request) {
+      if (!isValidField(request.protocol, true) || !isValidField(request.id, true) ||
+          !isValidField(request.switchId, false) || !isValidField(request.command, true) ||
+          queue::count >= TX_QUEUE_SIZE) {
+        counters::requestsRejected++;
+        return false;
+      }
+
+      Request &slot = queue::requests[queue::head];
+      slot = request;
+      slot.queuedAt = millis();
+      queue::head = (queue::head + 1) % TX_QUEUE_SIZE;
+      queue::count++;
+      counters::requestsQueued++;
+      return true;
+    }
+
+    uint8_t queuedRequests() {
+      return queue::count;
+    }
+
+    void mainLoop() {
+      if (queue::count == 0)
+        return;
+
+      const Request &request = queue::requests[(queue::head + TX_QUEUE_SIZE - queue::count) % TX_QUEUE_SIZE];
+      queue::count--;
+      unsigned long wait_ms = millis() - request.queuedAt;
+      if (wait_ms > counters::requestMaxWait_ms)
+        counters::requestMaxWait_ms = wait_ms;
+
+      // plugins parse InputBuffer_Serial, the same line gives the same encoder cache key as a 10;... command
+      if (request.switchId[0] != 0)
+        snprintf_P(InputBuffer_Serial, INPUT_COMMAND_SIZE, PSTR("10;%s;%s;%s;%s;"),
+                   request.protocol, request.id, request.switchId, request.command);
+      else
+        snprintf_P(InputBuffer_Serial, INPUT_COMMAND_SIZE, PSTR("10;%s;%s;%s;"), request.protocol, request.id, request.command);
+
+      uint8_t previousClass = Messages::setClass(Messages::Class_Reply);
+      Radio::set_Radio_mode(Radio::Radio_TX);
+      bool accepted = sendCommand(InputBuffer_Serial);
+      Radio::set_Radio_mode(Radio::Radio_RX);
+      InputBuffer_Serial[0] = 0;
+
+      if (accepted)
+        counters::requestsSent++;
+      else
+        counters::requestsRejected++;
+      display_Header();
+      display_Name(accepted ? PSTR("OK") : PSTR("CMD UNKNOWN"));
+      display_Footer();
+      Messages::setClass(previousClass);
+    }
+
+    void showCache() {
+      unsigned long lookups = counters::cacheHits + counters::cacheMisses;
+      sprintf_P(printBuf, PSTR("20;XX;DEBUG;TXCACHE;ENABLED=%i;ENTRIES=%u;PULSES=%u;HITS=%lu;MISSES=%lu;HIT_RATE=%lu%%;SAVED_US=%lu;"),
+                (int) params::cacheEnabled, cache::entriesCount(), cache::totalPulses,
+                counters::cacheHits, counters::cacheMisses,
+                lookups > 0 ? counters::cacheHits * 100 / lookups : 0UL, counters::cacheTimeSaved_us);
+      sendRawPrint(printBuf, true);
+    }
+
+    void executeCliCommand(char *cmd) {
+      char *commaIndex = strchr(cmd, ';');
+
+      if (commaIndex == nullptr) {
+        Serial.println(F("Error : failed to find ending ';' for the command"));
+        return;
+      }
+
+      int commandSize = commaIndex - cmd;
+      *commaIndex = 0; // replace ';' with null termination
+
+      if (strncasecmp_P(cmd, commands::calibrate, commandSize) == 0) {
+        calibrate();
+      }
+      else if (strncasecmp_P(cmd, commands::resetCalibration, commandSize) == 0) {
+        resetCalibration();
+        sendRawPrint(F("20;XX;DEBUG;TXCAL;RESET;"), true);
+      }
+      else if (strncasecmp_P(cmd, commands::batch, commandSize) == 0) {
+        sendBatch(commaIndex + 1);
+      }
+      else if (strncasecmp_P(cmd, commands::showCache, commandSize) == 0) {
+        showCache();
+      }
+      else if (strncasecmp_P(cmd, commands::clearCache, commandSize) == 0) {
+        cache::clear();
+        sendRawPrint(F("20;XX;DEBUG;TXCACHE;CLEARED;"), true);
+      }
+      else if (strncasecmp_P(cmd, commands::showCalibration, commandSize) == 0) {
+        sprintf_P(printBuf, PSTR("20;XX;DEBUG;TXCAL;CALIBRATED=%i;CORRECTIONS=%s;RESIDUAL_ERR=%.1f;"),
+                  (int) runtime::calibrated, params::corrections.c_str(), runtime::residualError_us);
+        sendRawPrint(printBuf, true);
+      }
+      else {
+        Serial.printf_P(PSTR("Error : unknown command '%s'\r\n"), cmd);
+      }
+    }
+
+    void getStatusJsonString(JsonObject &output) {
+      auto &&tx = output.createNestedObject("tx");
+      tx[F("calibrated")] = runtime::calibrated;
+      if (runtime::calibrated) {
+        tx[F("corrections")] = params::corrections;
+        tx[F("residual_error_us")] = runtime::residualError_us;
+      }
+
+      auto &&txCache = tx.createNestedObject("cache");
+      txCache[F("enabled")] = params::cacheEnabled;
+      txCache[F("entries")] = cache::entriesCount();
+      txCache[F("hits")] = counters::cacheHits;
+      txCache[F("misses")] = counters::cacheMisses;
+      txCache[F("time_saved_us")] = counters::cacheTimeSaved_us;
+
+      auto &&txQueue = tx.createNestedObject("queue");
+      txQueue[F("pending")] = queue::count;
+      txQueue[F("capacity")] = TX_QUEUE_SIZE;
+      txQueue[F("queued")] = counters::requestsQueued;
+      txQueue[F("sent")] = counters::requestsSent;
+      txQueue[F("rejected")] = counters::requestsRejected;
+      txQueue[F("max_wait_ms")] = counters::requestMaxWait_ms;
+    }
+
+  } // end of TX namespace
+} // end of RFLink namespace
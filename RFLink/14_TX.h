@@ -0,0 +1,189 @@
+#ifndef _14_TX_H_
+#define _14_TX_H_
+
+#include <Arduino.h>
+#include "RFLink.h"
+#include "1_Radio.h"
+#include "11_Config.h"
+
+#define TX_CORRECTION_BUCKETS 4            // number of pulse length classes in the correction table
+#define TX_CALIBRATION_PULSES_PER_BUCKET 16 // HIGH+LOW pairs sent for each class during calibration
+
+// limits of a batch ("scene") transmission, buffers are only allocated while a batch is being sent
+#ifdef ESP32
+#define TX_BATCH_MAX_ITEMS 32
+#define TX_BATCH_MAX_FRAMES 160
+#define TX_BATCH_MAX_PULSES 8192
+#else
+#define TX_BATCH_MAX_ITEMS 16
+#define TX_BATCH_MAX_FRAMES 64
+#define TX_BATCH_MAX_PULSES 2048
+#endif
+#define TX_BATCH_SEPARATOR '|'
+
+// encoder cache: recently sent commands are kept as ready to play pulse trains
+#ifdef ESP32
+#define TX_CACHE_MAX_ENTRIES 16
+#define TX_CACHE_MAX_PULSES 4096       // all entries together
+#define TX_CACHE_MAX_ENTRY_PULSES 1024 // commands producing more are not cached
+#else
+#define TX_CACHE_MAX_ENTRIES 6
+#define TX_CACHE_MAX_PULSES 1024
+#define TX_CACHE_MAX_ENTRY_PULSES 512
+#endif
+#define TX_CACHE_MAX_ENTRY_FRAMES 16
+#define TX_CACHE_KEY_SIZE 64
+
+// structured requests (MQTT command topics) waiting to be transmitted, one is sent per mainLoop() call
+#ifdef ESP32
+#define TX_QUEUE_SIZE 8
+#else
+#define TX_QUEUE_SIZE 4
+#endif
+
+namespace RFLink {
+  namespace TX {
+
+    extern Config::ConfigItem configItems[];
+
+    namespace params {
+      extern String corrections; // "h0,h1,h2,h3;l0,l1,l2,l3" in microseconds, empty when not calibrated
+      extern bool cacheEnabled;
+    }
+
+    namespace runtime {
+      // measured extra time (us) that a HIGH [0] or LOW [1] pulse takes on this board, per pulse length class
+      extern int16_t corrections[2][TX_CORRECTION_BUCKETS];
+      extern bool calibrated;
+      extern float residualError_us; // mean absolute edge-to-edge error after the last calibration
+      extern uint8_t lastLevel;      // level the previous sendPulse() left the pin at, LOW at a frame start
+    }
+
+    namespace counters {
+      extern unsigned long int cacheHits;
+      extern unsigned long int cacheMisses;
+      extern unsigned long int cacheTimeSaved_us; // parsing/encoding time not spent thanks to the cache
+      extern unsigned long int requestsQueued;
+      extern unsigned long int requestsSent;     // accepted by a plugin
+      extern unsigned long int requestsRejected; // invalid, queue full, or refused by every plugin
+      extern unsigned long int requestMaxWait_ms; // longest time a request spent in the queue
+    }
+
+    /**
+     * A command for one device, given field by field instead of as a 10;... line
+     * */
+    struct Request {
+      char protocol[24];
+      char id[16];
+      char switchId[8]; // empty for protocols without switch
+      char command[8];  // ON, OFF, ALLON, ALLOFF, UP, DOWN, STOP, PAIR, or a level
+      unsigned long queuedAt;
+    };
+
+    namespace recorder {
+      extern bool active; // set while a batch is being encoded, pulses are then stored instead of transmitted
+      extern bool tap;    // set while filling the cache, pulses are stored and transmitted
+      void addPulse(uint8_t level, unsigned long duration_us);
+    }
+
+    // upper bound (inclusive, in us) of each pulse length class
+    extern const uint16_t correctionBucketLimits[TX_CORRECTION_BUCKETS];
+
+    void setup();
+    void paramsUpdatedCallback();
+    void refreshParametersFromConfig(bool triggerChanges=true);
+
+    inline uint8_t correctionBucket(unsigned long duration_us) {
+      uint8_t bucket = 0;
+      while (bucket < TX_CORRECTION_BUCKETS - 1 && duration_us > correctionBucketLimits[bucket])
+        bucket++;
+      return bucket;
+    }
+
+    /**
+     * @return the delay to request from delayMicroseconds() so the pulse really lasts duration_us on air
+     */
+    inline unsigned long correctedDuration(uint8_t level, unsigned long duration_us) {
+      int16_t correction = runtime::corrections[level == HIGH ? 0 : 1][correctionBucket(duration_us)];
+      if (correction >= 0)
+        return (duration_us > (unsigned long) correction) ? duration_us - correction : 0;
+      return duration_us + (unsigned long) (-correction);
+    }
+
+    /**
+     * Drives the TX pin to 'level' for duration_us, compensated with the calibration table.
+     * All bit-bang encoders should go through this instead of digitalWrite()+delayMicroseconds()
+     * Corrections are edge latencies: a pulse of the same level as the previous one only extends it and is not corrected.
+     * */
+    inline void sendPulse(uint8_t level, unsigned long duration_us) {
+      unsigned long corrected = level == runtime::lastLevel ? duration_us : correctedDuration(level, duration_us);
+      runtime::lastLevel = level;
+      if (recorder::active || recorder::tap) {
+        recorder::addPulse(level, corrected);
+        if (recorder::active)
+          return;
+      }
+      digitalWrite(Radio::pins::TX_DATA, level);
+      delayMicroseconds(corrected);
+    }
+
+    inline bool isRecording() { return recorder::active; }
+
+    /**
+     * Encoders call this after each repeat of their frame so a batch can interleave repeats of several devices.
+     * Does nothing outside of a batch.
+     * @param minGapAfter_us minimum silence required before the next frame of the same device
+     * */
+    void endFrame(unsigned long minGapAfter_us=0);
+
+    /**
+     * Same as Radio::setFrequency() but, during a batch, the frequency is stored with the frame being recorded
+     * and applied at playback time.
+     * */
+    int32_t setFrequency(int32_t newFrequency);
+
+    /**
+     * Called by encoders whose output changes at each transmission (rolling codes) so it is never replayed from cache
+     * */
+    void markVolatile();
+
+    /**
+     * Sends a plugin TX command, replaying its pulses from the encoder cache when it was sent recently.
+     * @return true if a plugin accepted the command
+     * */
+    bool sendCommand(const char *cmd);
+
+    /**
+     * Encodes every TX command of the list (separated by TX_BATCH_SEPARATOR) then plays all of them in a single
+     * radio TX session, interleaving repeats (A1 B1 C1 A2 B2 C2 ...). Each item is acknowledged once sent.
+     * @return false if nothing could be sent
+     * */
+    bool sendBatch(const char *commands);
+
+    /**
+     * Checks a request and queues it, mainLoop() transmits it and replies OK or CMD UNKNOWN like a 10;... command
+     * @return false if a field is empty, too long or has characters a command cannot hold, or the queue is full
+     * */
+    bool queueRequest(const Request &request);
+    uint8_t queuedRequests();
+
+    /**
+     * Transmits the oldest queued request, if any
+     * */
+    void mainLoop();
+
+    /**
+     * Measures edge-to-edge timing errors of the transmitter by capturing its own output on the RX pin
+     * (requires TX_DATA to be looped back to RX_DATA, by wire or through a receiver) and updates
+     * the correction table accordingly.
+     * @return false if calibration could not be completed
+     * */
+    bool calibrate(bool saveToFlash=true);
+    void resetCalibration();
+
+    void executeCliCommand(char *cmd);
+    void getStatusJsonString(JsonObject &output);
+  }
+}
+
+#endif // _14_TX_H_
@@ -0,0 +1,432 @@
+#include <Arduino.h>
+#include "RFLink.h"
+#include "4_Display.h"
+#include "6_MQTT.h"
+#include "8_OLED.h"
+#include "9_Serial2Net.h"
+#include "15_Messages.h"
+#include "18_Outbox.h"
+#include "19_Events.h"
+
+namespace RFLink {
+  namespace Messages {
+
+    namespace commands {
+      const char showQueue[] PROGMEM = "showQueue";
+      const char resetCounters[] PROGMEM = "resetCounters";
+    }
+
+    namespace params {
+      DropPolicy dropPolicy = DropOldest;
+    }
+
+    namespace runtime {
+      uint8_t currentClass = Class_Decode;
+      uint8_t currentPlugin = 0;
+    }
+
+    namespace counters {
+      unsigned long int accepted = 0;
+      unsigned long int droppedOldest = 0;
+      unsigned long int droppedNewest = 0;
+      unsigned long int truncated = 0;
+      uint8_t highWatermark = 0;
+      SinkCounters sinks[Sink_EOF];
+    }
+
+    const char json_name_drop_policy[] = "drop_policy";
+    const char drop_policy_oldest[] PROGMEM = "oldest";
+    const char drop_policy_newest[] PROGMEM = "newest";
+
+    Config::ConfigItem configItems[] = {
+            Config::ConfigItem(json_name_drop_policy, Config::SectionId::Messages_id, "oldest", paramsUpdatedCallback),
+            Config::ConfigItem()};
+
+    const char *const sinkNames[Sink_EOF] = {"serial", "mqtt", "serial2net", "oled", "events"};
+
+    // MessageClass names, in flags order
+    const char *const classNames[] = {"decode", "reply", "debug", "pulses"};
+    const uint8_t classNamesCount = sizeof(classNames) / sizeof(char *);
+
+    uint8_t parseClasses(const char *list) {
+      uint8_t result = 0;
+      const char *token = list;
+
+      while (*token != 0) {
+        size_t length = strcspn(token, ",;");
+        if (length == 3 && strncasecmp_P(token, PSTR("all"), 3) == 0)
+          result = MESSAGE_CLASS_ALL;
+        else if (length == 4 && strncasecmp_P(token, PSTR("none"), 4) == 0)
+          result = 0;
+        else if (length > 0) {
+          uint8_t index = 0;
+          while (index < classNamesCount &&
+                 (strlen(classNames[index]) != length || strncasecmp(token, classNames[index], length) != 0))
+            index++;
+          if (index == classNamesCount)
+            return 0xFF;
+          result |= 1 << index;
+        }
+        token += length;
+        if (*token == ';')
+          break;
+        if (*token == ',')
+          token++;
+      }
+      return result;
+    }
+
+    void classesToString(uint8_t classes, char *destination) {
+      destination[0] = 0;
+      for (uint8_t index = 0; index < classNamesCount; index++) {
+        if (classes & (1 << index)) {
+          if (destination[0] != 0)
+            strcat(destination, ",");
+          strcat(destination, classNames[index]);
+        }
+      }
+      if (destination[0] == 0)
+        strcpy_P(destination, PSTR("none"));
+    }
+
+    static_assert((MESSAGES_QUEUE_SIZE & (MESSAGES_QUEUE_SIZE - 1)) == 0, "MESSAGES_QUEUE_SIZE must be a power of 2");
+
+    // Messages are stored once and each sink walks the store with its own cursor (the sequence of the next message
+    // it has to send). A slot is reused once every sink has moved past it.
+    namespace store {
+      Message slots[MESSAGES_QUEUE_SIZE];
+      uint32_t head = 0; // sequence of the next message to be pushed
+      uint32_t tail = 0; // oldest sequence still needed by a sink
+      uint32_t cursors[Sink_EOF];
+
+      inline Message &slot(uint32_t sequence) { return slots[sequence % MESSAGES_QUEUE_SIZE]; }
+      inline uint8_t used() { return head - tail; }
+    }
+
+    /**
+     * @return true if the sink is compiled in and enabled. Inactive sinks follow the head of the store and never lag.
+     * */
+    bool sinkActive(SinkId sink) {
+      switch (sink) {
+        case Sink_Serial:
+#ifdef SERIAL_ENABLED
+          return true;
+#else
+          return false;
+#endif
+        case Sink_MQTT:
+#ifndef RFLINK_MQTT_DISABLED
+          return Mqtt::params::enabled;
+#else
+          return false;
+#endif
+        case Sink_Serial2Net:
+#ifndef RFLINK_SERIAL2NET_DISABLED
+          return Serial2Net::params::enabled;
+#else
+          return false;
+#endif
+        case Sink_OLED:
+#ifdef OLED_ENABLED
+          return true;
+#else
+          return false;
+#endif
+        case Sink_Events:
+#ifndef RFLINK_PORTAL_DISABLED
+          return Events::params::enabled && Events::clientsCount() > 0;
+#else
+          return false;
+#endif
+        default:
+          return false;
+      }
+    }
+
+    /**
+     * @return true if the sink can take the message right now without blocking
+     * */
+    bool sinkReady(SinkId sink, const Message &message) {
+      switch (sink) {
+        case Sink_Serial:
+          return Serial.availableForWrite() >= (int) (Binary::params::serial ? message.frameLength : message.length);
+#ifndef RFLINK_MQTT_DISABLED
+        case Sink_MQTT:
+          return Mqtt::canPublish(); // reconnection is left to Mqtt::checkMQTTloop()
+#endif
+        default:
+          return true;
+      }
+    }
+
+    bool sinkWrite(SinkId sink, const Message &message) {
+      switch (sink) {
+        case Sink_Serial:
+          if (Binary::params::serial) // messages without a frame (built without footer or too long) are not sent
+            return message.frameLength == 0 || Serial.write(message.frame, message.frameLength) == message.frameLength;
+          return Serial.write((const uint8_t *) message.text, message.length) == message.length;
+#ifndef RFLINK_MQTT_DISABLED
+        case Sink_MQTT:
+          return Mqtt::publishMsg(message);
+#endif
+#ifndef RFLINK_SERIAL2NET_DISABLED
+        case Sink_Serial2Net:
+          Serial2Net::broadcastMessage(message);
+          return true;
+#endif
+#ifdef OLED_ENABLED
+        case Sink_OLED:
+          show_OLED(message); // only updates the view, loop_OLED() draws it
+          return true;
+#endif
+#ifndef RFLINK_PORTAL_DISABLED
+        case Sink_Events:
+          Events::broadcastMessage(message); // slow clients drop events on their own
+          return true;
+#endif
+        default:
+          return true;
+      }
+    }
+
+    void updateTail() {
+      uint8_t maxLag = 0;
+      for (int sink = 0; sink < Sink_EOF; sink++) {
+        if (!sinkActive((SinkId) sink))
+          store::cursors[sink] = store::head;
+        uint8_t sinkLag = store::head - store::cursors[sink];
+        if (sinkLag > maxLag)
+          maxLag = sinkLag;
+      }
+      store::tail = store::head - maxLag;
+    }
+
+    void paramsUpdatedCallback() {
+      refreshParametersFromConfig();
+    }
+
+    void refreshParametersFromConfig(bool triggerChanges) {
+      Config::ConfigItem *item;
+
+      item = Config::findConfigItem(json_name_drop_policy, Config::SectionId::Messages_id);
+      DropPolicy newPolicy = params::dropPolicy;
+      if (strcasecmp_P(item->getCharValue(), drop_policy_oldest) == 0)
+        newPolicy = DropOldest;
+      else if (strcasecmp_P(item->getCharValue(), drop_policy_newest) == 0)
+        newPolicy = DropNewest;
+      else
+        Serial.printf_P(PSTR("Invalid messages drop_policy '%s' found in config, expected 'oldest' or 'newest'\r\n"), item->getCharValue());
+
+      if (params::dropPolicy != newPolicy) {
+        params::dropPolicy = newPolicy;
+        if (triggerChanges)
+          Serial.println(F("Messages queue drop policy has changed."));
+      }
+    }
+
+    void setup() {
+      refreshParametersFromConfig(false);
+    }
+
+    bool push(const char *text, const uint8_t *frame, uint8_t frameLength) {
+      bool dropped = false;
+
+      updateTail();
+#ifndef RFLINK_MQTT_DISABLED
+      // MQTT moves what it could not publish yet to its outbox rather than losing it
+      if (store::used() == MESSAGES_QUEUE_SIZE && store::cursors[Sink_MQTT] == store::tail &&
+          sinkActive(Sink_MQTT) && Outbox::spill(store::slot(store::tail))) {
+        store::cursors[Sink_MQTT]++;
+        updateTail();
+      }
+#endif
+      if (store::used() == MESSAGES_QUEUE_SIZE) {
+        if (params::dropPolicy == DropNewest) {
+          counters::droppedNewest++;
+          return false;
+        }
+        // reclaim the oldest slot, sinks still waiting for it skip it
+        for (int sink = 0; sink < Sink_EOF; sink++) {
+          if (store::cursors[sink] == store::tail) {
+            store::cursors[sink]++;
+            counters::sinks[sink].dropped++;
+          }
+        }
+        store::tail++;
+        counters::droppedOldest++;
+        dropped = true;
+      }
+
+      Message &message = store::slot(store::head);
+      size_t length = strnlen(text, PRINT_BUFFER_SIZE);
+      if (length > PRINT_BUFFER_SIZE - 1) {
+        length = PRINT_BUFFER_SIZE - 1;
+        counters::truncated++;
+      }
+      memcpy(message.text, text, length);
+      message.text[length] = 0;
+      message.length = length;
+      message.frameLength = (frame != nullptr && frameLength <= BINARY_MAX_FRAME_SIZE) ? frameLength : 0;
+      if (message.frameLength > 0)
+        memcpy(message.frame, frame, message.frameLength);
+      message.messageClass = runtime::currentClass;
+      message.pluginId = runtime::currentPlugin;
+      message.sequence = store::head;
+      message.captured = time(nullptr);
+      store::head++;
+
+      counters::accepted++;
+      if (store::used() > counters::highWatermark)
+        counters::highWatermark = store::used();
+      for (int sink = 0; sink < Sink_EOF; sink++) {
+        uint8_t sinkLag = store::head - store::cursors[sink];
+        if (sinkActive((SinkId) sink) && sinkLag > counters::sinks[sink].maxLag)
+          counters::sinks[sink].maxLag = sinkLag;
+      }
+
+      return !dropped;
+    }
+
+    bool commitBuffer() {
+      if (pbuffer[0] == 0)
+        return true;
+      uint8_t frameLength;
+      const uint8_t *frame = Binary::frame(frameLength);
+      bool result = push(pbuffer, frame, frameLength);
+      Binary::discardEvent();
+      pbuffer[0] = 0;
+      return result;
+    }
+
+    void sendBurst(SinkId sink, int limit = MESSAGES_SINK_BURST, bool waitForSink = false) {
+      for (int burst = 0; burst < limit && store::cursors[sink] != store::head; burst++) {
+        const Message &message = store::slot(store::cursors[sink]);
+        if (!waitForSink && !sinkReady(sink, message))
+          break;
+        if (sinkWrite(sink, message)) {
+          counters::sinks[sink].sent++;
+          counters::sinks[sink].bytes += (sink == Sink_Serial && Binary::params::serial) ? message.frameLength : message.length;
+        }
+        else
+          counters::sinks[sink].dropped++;
+        store::cursors[sink]++;
+      }
+    }
+
+    void drain(SinkId sink) {
+      if (!sinkActive(sink)) {
+        store::cursors[sink] = store::head;
+        return;
+      }
+
+#ifndef RFLINK_MQTT_DISABLED
+      if (sink == Sink_MQTT) {
+        Mqtt::beginBatch();
+        // messages moved to the outbox are older than the queued ones, they go first
+        if (Outbox::replay())
+          sendBurst(sink);
+        Mqtt::endBatch();
+        return;
+      }
+#endif
+
+      sendBurst(sink);
+    }
+
+    void drain() {
+      for (int sink = 0; sink < Sink_EOF; sink++)
+        drain((SinkId) sink);
+      updateTail();
+    }
+
+    void catchUpRawSinks() {
+      // Serial.write() waits for the UART like the raw output itself, Serial2Net only queues
+      for (SinkId sink : {Sink_Serial, Sink_Serial2Net}) {
+        if (sinkActive(sink) && store::cursors[sink] != store::head)
+          sendBurst(sink, MESSAGES_QUEUE_SIZE, true);
+      }
+    }
+
+    uint8_t count() {
+      updateTail();
+      return store::used();
+    }
+
+    uint8_t lag(SinkId sink) {
+      if (!sinkActive(sink))
+        return 0;
+      return store::head - store::cursors[sink];
+    }
+
+    void clear() {
+      for (auto &cursor : store::cursors)
+        cursor = store::head;
+      store::tail = store::head;
+    }
+
+    void executeCliCommand(char *cmd) {
+      char *commaIndex = strchr(cmd, ';');
+
+      if (commaIndex == nullptr) {
+        Serial.println(F("Error : failed to find ending ';' for the command"));
+        return;
+      }
+
+      int commandSize = commaIndex - cmd;
+      *commaIndex = 0; // replace ';' with null termination
+
+      if (strncasecmp_P(cmd, commands::showQueue, commandSize) == 0) {
+        sprintf_P(printBuf, PSTR("20;XX;DEBUG;MESSAGES;QUEUED=%u;CAPACITY=%u;POLICY=%s;ACCEPTED=%lu;DROPPED_OLDEST=%lu;DROPPED_NEWEST=%lu;TRUNCATED=%lu;HIGH_WATERMARK=%u;"),
+                  (unsigned int) count(), (unsigned int) MESSAGES_QUEUE_SIZE,
+                  params::dropPolicy == DropOldest ? "OLDEST" : "NEWEST",
+                  counters::accepted, counters::droppedOldest, counters::droppedNewest, counters::truncated,
+                  (unsigned int) counters::highWatermark);
+        sendRawPrint(printBuf, true);
+        for (int sink = 0; sink < Sink_EOF; sink++) {
+          sprintf_P(printBuf, PSTR("20;XX;DEBUG;MESSAGES;SINK=%s;ACTIVE=%i;LAG=%u;MAX_LAG=%u;SENT=%lu;BYTES=%lu;DROPPED=%lu;"),
+                    sinkNames[sink], (int) sinkActive((SinkId) sink), (unsigned int) lag((SinkId) sink),
+                    (unsigned int) counters::sinks[sink].maxLag, counters::sinks[sink].sent,
+                    counters::sinks[sink].bytes, counters::sinks[sink].dropped);
+          sendRawPrint(printBuf, true);
+        }
+      }
+      else if (strncasecmp_P(cmd, commands::resetCounters, commandSize) == 0) {
+        counters::accepted = 0;
+        counters::droppedOldest = 0;
+        counters::droppedNewest = 0;
+        counters::truncated = 0;
+        counters::highWatermark = count();
+        for (int sink = 0; sink < Sink_EOF; sink++)
+          counters::sinks[sink] = SinkCounters();
+        sendRawPrint(F("20;XX;DEBUG;MESSAGES;COUNTERS RESET;"), true);
+      }
+      else {
+        Serial.printf_P(PSTR("Error : unknown command '%s'\r\n"), cmd);
+      }
+    }
+
+    void getStatusJsonString(JsonObject &output) {
+      auto &&messages = output.createNestedObject("messages");
+      messages[F("queued")] = count();
+      messages[F("capacity")] = MESSAGES_QUEUE_SIZE;
+      messages[F("drop_policy")] = params::dropPolicy == DropOldest ? "oldest" : "newest";
+      messages[F("accepted")] = counters::accepted;
+      messages[F("dropped_oldest")] = counters::droppedOldest;
+      messages[F("dropped_newest")] = counters::droppedNewest;
+      messages[F("truncated")] = counters::truncated;
+      messages[F("high_watermark")] = counters::highWatermark;
+
+      auto &&sinks = messages.createNestedObject("sinks");
+      for (int sink = 0; sink < Sink_EOF; sink++) {
+        auto &&sinkStatus = sinks.createNestedObject(sinkNames[sink]);
+        sinkStatus[F("active")] = sinkActive((SinkId) sink);
+        sinkStatus[F("lag")] = lag((SinkId) sink);
+        sinkStatus[F("max_lag")] = counters::sinks[sink].maxLag;
+        sinkStatus[F("sent")] = counters::sinks[sink].sent;
+        sinkStatus[F("bytes")] = counters::sinks[sink].bytes;
+        sinkStatus[F("dropped")] = counters::sinks[sink].dropped;
+      }
+    }
+
+  } // end of Messages namespace
+} // end of RFLink namespace
@@ -0,0 +1,149 @@
+#ifndef _15_MESSAGES_H_
+#define _15_MESSAGES_H_
+
+#include <Arduino.h>
+#include "RFLink.h"
+#include "4_Display.h"
+#include "11_Config.h"
+#include "16_Binary.h"
+
+// number of complete messages (20;XX;...;\r\n) kept until every sink (Serial, MQTT, Serial2Net, OLED, live events) has sent them
+#ifdef ESP32
+#define MESSAGES_QUEUE_SIZE 16
+#else
+#define MESSAGES_QUEUE_SIZE 8
+#endif
+#define MESSAGES_SINK_BURST 4 // messages a sink may send per drain() call, so one output never holds the main loop
+
+namespace RFLink {
+  namespace Messages {
+
+    extern Config::ConfigItem configItems[];
+
+    enum SinkId {
+      Sink_Serial,
+      Sink_MQTT,
+      Sink_Serial2Net,
+      Sink_OLED,
+      Sink_Events,
+      Sink_EOF // must always be the last!
+    };
+    extern const char *const sinkNames[Sink_EOF];
+
+    // what a message is about, so outputs can be subscribed to some of them only
+    enum MessageClass {
+      Class_Decode = 0x01, // decoded RF signals
+      Class_Reply = 0x02,  // anything printed while running a CLI command
+      Class_Debug = 0x04,  // debug traces printed with sendRawPrint()
+      Class_Pulses = 0x08, // raw pulses dumps (RFDEBUG, RFUDEBUG ...)
+    };
+#define MESSAGE_CLASS_ALL 0x0F
+
+    enum DropPolicy {
+      DropOldest, // a full queue makes room by discarding its oldest message, for the sinks which did not send it yet
+      DropNewest, // a full queue refuses the new message, for all sinks
+    };
+
+    namespace params {
+      extern DropPolicy dropPolicy;
+    }
+
+    struct SinkCounters {
+      unsigned long int sent;
+      unsigned long int bytes;
+      unsigned long int dropped; // messages this sink never sent, because it lagged or its write failed
+      uint8_t maxLag;            // maximum number of messages this sink had to catch up with
+    };
+
+    namespace runtime {
+      extern uint8_t currentClass;  // class of what is being printed right now, Class_Decode outside of CLI commands
+      extern uint8_t currentPlugin; // number of the plugin being called by PluginRXCall(), 0 otherwise
+    }
+
+    namespace counters {
+      extern unsigned long int accepted;
+      extern unsigned long int droppedOldest;
+      extern unsigned long int droppedNewest;
+      extern unsigned long int truncated; // messages longer than PRINT_BUFFER_SIZE-1
+      extern uint8_t highWatermark;       // maximum number of messages queued at once
+      extern SinkCounters sinks[Sink_EOF];
+    }
+
+    struct Message {
+      uint32_t sequence; // increases by one for each accepted message, a gap means messages were dropped
+      uint32_t captured; // unix time it was queued at
+      uint8_t length;
+      uint8_t messageClass;
+      uint8_t pluginId;
+      char text[PRINT_BUFFER_SIZE];
+      uint8_t frameLength; // 0 when no binary frame was built for this message
+      uint8_t frame[BINARY_MAX_FRAME_SIZE];
+    };
+
+    /**
+     * Tags what is printed from now on with messageClass
+     * @return the previous class, to be restored once done
+     * */
+    inline uint8_t setClass(uint8_t messageClass) {
+      uint8_t previous = runtime::currentClass;
+      runtime::currentClass = messageClass;
+      return previous;
+    }
+
+    // class of sendRawPrint() output: debug traces, unless a CLI command or a pulses dump is running
+    inline uint8_t rawPrintClass() {
+      return runtime::currentClass == Class_Decode ? (uint8_t) Class_Debug : runtime::currentClass;
+    }
+
+    // raw pulses dumps, unless printed for a CLI command (testRF ...) in which case they are part of the reply
+    inline uint8_t beginPulsesDump() {
+      return setClass(runtime::currentClass == Class_Reply ? (uint8_t) Class_Reply : (uint8_t) Class_Pulses);
+    }
+
+    void setup();
+    void paramsUpdatedCallback();
+    void refreshParametersFromConfig(bool triggerChanges=true);
+
+    /**
+     * Copies a complete message into the queue, never blocks.
+     * @return false if the message (or, with DropOldest, an older one) had to be dropped
+     * */
+    bool push(const char *text, const uint8_t *frame = nullptr, uint8_t frameLength = 0);
+
+    /**
+     * Queues the message built in pbuffer by the display_* functions, with its binary frame if any,
+     * and empties pbuffer for the next producer
+     * */
+    bool commitBuffer();
+
+    /**
+     * Sends pending messages to each sink which can take them without blocking, at most MESSAGES_SINK_BURST
+     * per sink. A sink which is not ready (MQTT disconnected, Serial TX buffer full ...) is retried on the next call
+     * while the other ones go on.
+     * */
+    void drain();
+    void drain(SinkId sink);
+
+    /**
+     * Sends to Serial and Serial2Net all the messages they did not take yet, called before sendRawPrint() output
+     * so a reply or a debug trace never goes out ahead of decoded signals queued before it
+     * */
+    void catchUpRawSinks();
+
+    /**
+     * @param list comma separated class names (decode, reply, debug, pulses), "all" or "none", ends at ';' if any
+     * @return MessageClass flags, 0xFF if a name is unknown
+     * */
+    uint8_t parseClasses(const char *list);
+    void classesToString(uint8_t classes, char *destination); // "none" or names joined with ',', 32 bytes at most
+
+    uint8_t count(); // messages not sent yet by at least one sink
+    uint8_t lag(SinkId sink);
+    void clear();
+
+    void executeCliCommand(char *cmd);
+    void getStatusJsonString(JsonObject &output);
+  }
+}
+
+#endif // _15_MESSAGES_H_
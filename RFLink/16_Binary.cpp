@@ -0,0 +1,499 @@
+#include <Arduino.h>
+#include "RFLink.h"
+#include "4_Display.h"
+#include "6_MQTT.h"
+#include "9_Serial2Net.h"
+#include "15_Messages.h"
+#include "16_Binary.h"
+#include "17_Cache.h"
+
+namespace RFLink {
+  namespace Binary {
+
+    namespace params {
+      bool serial = false;
+    }
+
+    namespace counters {
+      unsigned long int frames = 0;
+      unsigned long int overflows = 0;
+    }
+
+    const char json_name_serial[] = "serial";
+
+    Config::ConfigItem configItems[] = {
+            Config::ConfigItem(json_name_serial, Config::SectionId::Binary_id, false, paramsUpdatedCallback),
+            Config::ConfigItem()};
+
+    namespace event {
+      uint8_t buffer[BINARY_MAX_FRAME_SIZE];
+      uint8_t length = 0;  // bytes used in buffer, payload starts at index 3
+      bool building = false;
+      bool overflow = false;
+      bool complete = false;
+    }
+
+    namespace names {
+      uint16_t ids[BINARY_NAMES_COUNT];
+      const char *texts[BINARY_NAMES_COUNT]; // string literals of the plugins, never released
+      uint8_t count = 0;
+    }
+
+    void paramsUpdatedCallback() {
+      refreshParametersFromConfig();
+    }
+
+    void refreshParametersFromConfig(bool triggerChanges) {
+      Config::ConfigItem *item;
+
+      item = Config::findConfigItem(json_name_serial, Config::SectionId::Binary_id);
+      if (params::serial != item->getBoolValue()) {
+        params::serial = item->getBoolValue();
+        if (triggerChanges)
+          Serial.println(params::serial ? F("Serial now prints binary frames.") : F("Serial now prints text lines."));
+      }
+    }
+
+    void setup() {
+      refreshParametersFromConfig(false);
+    }
+
+    uint16_t crc16(const uint8_t *data, uint8_t length) {
+      uint16_t crc = 0xFFFF;
+      while (length-- > 0) {
+        crc ^= (uint16_t) (*data++) << 8;
+        for (uint8_t bit = 0; bit < 8; bit++)
+          crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+      }
+      return crc;
+    }
+
+    inline bool reserve(uint8_t size) {
+      if (event::length + size > BINARY_MAX_FRAME_SIZE - 2) { // keep room for the CRC
+        event::overflow = true;
+        return false;
+      }
+      return true;
+    }
+
+    void beginEvent(uint8_t sequence) {
+      // frames are only built while someone reads them
+      event::building = params::serial;
+#ifdef OLED_ENABLED
+      event::building = true; // the screen shows decoded fields
+#endif
+#ifndef RFLINK_SERIAL2NET_DISABLED
+      event::building = event::building || Serial2Net::hasBinaryClient();
+#endif
+#ifndef RFLINK_MQTT_DISABLED
+      event::building = event::building || (Mqtt::params::enabled && (Mqtt::params::json_enabled || Cache::params::enabled));
+#endif
+      event::complete = false;
+      event::overflow = false;
+      event::length = 3; // sync, length and type are set by endEvent()
+      addNumber(Tag_Sequence, sequence);
+    }
+
+    void addNumber(uint8_t tag, unsigned long value, uint8_t minSize) {
+      if (!event::building)
+        return;
+
+      uint8_t size = minSize < 1 ? 1 : (minSize > 4 ? 4 : minSize);
+      while (size < 4 && (value >> (size * 8)) != 0)
+        size++;
+      if (!reserve(2 + size))
+        return;
+
+      event::buffer[event::length++] = tag;
+      event::buffer[event::length++] = size;
+      for (uint8_t i = 0; i < size; i++)
+        event::buffer[event::length++] = (value >> (i * 8)) & 0xFF;
+    }
+
+    void addText(uint8_t tag, const char *text, bool fromFlash) {
+      if (!event::building)
+        return;
+
+      size_t size = fromFlash ? strlen_P(text) : strlen(text);
+      if (size > 255 || !reserve(2 + size))
+        return;
+
+      event::buffer[event::length++] = tag;
+      event::buffer[event::length++] = size;
+      if (fromFlash)
+        memcpy_P(&event::buffer[event::length], text, size);
+      else
+        memcpy(&event::buffer[event::length], text, size);
+      event::length += size;
+    }
+
+    uint16_t nameId(const char *name) {
+      uint32_t hash = 2166136261UL;
+      for (uint8_t c; (c = pgm_read_byte(name)) != 0; name++)
+        hash = (hash ^ c) * 16777619UL;
+      return (hash >> 16) ^ (hash & 0xFFFF);
+    }
+
+    PGM_P nameText(uint16_t id) {
+      for (uint8_t i = 0; i < names::count; i++) {
+        if (names::ids[i] == id)
+          return names::texts[i];
+      }
+      return nullptr;
+    }
+
+    bool sameName(const char *name, const char *other) {
+      for (;; name++, other++) {
+        uint8_t c = pgm_read_byte(name);
+        if (c != pgm_read_byte(other))
+          return false;
+        if (c == 0)
+          return true;
+      }
+    }
+
+    void addName(const char *name) {
+      if (!event::building)
+        return;
+
+      // names printed outside of plugins (CLI replies ...) may be built in a RAM buffer, they can't be kept
+      if (Messages::runtime::currentPlugin != 0) {
+        uint16_t id = nameId(name);
+        PGM_P known = nameText(id);
+        if (known == nullptr && names::count < BINARY_NAMES_COUNT) {
+          names::ids[names::count] = id;
+          names::texts[names::count++] = name;
+          known = name;
+        }
+        if (known != nullptr && (known == name || sameName(known, name))) {
+          addNumber(Tag_NameId, id, 2);
+          return;
+        }
+      }
+      addText(Tag_Name, name, true);
+    }
+
+    void endEvent(uint8_t messageClass, float rssi, uint8_t pluginId) {
+      if (!event::building)
+        return;
+
+      if (rssi > -1000.0F) { // -9999 when the radio does not report it
+        int16_t tenths = (int16_t) (rssi * 10.0F);
+        if (reserve(4)) {
+          event::buffer[event::length++] = Tag_RSSI;
+          event::buffer[event::length++] = 2;
+          event::buffer[event::length++] = tenths & 0xFF;
+          event::buffer[event::length++] = (tenths >> 8) & 0xFF;
+        }
+      }
+
+      struct timeval now;
+      gettimeofday(&now, nullptr);
+      if (reserve(8)) {
+        uint32_t seconds = now.tv_sec;
+        uint16_t milliseconds = now.tv_usec / 1000;
+        event::buffer[event::length++] = Tag_Timestamp;
+        event::buffer[event::length++] = 6;
+        for (uint8_t i = 0; i < 4; i++)
+          event::buffer[event::length++] = (seconds >> (i * 8)) & 0xFF;
+        event::buffer[event::length++] = milliseconds & 0xFF;
+        event::buffer[event::length++] = milliseconds >> 8;
+      }
+
+      if (pluginId != 0)
+        addNumber(Tag_Plugin, pluginId);
+
+      if (event::overflow) {
+        counters::overflows++;
+        discardEvent();
+        return;
+      }
+
+      event::buffer[0] = BINARY_SYNC;
+      event::buffer[1] = event::length - 2; // type + payload
+      event::buffer[2] = messageClass;
+      uint16_t crc = crc16(&event::buffer[1], event::length - 1);
+      event::buffer[event::length++] = crc & 0xFF;
+      event::buffer[event::length++] = crc >> 8;
+
+      event::complete = true;
+      counters::frames++;
+    }
+
+    void discardEvent() {
+      event::building = false;
+      event::complete = false;
+    }
+
+    const uint8_t *frame(uint8_t &length) {
+      if (!event::complete) {
+        length = 0;
+        return nullptr;
+      }
+      length = event::length;
+      return event::buffer;
+    }
+
+    enum FieldKind {
+      Kind_Number,
+      Kind_Tenths,       // unsigned, needs division by 10
+      Kind_SignedTenths, // sign in bit 15, needs division by 10
+      Kind_Hex,          // hexadecimal text, as many digits as bytes * 2
+      Kind_Text,
+      Kind_Other,        // converted by frameToJson() itself
+    };
+
+    FieldKind fieldKind(uint8_t tag) {
+      switch (tag) {
+        case Tag_Temp:
+        case Tag_WinChl:
+        case Tag_WinTmp:
+          return Kind_SignedTenths;
+        case Tag_Rain:
+        case Tag_RainRate:
+        case Tag_WinSp:
+        case Tag_AWinSp:
+          return Kind_Tenths;
+        case Tag_ID:
+        case Tag_Switch:
+          return Kind_Hex;
+        case Tag_Name:
+        case Tag_IDText:
+        case Tag_SwitchText:
+          return Kind_Text;
+        case Tag_NameId:
+        case Tag_Cmd:
+        case Tag_Bat:
+        case Tag_SmokeAlert:
+        case Tag_PIR:
+        case Tag_RSSI:
+        case Tag_Timestamp:
+          return Kind_Other;
+        default:
+          return Kind_Number;
+      }
+    }
+
+    PGM_P fieldName(uint8_t tag) {
+      switch (tag) {
+        case Tag_Sequence: return PSTR("seq");
+        case Tag_Name:
+        case Tag_NameId: return PSTR("protocol");
+        case Tag_ID:
+        case Tag_IDText: return PSTR("id");
+        case Tag_Switch:
+        case Tag_SwitchText: return PSTR("switch");
+        case Tag_Cmd: return PSTR("cmd");
+        case Tag_SetLevel: return PSTR("set_level");
+        case Tag_Temp: return PSTR("temp");
+        case Tag_Hum: return PSTR("hum");
+        case Tag_Baro: return PSTR("baro");
+        case Tag_HStatus: return PSTR("hstatus");
+        case Tag_BForecast: return PSTR("bforecast");
+        case Tag_UV: return PSTR("uv");
+        case Tag_Lux: return PSTR("lux");
+        case Tag_Bat: return PSTR("bat");
+        case Tag_Rain: return PSTR("rain");
+        case Tag_RainRate: return PSTR("rainrate");
+        case Tag_WinSp: return PSTR("winsp");
+        case Tag_AWinSp: return PSTR("awinsp");
+        case Tag_WinGs: return PSTR("wings");
+        case Tag_WinDir: return PSTR("windir");
+        case Tag_WinChl: return PSTR("winchl");
+        case Tag_WinTmp: return PSTR("wintmp");
+        case Tag_Chime: return PSTR("chime");
+        case Tag_SmokeAlert: return PSTR("smokealert");
+        case Tag_PIR: return PSTR("pir");
+        case Tag_CO2: return PSTR("co2");
+        case Tag_Sound: return PSTR("sound");
+        case Tag_KWatt: return PSTR("kwatt");
+        case Tag_Watt: return PSTR("watt");
+        case Tag_Current: return PSTR("current");
+        case Tag_Dist: return PSTR("dist");
+        case Tag_Meter: return PSTR("meter");
+        case Tag_Volt: return PSTR("volt");
+        case Tag_RGBW: return PSTR("rgbw");
+        case Tag_Channel: return PSTR("chn");
+        case Tag_RSSI: return PSTR("rssi");
+        case Tag_Timestamp: return PSTR("timestamp");
+        case Tag_Plugin: return PSTR("plugin");
+        default: return nullptr;
+      }
+    }
+
+    uint8_t fieldTag(const char *name, size_t length) {
+      for (uint8_t tag = Tag_Sequence; tag <= Tag_Plugin; tag++) {
+        PGM_P candidate = fieldName(tag);
+        if (candidate != nullptr && strlen_P(candidate) == length && strncasecmp_P(name, candidate, length) == 0)
+          return tag;
+      }
+      return 0;
+    }
+
+    long fieldValue(uint8_t tag, const uint8_t *value, uint8_t size) {
+      unsigned long number = fieldNumber(value, size);
+      if (fieldKind(tag) == Kind_SignedTenths && (number & 0x8000))
+        return -(long) (number & 0x7FFF);
+      if (tag == Tag_RSSI)
+        return (int16_t) number;
+      return number;
+    }
+
+    void frameToJson(const uint8_t *frame, uint8_t length, JsonObject &output) {
+      forEachField(frame, length, [&output](uint8_t tag, const uint8_t *value, uint8_t size) {
+        PGM_P name = fieldName(tag);
+        if (name == nullptr)
+          return;
+        auto key = reinterpret_cast<const __FlashStringHelper *>(name);
+        unsigned long number = fieldNumber(value, size);
+
+        switch (fieldKind(tag)) {
+          case Kind_Number:
+            output[key] = number;
+            break;
+          case Kind_Tenths:
+            output[key] = number / 10.0F;
+            break;
+          case Kind_SignedTenths:
+            output[key] = (number & 0x8000 ? -(float) (number & 0x7FFF) : (float) number) / 10.0F;
+            break;
+          case Kind_Hex: {
+            char hex[9];
+            snprintf_P(hex, sizeof(hex), PSTR("%0*lx"), size * 2, number);
+            output[key] = hex; // char * values are copied by ArduinoJson, const char * ones are not
+            break;
+          }
+          case Kind_Text: {
+            char text[BINARY_MAX_FRAME_SIZE];
+            memcpy(text, value, size);
+            text[size] = 0;
+            output[key] = text;
+            break;
+          }
+          case Kind_Other:
+            if (tag == Tag_RSSI)
+              output[key] = (int16_t) number / 10.0F;
+            else if (tag == Tag_Timestamp)
+              output[key] = number; // seconds, milliseconds are left out
+            else if (tag == Tag_NameId) {
+              PGM_P text = nameText(number);
+              if (text != nullptr)
+                output[key] = reinterpret_cast<const __FlashStringHelper *>(text);
+            }
+            else if (tag == Tag_Bat)
+              output[key] = number ? F("OK") : F("LOW");
+            else if (tag == Tag_Cmd) {
+              char cmd[12];
+              cmd[0] = 0;
+              if (number & 0x80)
+                strcpy_P(cmd, PSTR("ALL"));
+              strcat_P(cmd, display_CMDName(number & 0x7F));
+              output[key] = cmd;
+            }
+            else
+              output[key] = number ? F("ON") : F("OFF");
+            break;
+        }
+      });
+    }
+
+    size_t formatField(uint8_t tag, const uint8_t *value, uint8_t size, char *output, size_t outputSize) {
+      if (outputSize == 0)
+        return 0;
+
+      FieldKind kind = fieldKind(tag);
+      unsigned long number = fieldNumber(value, size);
+      int length;
+
+      if (kind == Kind_Tenths || kind == Kind_SignedTenths || tag == Tag_RSSI) {
+        long tenths = fieldValue(tag, value, size);
+        unsigned long absolute = tenths < 0 ? -tenths : tenths;
+        length = snprintf_P(output, outputSize, PSTR("%s%lu.%lu"), tenths < 0 ? "-" : "", absolute / 10, absolute % 10);
+      }
+      else if (kind == Kind_Hex)
+        length = snprintf_P(output, outputSize, PSTR("%0*lx"), size * 2, number);
+      else if (kind == Kind_Text)
+        length = snprintf_P(output, outputSize, PSTR("%.*s"), (int) size, (const char *) value);
+      else if (tag == Tag_NameId)
+        length = snprintf_P(output, outputSize, PSTR("%s"), nameText(number) != nullptr ? nameText(number) : PSTR(""));
+      else if (tag == Tag_Bat)
+        length = snprintf_P(output, outputSize, PSTR("%s"), number ? PSTR("OK") : PSTR("LOW"));
+      else if (tag == Tag_Cmd)
+        length = snprintf_P(output, outputSize, PSTR("%s%s"), number & 0x80 ? PSTR("ALL") : PSTR(""),
+                            display_CMDName(number & 0x7F));
+      else if (tag == Tag_SmokeAlert || tag == Tag_PIR)
+        length = snprintf_P(output, outputSize, PSTR("%s"), number ? PSTR("ON") : PSTR("OFF"));
+      else
+        length = snprintf_P(output, outputSize, PSTR("%lu"), number);
+
+      if (length < 0)
+        return 0;
+      return (size_t) length < outputSize ? length : outputSize - 1;
+    }
+
+    bool frameDeviceTopic(const uint8_t *frame, uint8_t length, char *topic, size_t size) {
+      const uint8_t *name = nullptr, *id = nullptr, *sw = nullptr;
+      uint8_t nameSize = 0, idSize = 0, swSize = 0;
+      uint8_t idTag = 0, swTag = 0;
+      bool nameFromFlash = false;
+
+      forEachField(frame, length, [&](uint8_t tag, const uint8_t *value, uint8_t valueSize) {
+        if (tag == Tag_Name) {
+          name = value;
+          nameSize = valueSize;
+          nameFromFlash = false;
+        }
+        else if (tag == Tag_NameId && nameText(fieldNumber(value, valueSize)) != nullptr) {
+          name = (const uint8_t *) nameText(fieldNumber(value, valueSize));
+          nameSize = strlen_P((PGM_P) name);
+          nameFromFlash = true;
+        }
+        else if (tag == Tag_ID || tag == Tag_IDText) {
+          id = value;
+          idSize = valueSize;
+          idTag = tag;
+        }
+        else if (tag == Tag_Switch || tag == Tag_SwitchText) {
+          sw = value;
+          swSize = valueSize;
+          swTag = tag;
+        }
+      });
+      if (name == nullptr || id == nullptr)
+        return false;
+
+      size_t used = 0;
+      auto append = [&](const uint8_t *value, uint8_t valueSize, bool hex, bool fromFlash = false) {
+        if (used > 0 && used < size)
+          topic[used++] = '/';
+        if (hex)
+          used += snprintf_P(used < size ? &topic[used] : nullptr, used < size ? size - used : 0, PSTR("%0*lx"),
+                             valueSize * 2, fieldNumber(value, valueSize));
+        else {
+          for (uint8_t i = 0; i < valueSize; i++, used++) {
+            uint8_t c = fromFlash ? pgm_read_byte(&value[i]) : value[i];
+            if (used < size)
+              topic[used] = (c == ' ' || c == '/' || c == '+' || c == '#') ? '_' : c;
+          }
+        }
+      };
+      append(name, nameSize, false, nameFromFlash);
+      append(id, idSize, idTag == Tag_ID);
+      if (sw != nullptr)
+        append(sw, swSize, swTag == Tag_Switch);
+
+      if (used >= size)
+        return false;
+      topic[used] = 0;
+      return true;
+    }
+
+    void getStatusJsonString(JsonObject &output) {
+      auto &&binary = output.createNestedObject("binary");
+      binary[F("serial")] = params::serial;
+      binary[F("frames")] = counters::frames;
+      binary[F("overflows")] = counters::overflows;
+    }
+
+  } // end of Binary namespace
+} // end of RFLink namespace
@@ -0,0 +1,156 @@
+#ifndef _16_BINARY_H_
+#define _16_BINARY_H_
+
+#include <Arduino.h>
+#include "RFLink.h"
+#include "11_Config.h"
+
+// Binary framed output, an opt-in alternative to the 20;XX;... text lines, per output (Serial or Serial2Net client).
+//
+// frame  := SYNC length type payload crc16
+//   SYNC    0xA5
+//   length  1 byte, size of type + payload
+//   type    Messages::MessageClass of the event (0x01 decoded signal, 0x02 CLI reply ...)
+//   payload TLV fields: tag (1 byte), value length (1 byte), value
+//   crc16   CRC-16/CCITT-FALSE (poly 0x1021, init 0xFFFF) of length + type + payload, little endian
+//
+// Numbers are unsigned little endian, on as few bytes as needed (1 to 4, ID keeps the width of its text form), and
+// carry the same value as the hexadecimal/decimal text field (TEMP keeps its sign bit in bit 15). Text values are not
+// null terminated.
+// The protocol name of a decoded signal is sent as NAME_ID: FNV-1a 32 bits hash of the name, upper and lower halves
+// xored, so decoders map it back with a table of the names printed by the plugins. It is sent as NAME text instead
+// when BINARY_NAMES_COUNT names were already seen or when another name has the same id.
+// A reference decoder is available in tools/rflink_binary_decoder.py
+#define BINARY_SYNC 0xA5
+#define BINARY_MAX_FRAME_SIZE 96
+#define BINARY_NAMES_COUNT 48 // protocol names which can be sent as NAME_ID
+
+namespace RFLink {
+  namespace Binary {
+
+    extern Config::ConfigItem configItems[];
+
+    enum Tag {
+      Tag_Sequence = 0x01, // packet counter, the XX of 20;XX;
+      Tag_Name = 0x02,     // text
+      Tag_ID = 0x03,
+      Tag_IDText = 0x04,
+      Tag_Switch = 0x05,
+      Tag_SwitchText = 0x06,
+      Tag_Cmd = 0x07,      // CMD_OnOff value, bit 7 set for ALL
+      Tag_SetLevel = 0x08,
+      Tag_NameId = 0x09,   // uint16, id of the protocol name of a decoded signal
+      Tag_Temp = 0x10,
+      Tag_Hum = 0x11,
+      Tag_Baro = 0x12,
+      Tag_HStatus = 0x13,
+      Tag_BForecast = 0x14,
+      Tag_UV = 0x15,
+      Tag_Lux = 0x16,
+      Tag_Bat = 0x17,      // 1 = OK, 0 = LOW
+      Tag_Rain = 0x18,
+      Tag_RainRate = 0x19,
+      Tag_WinSp = 0x1A,
+      Tag_AWinSp = 0x1B,
+      Tag_WinGs = 0x1C,
+      Tag_WinDir = 0x1D,
+      Tag_WinChl = 0x1E,
+      Tag_WinTmp = 0x1F,
+      Tag_Chime = 0x20,
+      Tag_SmokeAlert = 0x21,
+      Tag_PIR = 0x22,
+      Tag_CO2 = 0x23,
+      Tag_Sound = 0x24,
+      Tag_KWatt = 0x25,
+      Tag_Watt = 0x26,
+      Tag_Current = 0x27,
+      Tag_Dist = 0x28,
+      Tag_Meter = 0x29,
+      Tag_Volt = 0x2A,
+      Tag_RGBW = 0x2B,
+      Tag_Channel = 0x2C,
+      Tag_RSSI = 0x40,      // int16, tenths of dBm
+      Tag_Timestamp = 0x41, // uint32 unix seconds + uint16 milliseconds
+      Tag_Plugin = 0x42,    // number of the plugin which decoded the signal
+    };
+
+    namespace params {
+      extern bool serial; // Serial prints frames instead of text lines
+    }
+
+    namespace counters {
+      extern unsigned long int frames;
+      extern unsigned long int overflows; // events which did not fit in BINARY_MAX_FRAME_SIZE and were sent as text only
+    }
+
+    void setup();
+    void paramsUpdatedCallback();
+    void refreshParametersFromConfig(bool triggerChanges=true);
+
+    // Event builder, fed by the display_* functions along with the text message
+    void beginEvent(uint8_t sequence);
+    void addNumber(uint8_t tag, unsigned long value, uint8_t minSize = 1);
+    void addText(uint8_t tag, const char *text, bool fromFlash);
+    void addName(const char *name); // NAME_ID when a plugin is decoding and the name has one, NAME text otherwise
+    void endEvent(uint8_t messageClass, float rssi, uint8_t pluginId);
+    void discardEvent();
+
+    /**
+     * @return the frame completed by endEvent(), nullptr if there is none (no binary output or overflow)
+     * */
+    const uint8_t *frame(uint8_t &length);
+
+    /**
+     * Walks the fields of a frame, calls visit(tag, value, size) for each of them
+     * */
+    template<typename Visitor>
+    void forEachField(const uint8_t *frame, uint8_t length, Visitor visit) {
+      if (frame == nullptr || length < 5)
+        return;
+      uint8_t end = length - 2; // CRC
+      for (uint8_t i = 3; i + 2 <= end && i + 2 + frame[i + 1] <= end; i += 2 + frame[i + 1])
+        visit(frame[i], &frame[i + 2], frame[i + 1]);
+    }
+
+    inline unsigned long fieldNumber(const uint8_t *value, uint8_t size) {
+      unsigned long number = 0;
+      for (uint8_t i = 0; i < size && i < 4; i++)
+        number |= (unsigned long) value[i] << (i * 8);
+      return number;
+    }
+
+    /**
+     * @return the value of a numeric field, with its sign applied for temperatures and RSSI (still in tenths)
+     * */
+    long fieldValue(uint8_t tag, const uint8_t *value, uint8_t size);
+
+    uint16_t nameId(const char *name);
+    PGM_P nameText(uint16_t id);                     // name sent with this id, nullptr if none was
+
+    PGM_P fieldName(uint8_t tag);                    // lower case name of the text field, nullptr if unknown
+    uint8_t fieldTag(const char *name, size_t length); // 0 if unknown
+
+    /**
+     * Adds the fields of a frame to output, named after their text counterpart in lower case ("temp", "hum" ...).
+     * Temperatures, rain and wind speeds are converted from tenths, ID and SWITCH are kept as hexadecimal text.
+     * */
+    void frameToJson(const uint8_t *frame, uint8_t length, JsonObject &output);
+
+    /**
+     * Writes the value of a field as it is meant to be read by a human ("-2.5", "OK", "ALLON", "1a2d" ...)
+     * @return number of characters written, without the null termination
+     * */
+    size_t formatField(uint8_t tag, const uint8_t *value, uint8_t size, char *output, size_t outputSize);
+
+    /**
+     * Writes "<protocol>/<id>[/<switch>]" of a decoded signal frame in topic, characters which have a meaning
+     * in MQTT topics (and spaces) replaced with '_'
+     * @return false if the frame has no name or no ID, or topic is too small
+     * */
+    bool frameDeviceTopic(const uint8_t *frame, uint8_t length, char *topic, size_t size);
+
+    void getStatusJsonString(JsonObject &output);
+  }
+}
+
+#endif // _16_BINARY_H_
@@ -0,0 +1,326 @@
+#include <Arduino.h>
+#include "RFLink.h"
+#include "16_Binary.h"
+#include "17_Cache.h"
+
+namespace RFLink {
+  namespace Cache {
+
+    namespace commands {
+      const char show[] PROGMEM = "show";
+      const char clear[] PROGMEM = "clear";
+    }
+
+    namespace params {
+      bool enabled = false;
+      unsigned long heartbeat = 15;
+    }
+
+    namespace counters {
+      unsigned long int suppressed = 0;
+      unsigned long int changed = 0;
+      unsigned long int heartbeats = 0;
+      unsigned long int newDevices = 0;
+      unsigned long int bypassed = 0;
+      unsigned long int evictions = 0;
+    }
+
+    const char json_name_enabled[] = "enabled";
+    const char json_name_heartbeat[] = "heartbeat";
+    const char json_name_deadbands[] = "deadbands";
+
+    Config::ConfigItem configItems[] = {
+            Config::ConfigItem(json_name_enabled, Config::SectionId::Cache_id, false, paramsUpdatedCallback),
+            Config::ConfigItem(json_name_heartbeat, Config::SectionId::Cache_id, 15, paramsUpdatedCallback),
+            Config::ConfigItem(json_name_deadbands, Config::SectionId::Cache_id, "", paramsUpdatedCallback),
+            Config::ConfigItem()};
+
+    struct Field {
+      uint8_t tag;
+      int32_t value;
+    };
+
+    struct Entry {
+      uint32_t key;              // 0 for a free entry
+      uint32_t lastSeen;         // value of runtime::tick when the device was last received
+      unsigned long publishedAt; // millis()
+      uint8_t fieldCount;        // may be more than CACHE_MAX_FIELDS, only the first ones are kept then
+      Field fields[CACHE_MAX_FIELDS];
+    };
+
+    struct Deadband {
+      uint8_t tag;
+      uint16_t band; // in the unit of the field value (tenths for temperatures)
+    };
+
+    namespace runtime {
+      Entry entries[CACHE_SIZE];
+      uint32_t tick = 0;
+      Deadband deadbands[CACHE_MAX_DEADBANDS];
+      uint8_t deadbandCount = 0;
+    }
+
+    void parseDeadbands(const char *text) {
+      // "temp:2,hum:1"
+      runtime::deadbandCount = 0;
+      while (*text != 0) {
+        const char *separator = strchr(text, ':');
+        if (separator == nullptr)
+          break;
+        uint8_t tag = Binary::fieldTag(text, separator - text);
+        long band = strtol(separator + 1, (char **) &text, 10);
+        if (tag == 0 || band < 0 || band > 0xFFFF)
+          Serial.printf_P(PSTR("Cache: ignoring invalid deadband near '%s'\r\n"), separator + 1);
+        else if (runtime::deadbandCount < CACHE_MAX_DEADBANDS)
+          runtime::deadbands[runtime::deadbandCount++] = {tag, (uint16_t) band};
+        while (*text == ',' || *text == ' ')
+          text++;
+      }
+    }
+
+    void paramsUpdatedCallback() {
+      refreshParametersFromConfig();
+    }
+
+    void refreshParametersFromConfig(bool triggerChanges) {
+      Config::ConfigItem *item;
+
+      item = Config::findConfigItem(json_name_enabled, Config::SectionId::Cache_id);
+      if (params::enabled != item->getBoolValue()) {
+        params::enabled = item->getBoolValue();
+        clear();
+        if (triggerChanges)
+          Serial.println(params::enabled ? F("Cache enabled, unchanged values will not be published.") : F("Cache disabled."));
+      }
+
+      item = Config::findConfigItem(json_name_heartbeat, Config::SectionId::Cache_id);
+      long int heartbeat = item->getLongIntValue();
+      if (heartbeat < 0) {
+        Serial.println(F("Cache heartbeat must be 0 or more minutes, using 0 (never)"));
+        heartbeat = 0;
+      }
+      params::heartbeat = heartbeat;
+
+      item = Config::findConfigItem(json_name_deadbands, Config::SectionId::Cache_id);
+      parseDeadbands(item->getCharValue());
+    }
+
+    void setup() {
+      refreshParametersFromConfig(false);
+    }
+
+    inline bool isTracked(uint8_t tag) {
+      switch (tag) {
+        case Binary::Tag_Sequence:
+        case Binary::Tag_Name:
+        case Binary::Tag_NameId:
+        case Binary::Tag_ID:
+        case Binary::Tag_IDText:
+        case Binary::Tag_Switch:
+        case Binary::Tag_SwitchText:
+        case Binary::Tag_RSSI:
+        case Binary::Tag_Timestamp:
+        case Binary::Tag_Plugin:
+          return false;
+        default:
+          return true;
+      }
+    }
+
+    uint16_t deadband(uint8_t tag) {
+      for (uint8_t i = 0; i < runtime::deadbandCount; i++) {
+        if (runtime::deadbands[i].tag == tag)
+          return runtime::deadbands[i].band;
+      }
+      return 0;
+    }
+
+    /**
+     * @return FNV-1a hash of protocol name, ID and switch of the frame, 0 if it is not a device state
+     * */
+    uint32_t keyOf(const uint8_t *frame, uint8_t length) {
+      uint32_t hash = 2166136261UL;
+      bool hasName = false, hasID = false, isEvent = false;
+
+      Binary::forEachField(frame, length, [&](uint8_t tag, const uint8_t *value, uint8_t size) {
+        if (tag == Binary::Tag_Cmd || tag == Binary::Tag_Chime)
+          isEvent = true; // a button pressed twice must be published twice
+        if (tag != Binary::Tag_Name && tag != Binary::Tag_NameId && tag != Binary::Tag_ID &&
+            tag != Binary::Tag_IDText && tag != Binary::Tag_Switch && tag != Binary::Tag_SwitchText)
+          return;
+        hasName = hasName || tag == Binary::Tag_Name || tag == Binary::Tag_NameId;
+        hasID = hasID || tag == Binary::Tag_ID || tag == Binary::Tag_IDText;
+        hash = (hash ^ tag) * 16777619UL;
+        for (uint8_t i = 0; i < size; i++)
+          hash = (hash ^ value[i]) * 16777619UL;
+      });
+
+      if (!hasName || !hasID || isEvent)
+        return 0;
+      return hash == 0 ? 1 : hash;
+    }
+
+    Entry *find(uint32_t key) {
+      for (auto &entry : runtime::entries) {
+        if (entry.key == key)
+          return &entry;
+      }
+      return nullptr;
+    }
+
+    bool isRedundant(const uint8_t *frame, uint8_t length) {
+      if (!params::enabled)
+        return false;
+
+      uint32_t key = keyOf(frame, length);
+      if (key == 0) {
+        counters::bypassed++;
+        return false;
+      }
+
+      Entry *entry = find(key);
+      if (entry == nullptr) {
+        counters::newDevices++;
+        return false;
+      }
+      entry->lastSeen = ++runtime::tick;
+
+      if (params::heartbeat > 0 && millis() - entry->publishedAt >= params::heartbeat * 60000UL) {
+        counters::heartbeats++;
+        return false;
+      }
+
+      bool changed = entry->fieldCount > CACHE_MAX_FIELDS;
+      uint8_t fieldCount = 0;
+      Binary::forEachField(frame, length, [&](uint8_t tag, const uint8_t *value, uint8_t size) {
+        if (changed || !isTracked(tag))
+          return;
+        fieldCount++;
+        long current = Binary::fieldValue(tag, value, size);
+        for (uint8_t i = 0; i < entry->fieldCount && i < CACHE_MAX_FIELDS; i++) {
+          if (entry->fields[i].tag == tag) {
+            long difference = current - entry->fields[i].value;
+            changed = (difference < 0 ? -difference : difference) > deadband(tag);
+            return;
+          }
+        }
+        changed = true; // a value which was not there before
+      });
+
+      if (changed || fieldCount != entry->fieldCount) {
+        counters::changed++;
+        return false;
+      }
+      counters::suppressed++;
+      return true;
+    }
+
+    void remember(const uint8_t *frame, uint8_t length) {
+      if (!params::enabled)
+        return;
+
+      uint32_t key = keyOf(frame, length);
+      if (key == 0)
+        return;
+
+      Entry *entry = find(key);
+      if (entry == nullptr) {
+        // a free entry, or the least recently seen device
+        entry = &runtime::entries[0];
+        for (auto &candidate : runtime::entries) {
+          if (candidate.key == 0) {
+            entry = &candidate;
+            break;
+          }
+          if (candidate.lastSeen < entry->lastSeen)
+            entry = &candidate;
+        }
+        if (entry->key != 0)
+          counters::evictions++;
+        entry->key = key;
+      }
+
+      entry->lastSeen = ++runtime::tick;
+      entry->publishedAt = millis();
+      entry->fieldCount = 0;
+      Binary::forEachField(frame, length, [entry](uint8_t tag, const uint8_t *value, uint8_t size) {
+        if (!isTracked(tag))
+          return;
+        if (entry->fieldCount < CACHE_MAX_FIELDS)
+          entry->fields[entry->fieldCount] = {tag, (int32_t) Binary::fieldValue(tag, value, size)};
+        if (entry->fieldCount < 0xFF)
+          entry->fieldCount++;
+      });
+    }
+
+    uint8_t countEntries() {
+      uint8_t used = 0;
+      for (auto &entry : runtime::entries) {
+        if (entry.key != 0)
+          used++;
+      }
+      return used;
+    }
+
+    void clear() {
+      for (auto &entry : runtime::entries)
+        entry.key = 0;
+      runtime::tick = 0;
+    }
+
+    void executeCliCommand(char *cmd) {
+      char *commaIndex = strchr(cmd, ';');
+
+      if (commaIndex == nullptr) {
+        Serial.println(F("Error : failed to find ending ';' for the command"));
+        return;
+      }
+
+      int commandSize = commaIndex - cmd;
+      *commaIndex = 0; // replace ';' with null termination
+
+      if (strncasecmp_P(cmd, commands::show, commandSize) == 0) {
+        sprintf_P(printBuf, PSTR("20;XX;DEBUG;CACHE;ENABLED=%i;DEVICES=%u;CAPACITY=%u;HEARTBEAT=%lu;SUPPRESSED=%lu;CHANGED=%lu;HEARTBEATS=%lu;NEW=%lu;BYPASSED=%lu;EVICTIONS=%lu;"),
+                  (int) params::enabled, (unsigned int) countEntries(), (unsigned int) CACHE_SIZE, params::heartbeat,
+                  counters::suppressed, counters::changed, counters::heartbeats, counters::newDevices,
+                  counters::bypassed, counters::evictions);
+        sendRawPrint(printBuf, true);
+        for (auto &entry : runtime::entries) {
+          if (entry.key == 0)
+            continue;
+          sprintf_P(printBuf, PSTR("20;XX;DEBUG;CACHE;KEY=%08lx;FIELDS=%u;PUBLISHED=%lus;"),
+                    (unsigned long) entry.key, (unsigned int) entry.fieldCount,
+                    (millis() - entry.publishedAt) / 1000);
+          sendRawPrint(printBuf, true);
+        }
+      }
+      else if (strncasecmp_P(cmd, commands::clear, commandSize) == 0) {
+        clear();
+        counters::suppressed = 0;
+        counters::changed = 0;
+        counters::heartbeats = 0;
+        counters::newDevices = 0;
+        counters::bypassed = 0;
+        counters::evictions = 0;
+        sendRawPrint(F("20;XX;DEBUG;CACHE;CLEARED;"), true);
+      }
+      else {
+        Serial.printf_P(PSTR("Error : unknown command '%s'\r\n"), cmd);
+      }
+    }
+
+    void getStatusJsonString(JsonObject &output) {
+      auto &&cache = output.createNestedObject("cache");
+      cache[F("enabled")] = params::enabled;
+      cache[F("devices")] = countEntries();
+      cache[F("capacity")] = CACHE_SIZE;
+      cache[F("suppressed")] = counters::suppressed;
+      cache[F("changed")] = counters::changed;
+      cache[F("heartbeats")] = counters::heartbeats;
+      cache[F("new_devices")] = counters::newDevices;
+      cache[F("bypassed")] = counters::bypassed;
+      cache[F("evictions")] = counters::evictions;
+    }
+
+  } // end of Cache namespace
+} // end of RFLink namespace
@@ -0,0 +1,59 @@
+#ifndef _17_CACHE_H_
+#define _17_CACHE_H_
+
+#include <Arduino.h>
+#include "RFLink.h"
+#include "11_Config.h"
+
+// Last published values of each device (protocol + ID + switch), so MQTT only publishes decoded signals which bring
+// something new: a value which changed by more than its deadband, or a heartbeat once in a while.
+// The least recently seen device is forgotten when the cache is full.
+#ifdef ESP32
+#define CACHE_SIZE 32
+#else
+#define CACHE_SIZE 16
+#endif
+#define CACHE_MAX_FIELDS 8    // devices reporting more values than this are always published
+#define CACHE_MAX_DEADBANDS 8
+
+namespace RFLink {
+  namespace Cache {
+
+    extern Config::ConfigItem configItems[];
+
+    namespace params {
+      extern bool enabled;
+      extern unsigned long heartbeat; // minutes after which an unchanged device is published anyway, 0 for never
+    }
+
+    namespace counters {
+      extern unsigned long int suppressed;
+      extern unsigned long int changed;
+      extern unsigned long int heartbeats;
+      extern unsigned long int newDevices;
+      extern unsigned long int bypassed;  // signals which are events rather than states (CMD, CHIME) or have no ID
+      extern unsigned long int evictions;
+    }
+
+    void setup();
+    void paramsUpdatedCallback();
+    void refreshParametersFromConfig(bool triggerChanges=true);
+
+    /**
+     * @return true if publishing this decoded signal frame would not tell anything new. Does not record it.
+     * */
+    bool isRedundant(const uint8_t *frame, uint8_t length);
+
+    /**
+     * Records the values of a frame once it has been published
+     * */
+    void remember(const uint8_t *frame, uint8_t length);
+
+    void clear();
+
+    void executeCliCommand(char *cmd);
+    void getStatusJsonString(JsonObject &output);
+  }
+}
+
+#endif // _17_CACHE_H_
@@ -0,0 +1,294 @@
+#include <Arduino.h>
+#include "RFLink.h"
+
+#ifndef RFLINK_MQTT_DISABLED
+
+#ifdef ESP8266
+#include <LittleFS.h>
+#else
+#include <FS.h>
+#include <LITTLEFS.h>
+#define LittleFS LITTLEFS
+#endif
+
+#include "6_MQTT.h"
+#include "18_Outbox.h"
+
+namespace RFLink {
+  namespace Outbox {
+
+    namespace commands {
+      const char show[] PROGMEM = "show";
+      const char clear[] PROGMEM = "clear";
+    }
+
+    namespace params {
+      bool enabled = false;
+      unsigned long replayRate = 20;
+    }
+
+    namespace counters {
+      unsigned long int spilled = 0;
+      unsigned long int replayed = 0;
+      unsigned long int dropped = 0;
+      unsigned long int errors = 0;
+    }
+
+    const char json_name_enabled[] = "enabled";
+    const char json_name_replay_rate[] = "replay_rate";
+
+    Config::ConfigItem configItems[] = {
+            Config::ConfigItem(json_name_enabled, Config::SectionId::Outbox_id, false, paramsUpdatedCallback),
+            Config::ConfigItem(json_name_replay_rate, Config::SectionId::Outbox_id, 20, paramsUpdatedCallback),
+            Config::ConfigItem()};
+
+    const char recordsFileName[] = "/outbox.bin";
+    const char indexFileName[] = "/outbox.idx";
+#define OUTBOX_MAGIC 0x52464F31UL // RFO1, changes whenever Record or Index do
+
+    // records are OUTBOX_RECORD_SIZE apart in the file, only the used part of a slot is rewritten once the file covers it
+    struct __attribute__((packed)) Record {
+      uint32_t captured; // unix time the message was queued at
+      uint8_t messageClass;
+      uint8_t pluginId;
+      uint8_t textLength;
+      uint8_t frameLength;
+      uint8_t data[OUTBOX_RECORD_SIZE - 8]; // text then frame
+    };
+
+    static_assert(sizeof(Record) == OUTBOX_RECORD_SIZE, "Record must fill a record slot exactly");
+    static_assert(sizeof(Record::data) >= PRINT_BUFFER_SIZE + BINARY_MAX_FRAME_SIZE, "OUTBOX_RECORD_SIZE is too small for a message");
+
+    struct Index {
+      uint32_t magic;
+      uint32_t head; // sequence of the next record to write
+      uint32_t tail; // sequence of the oldest record
+    };
+
+    namespace runtime {
+      File records;
+      Index index = {OUTBOX_MAGIC, 0, 0};
+      unsigned long lastReplay = 0;
+      bool ready = false; // file opened
+    }
+
+    inline uint32_t recordOffset(uint32_t sequence) {
+      return (sequence % OUTBOX_CAPACITY) * OUTBOX_RECORD_SIZE;
+    }
+
+    bool saveIndex() {
+      File file = LittleFS.open(indexFileName, "w");
+      if (!file) {
+        counters::errors++;
+        return false;
+      }
+      bool ok = file.write((const uint8_t *) &runtime::index, sizeof(runtime::index)) == sizeof(runtime::index);
+      file.close();
+      if (!ok)
+        counters::errors++;
+      return ok;
+    }
+
+    void close() {
+      if (runtime::ready)
+        runtime::records.close();
+      runtime::ready = false;
+    }
+
+    /**
+     * Opens the records file and loads its index, starts a new empty ring if any of them is missing or invalid
+     * */
+    bool open() {
+      if (runtime::ready)
+        return true;
+
+      File file = LittleFS.open(indexFileName, "r");
+      bool valid = file && file.read((uint8_t *) &runtime::index, sizeof(runtime::index)) == sizeof(runtime::index) &&
+                   runtime::index.magic == OUTBOX_MAGIC &&
+                   runtime::index.head - runtime::index.tail <= OUTBOX_CAPACITY;
+      if (file)
+        file.close();
+
+      if (valid && LittleFS.exists(recordsFileName))
+        runtime::records = LittleFS.open(recordsFileName, "r+");
+      else {
+        runtime::index = {OUTBOX_MAGIC, 0, 0};
+        runtime::records = LittleFS.open(recordsFileName, "w+");
+        saveIndex();
+      }
+
+      runtime::ready = (bool) runtime::records;
+      if (!runtime::ready) {
+        counters::errors++;
+        Serial.println(F("Outbox: failed to open records file"));
+      }
+      else if (pending() > 0)
+        Serial.printf_P(PSTR("Outbox: %u messages left from a previous run will be published\r\n"), (unsigned int) pending());
+      return runtime::ready;
+    }
+
+    void paramsUpdatedCallback() {
+      refreshParametersFromConfig();
+    }
+
+    void refreshParametersFromConfig(bool triggerChanges) {
+      Config::ConfigItem *item;
+
+      item = Config::findConfigItem(json_name_enabled, Config::SectionId::Outbox_id);
+      if (params::enabled != item->getBoolValue()) {
+        params::enabled = item->getBoolValue();
+        if (!params::enabled)
+          close(); // records are kept, they are published if it is enabled again
+        if (triggerChanges)
+          Serial.println(params::enabled ? F("MQTT outbox enabled.") : F("MQTT outbox disabled."));
+      }
+
+      item = Config::findConfigItem(json_name_replay_rate, Config::SectionId::Outbox_id);
+      long int rate = item->getLongIntValue();
+      if (rate < 1) {
+        Serial.println(F("Outbox replay_rate must be at least 1 message per second, using 1"));
+        rate = 1;
+      }
+      params::replayRate = rate;
+    }
+
+    void setup() {
+      refreshParametersFromConfig(false);
+      if (params::enabled)
+        open();
+    }
+
+    uint32_t pending() {
+      return runtime::index.head - runtime::index.tail;
+    }
+
+    bool spill(const Messages::Message &message) {
+      if (!params::enabled || !open())
+        return false;
+
+      Record record;
+      record.captured = message.captured;
+      record.messageClass = message.messageClass;
+      record.pluginId = message.pluginId;
+      record.textLength = message.length;
+      record.frameLength = message.frameLength;
+      memcpy(record.data, message.text, message.length);
+      memcpy(&record.data[message.length], message.frame, message.frameLength);
+      size_t size = offsetof(Record, data) + message.length + message.frameLength;
+      if (runtime::records.size() < recordOffset(runtime::index.head) + OUTBOX_RECORD_SIZE) {
+        // the file grows by whole records, so the next one never has to be written past its end
+        memset(((uint8_t *) &record) + size, 0, OUTBOX_RECORD_SIZE - size);
+        size = OUTBOX_RECORD_SIZE;
+      }
+
+      if (!runtime::records.seek(recordOffset(runtime::index.head), SeekSet) ||
+          runtime::records.write((const uint8_t *) &record, size) != size) {
+        counters::errors++;
+        return false;
+      }
+      runtime::records.flush();
+
+      if (pending() == OUTBOX_CAPACITY) { // the record just written replaced the oldest one
+        runtime::index.tail++;
+        counters::dropped++;
+      }
+      runtime::index.head++;
+      counters::spilled++;
+      saveIndex();
+      return true;
+    }
+
+    bool replay() {
+      if (pending() == 0)
+        return true;
+      if (!params::enabled || !Mqtt::isConnected() || !open())
+        return false;
+
+      // OUTBOX_REPLAY_BURST records every burst period, so the broker and subscribers are not flooded
+      if (millis() - runtime::lastReplay < 1000UL * OUTBOX_REPLAY_BURST / params::replayRate)
+        return false;
+      runtime::lastReplay = millis();
+
+      static Messages::Message message; // too large for the stack of some loops
+      Record record;
+      uint8_t burst = 0;
+      for (; burst < OUTBOX_REPLAY_BURST && pending() > 0; burst++) {
+        if (!runtime::records.seek(recordOffset(runtime::index.tail), SeekSet) ||
+            runtime::records.read((uint8_t *) &record, offsetof(Record, data)) != offsetof(Record, data) ||
+            record.textLength >= PRINT_BUFFER_SIZE || record.frameLength > BINARY_MAX_FRAME_SIZE ||
+            runtime::records.read(record.data, record.textLength + record.frameLength) != record.textLength + record.frameLength) {
+          counters::errors++; // unreadable record, skipped
+          runtime::index.tail++;
+          continue;
+        }
+
+        message.sequence = 0;
+        message.captured = record.captured;
+        message.messageClass = record.messageClass;
+        message.pluginId = record.pluginId;
+        message.length = record.textLength;
+        memcpy(message.text, record.data, record.textLength);
+        message.text[record.textLength] = 0;
+        message.frameLength = record.frameLength;
+        memcpy(message.frame, &record.data[record.textLength], record.frameLength);
+
+        if (!Mqtt::publishMsg(message))
+          break; // kept for the next call
+        runtime::index.tail++;
+        counters::replayed++;
+      }
+
+      if (burst > 0)
+        saveIndex();
+      return pending() == 0;
+    }
+
+    void clear() {
+      runtime::index.tail = runtime::index.head;
+      if (runtime::ready)
+        saveIndex();
+    }
+
+    void executeCliCommand(char *cmd) {
+      char *commaIndex = strchr(cmd, ';');
+
+      if (commaIndex == nullptr) {
+        Serial.println(F("Error : failed to find ending ';' for the command"));
+        return;
+      }
+
+      int commandSize = commaIndex - cmd;
+      *commaIndex = 0; // replace ';' with null termination
+
+      if (strncasecmp_P(cmd, commands::show, commandSize) == 0) {
+        sprintf_P(printBuf, PSTR("20;XX;DEBUG;OUTBOX;ENABLED=%i;RAM=%u;FILE=%lu;CAPACITY=%u;SPILLED=%lu;REPLAYED=%lu;DROPPED=%lu;ERRORS=%lu;"),
+                  (int) params::enabled, (unsigned int) Messages::lag(Messages::Sink_MQTT), (unsigned long) pending(),
+                  (unsigned int) OUTBOX_CAPACITY, counters::spilled, counters::replayed, counters::dropped,
+                  counters::errors);
+        sendRawPrint(printBuf, true);
+      }
+      else if (strncasecmp_P(cmd, commands::clear, commandSize) == 0) {
+        clear();
+        sendRawPrint(F("20;XX;DEBUG;OUTBOX;CLEARED;"), true);
+      }
+      else {
+        Serial.printf_P(PSTR("Error : unknown command '%s'\r\n"), cmd);
+      }
+    }
+
+    void getStatusJsonString(JsonObject &output) {
+      auto &&outbox = output.createNestedObject("outbox");
+      outbox[F("enabled")] = params::enabled;
+      outbox[F("ram")] = Messages::lag(Messages::Sink_MQTT);
+      outbox[F("file")] = pending();
+      outbox[F("capacity")] = OUTBOX_CAPACITY;
+      outbox[F("spilled")] = counters::spilled;
+      outbox[F("replayed")] = counters::replayed;
+      outbox[F("dropped")] = counters::dropped;
+      outbox[F("errors")] = counters::errors;
+    }
+
+  } // end of Outbox namespace
+} // end of RFLink namespace
+
+#endif // RFLINK_MQTT_DISABLED
@@ -0,0 +1,65 @@
+#ifndef _18_OUTBOX_H_
+#define _18_OUTBOX_H_
+
+#include <Arduino.h>
+#include "RFLink.h"
+
+#ifndef RFLINK_MQTT_DISABLED
+
+#include "11_Config.h"
+#include "15_Messages.h"
+
+// Messages MQTT could not publish yet stay in the messages queue (RAM). When the queue is full, the oldest of them
+// are moved to a ring of fixed size records in a LittleFS file instead of being dropped, and replayed in order,
+// at a limited rate, once the broker is back. The ring survives reboots.
+#ifdef ESP32
+#define OUTBOX_CAPACITY 256
+#else
+#define OUTBOX_CAPACITY 128
+#endif
+#define OUTBOX_RECORD_SIZE 232        // header + text + frame of a Messages::Message
+#define OUTBOX_REPLAY_BURST 4         // records published per replay() call at most
+
+namespace RFLink {
+  namespace Outbox {
+
+    extern Config::ConfigItem configItems[];
+
+    namespace params {
+      extern bool enabled;
+      extern unsigned long replayRate; // records per second
+    }
+
+    namespace counters {
+      extern unsigned long int spilled;  // messages moved from RAM to the file
+      extern unsigned long int replayed;
+      extern unsigned long int dropped;  // oldest records overwritten because the file was full
+      extern unsigned long int errors;   // file system failures
+    }
+
+    void setup();
+    void paramsUpdatedCallback();
+    void refreshParametersFromConfig(bool triggerChanges=true);
+
+    /**
+     * Moves a message MQTT did not publish to the file
+     * @return false if the outbox is disabled or the file cannot be written, the message is then dropped by the queue
+     * */
+    bool spill(const Messages::Message &message);
+
+    /**
+     * Publishes the oldest records, at most OUTBOX_REPLAY_BURST and no faster than replay_rate
+     * @return true once the file is empty, newer messages of the queue can be published
+     * */
+    bool replay();
+
+    uint32_t pending();
+    void clear();
+
+    void executeCliCommand(char *cmd);
+    void getStatusJsonString(JsonObject &output);
+  }
+}
+
+#endif // RFLINK_MQTT_DISABLED
+#endif // _18_OUTBOX_H_
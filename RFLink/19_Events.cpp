@@ -0,0 +1,501 @@
+#include <Arduino.h>
+#include "RFLink.h"
+
+#ifndef RFLINK_PORTAL_DISABLED
+
+#include <new>
+#include <ESPAsyncWebServer.h>
+#include "16_Binary.h"
+#include "19_Events.h"
+
+namespace RFLink {
+  namespace Events {
+
+    namespace commands {
+      const char show[] PROGMEM = "show";
+    }
+
+    // filters, given as query parameters (/api/events?classes=decode,reply&plugins=48) or sent by the client later
+    // as "classes=decode,reply;plugins=all;captures=on;"
+    namespace filters {
+      const char classes[] PROGMEM = "classes";
+      const char plugins[] PROGMEM = "plugins";
+      const char captures[] PROGMEM = "captures";
+    }
+
+    namespace params {
+      bool enabled = false;
+    }
+
+    namespace counters {
+      unsigned long int sent = 0;
+      unsigned long int dropped = 0;
+      unsigned long int disconnected = 0;
+      unsigned long int refused = 0;
+      unsigned long int captures = 0;
+    }
+
+    const char json_name_enabled[] = "enabled";
+
+    Config::ConfigItem configItems[] = {
+            Config::ConfigItem(json_name_enabled, Config::SectionId::Events_id, true, paramsUpdatedCallback),
+            Config::ConfigItem()};
+
+    struct Subscriber {
+      uint32_t id; // AsyncWebSocketClient::id(), 0 for a free slot
+      uint8_t classes;
+      bool captures;
+      bool pluginsFiltered; // when set, decoded signals are sent only for plugins flagged in 'plugins'
+      uint8_t plugins[256 / 8];
+      unsigned long sent;
+      unsigned long dropped;
+      uint16_t droppedInARow;
+
+      bool wants(uint8_t messageClass, uint8_t pluginId) const {
+        if ((classes & messageClass) == 0)
+          return false;
+        if (messageClass == Messages::Class_Decode && pluginsFiltered)
+          return plugins[pluginId >> 3] & (1 << (pluginId & 7));
+        return true;
+      }
+    };
+
+    namespace runtime {
+      AsyncWebSocket socket("/api/events");
+      Subscriber subscribers[EVENTS_MAX_CLIENTS];
+      uint8_t captureSubscribers = 0; // so publishCapture() costs nothing when nobody wants captures
+      char output[EVENTS_JSON_SIZE];  // too large for the stack of some loops
+    }
+
+    // Print which only measures what is printed when it has no buffer, so an event is sized before being allocated
+    class EventPrint : public Print {
+      public:
+        EventPrint(char *buffer, size_t size) : buffer(buffer), size(size) {}
+
+        size_t write(uint8_t c) override {
+          if (buffer != nullptr && length < size)
+            buffer[length] = c;
+          length++;
+          return 1;
+        }
+
+        size_t length = 0;
+
+      private:
+        char *buffer;
+        size_t size;
+    };
+
+    void countCaptureSubscribers() {
+      uint8_t count = 0;
+      for (auto &subscriber : runtime::subscribers) {
+        if (subscriber.id != 0 && subscriber.captures)
+          count++;
+      }
+      runtime::captureSubscribers = count;
+    }
+
+    Subscriber *findSubscriber(uint32_t id) {
+      for (auto &subscriber : runtime::subscribers) {
+        if (subscriber.id == id)
+          return &subscriber;
+      }
+      return nullptr;
+    }
+
+    /**
+     * @return nullptr if the filter was applied, the reason why it was not otherwise (PROGMEM)
+     * */
+    PGM_P applyFilter(Subscriber &subscriber, const char *name, size_t nameLength, const char *value) {
+      if (nameLength == strlen_P(filters::classes) && strncasecmp_P(name, filters::classes, nameLength) == 0) {
+        uint8_t classes = Messages::parseClasses(value);
+        if (classes == 0xFF)
+          return PSTR("unknown message class, expected decode, reply, debug, pulses, all or none");
+        subscriber.classes = classes;
+      }
+      else if (nameLength == strlen_P(filters::plugins) && strncasecmp_P(name, filters::plugins, nameLength) == 0) {
+        if (strncasecmp_P(value, PSTR("all"), 3) == 0) {
+          subscriber.pluginsFiltered = false;
+          return nullptr;
+        }
+        uint8_t plugins[sizeof(subscriber.plugins)] = {0};
+        char *end;
+        for (const char *ptr = value; *ptr != 0 && *ptr != ';'; ptr = end) {
+          unsigned long pluginId = strtoul(ptr, &end, 10);
+          if (end == ptr || pluginId > 255 || (*end != ',' && *end != ';' && *end != 0))
+            return PSTR("expected a comma separated list of plugin numbers or 'all'");
+          plugins[pluginId >> 3] |= 1 << (pluginId & 7);
+          if (*end == ',')
+            end++;
+        }
+        memcpy(subscriber.plugins, plugins, sizeof(plugins));
+        subscriber.pluginsFiltered = true;
+      }
+      else if (nameLength == strlen_P(filters::captures) && strncasecmp_P(name, filters::captures, nameLength) == 0) {
+        if (strncasecmp_P(value, PSTR("on"), 2) == 0 || value[0] == '1')
+          subscriber.captures = true;
+        else if (strncasecmp_P(value, PSTR("off"), 3) == 0 || value[0] == '0')
+          subscriber.captures = false;
+        else
+          return PSTR("expected captures 'on' or 'off'");
+        countCaptureSubscribers();
+      }
+      else
+        return PSTR("unknown filter, expected classes, plugins or captures");
+      return nullptr;
+    }
+
+    // replies to a client are built on the stack: they are sent from the web server callbacks, which may run while
+    // the main loop renders an event in runtime::output
+    void sendError(AsyncWebSocketClient *client, PGM_P reason) {
+      char reply[128];
+      int length = snprintf_P(reply, sizeof(reply), PSTR("{\"type\":\"error\",\"message\":\"%s\"}"), reason);
+      client->text(reply, length);
+    }
+
+    // current filters of the client, sent once connected and after each change
+    void sendFilters(AsyncWebSocketClient *client, const Subscriber &subscriber) {
+      char reply[192];
+      char classes[40];
+      Messages::classesToString(subscriber.classes, classes);
+      int length = snprintf_P(reply, sizeof(reply), PSTR("{\"type\":\"filters\",\"classes\":\"%s\",\"captures\":%s,\"plugins\":"),
+                              classes, subscriber.captures ? "true" : "false");
+
+      if (!subscriber.pluginsFiltered)
+        length += snprintf_P(&reply[length], sizeof(reply) - length, PSTR("\"all\""));
+      else {
+        reply[length++] = '[';
+        for (int pluginId = 0; pluginId < 256 && length < (int) sizeof(reply) - 8; pluginId++) {
+          if (subscriber.plugins[pluginId >> 3] & (1 << (pluginId & 7)))
+            length += snprintf_P(&reply[length], sizeof(reply) - length, PSTR("%i,"), pluginId);
+        }
+        if (reply[length - 1] == ',')
+          length--;
+        reply[length++] = ']';
+      }
+      reply[length++] = '}';
+      client->text(reply, length);
+    }
+
+    // "classes=decode;captures=on;" sent by a client
+    void executeClientCommand(AsyncWebSocketClient *client, Subscriber &subscriber, char *command) {
+      for (char *token = command; *token != 0;) {
+        char *end = token + strcspn(token, ";");
+        char *equal = (char *) memchr(token, '=', end - token);
+        if (equal == nullptr) {
+          if (end != token)
+            sendError(client, PSTR("expected name=value;"));
+          break;
+        }
+        PGM_P error = applyFilter(subscriber, token, equal - token, equal + 1);
+        if (error != nullptr) {
+          sendError(client, error);
+          break;
+        }
+        token = *end == ';' ? end + 1 : end;
+      }
+      sendFilters(client, subscriber);
+    }
+
+    void onConnect(AsyncWebSocketClient *client, AsyncWebServerRequest *request) {
+      Subscriber *subscriber = params::enabled ? findSubscriber(0) : nullptr;
+      if (subscriber == nullptr) {
+        counters::refused++;
+        client->close(1013, params::enabled ? "too many clients" : "events are disabled");
+        return;
+      }
+
+      subscriber->classes = Messages::Class_Decode;
+      subscriber->captures = false;
+      subscriber->pluginsFiltered = false;
+      subscriber->sent = 0;
+      subscriber->dropped = 0;
+      subscriber->droppedInARow = 0;
+
+      PGM_P names[] = {filters::classes, filters::plugins, filters::captures};
+      for (auto name : names) {
+        char nameBuffer[12];
+        strncpy_P(nameBuffer, name, sizeof(nameBuffer));
+        if (request == nullptr || !request->hasParam(nameBuffer))
+          continue;
+        PGM_P error = applyFilter(*subscriber, nameBuffer, strlen(nameBuffer), request->getParam(nameBuffer)->value().c_str());
+        if (error != nullptr)
+          sendError(client, error);
+      }
+
+      subscriber->id = client->id(); // last, so broadcasts never see a half set subscriber
+      countCaptureSubscribers();
+      sendFilters(client, *subscriber);
+    }
+
+    void onEvent(AsyncWebSocket *server, AsyncWebSocketClient *client, AwsEventType type, void *arg, uint8_t *data, size_t len) {
+      switch (type) {
+        case WS_EVT_CONNECT:
+          onConnect(client, (AsyncWebServerRequest *) arg);
+          break;
+
+        case WS_EVT_DISCONNECT: {
+          Subscriber *subscriber = findSubscriber(client->id());
+          if (subscriber != nullptr)
+            subscriber->id = 0;
+          countCaptureSubscribers();
+          break;
+        }
+
+        case WS_EVT_DATA: {
+          Subscriber *subscriber = findSubscriber(client->id());
+          AwsFrameInfo *info = (AwsFrameInfo *) arg;
+          if (subscriber == nullptr)
+            break;
+          if (!info->final || info->index != 0 || info->len != len || info->opcode != WS_TEXT || len >= EVENTS_COMMAND_SIZE) {
+            sendError(client, PSTR("filters must be sent as one short text frame"));
+            break;
+          }
+          char command[EVENTS_COMMAND_SIZE];
+          memcpy(command, data, len);
+          command[len] = 0;
+          executeClientCommand(client, *subscriber, command);
+          break;
+        }
+
+        default:
+          break;
+      }
+    }
+
+    /**
+     * Queues an event for a client unless its message queue in the library is full, a client whose queue stays full
+     * for EVENTS_MAX_DROPS events in a row is too slow and gets disconnected. The size of the event is not checked
+     * against the TCP send window, the library copies it and sends it over as many ACKs as it takes.
+     * */
+    bool send(Subscriber &subscriber, const char *text, size_t length) {
+      AsyncWebSocketClient *client = runtime::socket.client(subscriber.id);
+      if (client == nullptr || client->status() != WS_CONNECTED)
+        return false;
+
+      if (client->queueIsFull()) {
+        subscriber.dropped++;
+        counters::dropped++;
+        if (++subscriber.droppedInARow >= EVENTS_MAX_DROPS) {
+          counters::disconnected++;
+          subscriber.id = 0;
+          countCaptureSubscribers();
+          client->close(1008, "too slow");
+        }
+        return false;
+      }
+
+      if (subscriber.droppedInARow > 0) {
+        char notice[40];
+        int noticeLength = snprintf_P(notice, sizeof(notice), PSTR("{\"type\":\"dropped\",\"count\":%u}"),
+                                      (unsigned int) subscriber.droppedInARow);
+        client->text(notice, noticeLength);
+        subscriber.droppedInARow = 0;
+        if (client->queueIsFull()) { // the notice took the last slot, the event counts as a fresh drop
+          subscriber.dropped++;
+          counters::dropped++;
+          subscriber.droppedInARow = 1;
+          return false;
+        }
+      }
+
+      client->text(text, length);
+      subscriber.sent++;
+      counters::sent++;
+      return true;
+    }
+
+    const char *className(uint8_t messageClass) {
+      switch (messageClass) {
+        case Messages::Class_Decode:
+          return "decode";
+        case Messages::Class_Reply:
+          return "reply";
+        case Messages::Class_Pulses:
+          return "pulses";
+        default:
+          return "debug";
+      }
+    }
+
+    /**
+     * Renders a queued message in runtime::output, with the fields of its binary frame for decoded signals
+     * @return length of the event, 0 if it did not fit
+     * */
+    size_t render(const Messages::Message &message) {
+      char text[PRINT_BUFFER_SIZE];
+      size_t textLength = message.length;
+      while (textLength > 0 && (message.text[textLength - 1] == '\r' || message.text[textLength - 1] == '\n'))
+        textLength--;
+      memcpy(text, message.text, textLength);
+      text[textLength] = 0;
+
+      StaticJsonDocument<EVENTS_JSON_SIZE> json;
+      json[F("type")] = className(message.messageClass);
+      json[F("seq")] = message.sequence;
+      json[F("time")] = message.captured;
+      json[F("text")] = (const char *) text; // not copied, serialized before text goes away
+      if (message.messageClass == Messages::Class_Decode) {
+        json[F("plugin")] = message.pluginId;
+        if (message.frameLength > 0) {
+          JsonObject fields = json.createNestedObject(F("fields"));
+          Binary::frameToJson(message.frame, message.frameLength, fields);
+        }
+      }
+
+      size_t length = serializeJson(json, runtime::output, sizeof(runtime::output));
+      if (json.overflowed() || length >= sizeof(runtime::output) - 1)
+        return 0;
+      return length;
+    }
+
+    void broadcastMessage(const Messages::Message &message) {
+      size_t length = 0; // rendered only if someone wants it
+
+      for (auto &subscriber : runtime::subscribers) {
+        if (subscriber.id == 0 || !subscriber.wants(message.messageClass, message.pluginId))
+          continue;
+        if (length == 0 && (length = render(message)) == 0)
+          return;
+        send(subscriber, runtime::output, length);
+      }
+    }
+
+    void printCapture(Print &output, const Signal::RawSignalStruct &signal) {
+      output.print(F("{\"type\":\"capture\",\"time\":"));
+      output.print(signal.Time);
+      output.print(F(",\"rssi\":"));
+      output.print(signal.rssi, 0);
+      output.print(F(",\"end\":\""));
+      output.print(FPSTR(Signal::endReasonToString(signal.endReason)));
+      output.print(F("\",\"pulses\":["));
+      for (int i = 1; i <= signal.Number; i++) {
+        if (i > 1)
+          output.write(',');
+        output.print((unsigned long) signal.Pulses[i] * signal.Multiply);
+      }
+      output.print(F("]}"));
+    }
+
+    void publishCapture(const Signal::RawSignalStruct &signal) {
+      if (runtime::captureSubscribers == 0)
+        return;
+
+      EventPrint measure(nullptr, 0);
+      printCapture(measure, signal);
+
+      char *event = nullptr;
+      bool sent = false;
+      for (auto &subscriber : runtime::subscribers) {
+        if (subscriber.id == 0 || !subscriber.captures)
+          continue;
+        if (event == nullptr) {
+          event = new(std::nothrow) char[measure.length];
+          if (event == nullptr) { // dropped for everyone
+            counters::dropped += runtime::captureSubscribers;
+            return;
+          }
+          EventPrint output(event, measure.length);
+          printCapture(output, signal);
+        }
+        sent = send(subscriber, event, measure.length) || sent; // the client keeps its own copy
+      }
+
+      delete[] event;
+      if (sent)
+        counters::captures++;
+    }
+
+    uint8_t clientsCount() {
+      uint8_t count = 0;
+      for (auto &subscriber : runtime::subscribers) {
+        if (subscriber.id != 0)
+          count++;
+      }
+      return count;
+    }
+
+    void closeAll() {
+      for (auto &subscriber : runtime::subscribers)
+        subscriber.id = 0;
+      runtime::captureSubscribers = 0;
+      runtime::socket.closeAll(1001, "events are disabled");
+    }
+
+    void init(AsyncWebServer &server) {
+      refreshParametersFromConfig(false);
+      runtime::socket.onEvent(onEvent);
+      server.addHandler(&runtime::socket);
+    }
+
+    void setAuthentication(const char *user, const char *password) {
+      runtime::socket.setAuthentication(user, password);
+    }
+
+    void paramsUpdatedCallback() {
+      refreshParametersFromConfig();
+    }
+
+    void refreshParametersFromConfig(bool triggerChanges) {
+      Config::ConfigItem *item;
+
+      item = Config::findConfigItem(json_name_enabled, Config::SectionId::Events_id);
+      if (params::enabled != item->getBoolValue()) {
+        params::enabled = item->getBoolValue();
+        if (!params::enabled)
+          closeAll();
+        if (triggerChanges)
+          Serial.println(params::enabled ? F("Live events enabled.") : F("Live events disabled."));
+      }
+    }
+
+    void executeCliCommand(char *cmd) {
+      char *commaIndex = strchr(cmd, ';');
+
+      if (commaIndex == nullptr) {
+        Serial.println(F("Error : failed to find ending ';' for the command"));
+        return;
+      }
+
+      int commandSize = commaIndex - cmd;
+      *commaIndex = 0; // replace ';' with null termination
+
+      if (strncasecmp_P(cmd, commands::show, commandSize) == 0) {
+        sprintf_P(printBuf, PSTR("20;XX;DEBUG;EVENTS;ENABLED=%i;CLIENTS=%u;MAX=%u;SENT=%lu;DROPPED=%lu;DISCONNECTED=%lu;REFUSED=%lu;CAPTURES=%lu;"),
+                  (int) params::enabled, (unsigned int) clientsCount(), (unsigned int) EVENTS_MAX_CLIENTS,
+                  counters::sent, counters::dropped, counters::disconnected, counters::refused, counters::captures);
+        sendRawPrint(printBuf, true);
+        for (auto &subscriber : runtime::subscribers) {
+          if (subscriber.id == 0)
+            continue;
+          AsyncWebSocketClient *client = runtime::socket.client(subscriber.id);
+          char classes[40];
+          Messages::classesToString(subscriber.classes, classes);
+          sprintf_P(printBuf, PSTR("20;XX;DEBUG;EVENTS;CLIENT=%s;CLASSES=%s;PLUGINS=%s;CAPTURES=%i;SENT=%lu;DROPPED=%lu;"),
+                    client != nullptr ? client->remoteIP().toString().c_str() : "?", classes,
+                    subscriber.pluginsFiltered ? "some" : "all", (int) subscriber.captures, subscriber.sent,
+                    subscriber.dropped);
+          sendRawPrint(printBuf, true);
+        }
+      }
+      else {
+        Serial.printf_P(PSTR("Error : unknown command '%s'\r\n"), cmd);
+      }
+    }
+
+    void getStatusJsonString(JsonObject &output) {
+      auto &&events = output.createNestedObject("events");
+      events[F("enabled")] = params::enabled;
+      events[F("clients")] = clientsCount();
+      events[F("max_clients")] = EVENTS_MAX_CLIENTS;
+      events[F("sent")] = counters::sent;
+      events[F("dropped")] = counters::dropped;
+      events[F("disconnected")] = counters::disconnected;
+      events[F("refused")] = counters::refused;
+      events[F("captures")] = counters::captures;
+    }
+
+  } // end of Events namespace
+} // end of RFLink namespace
+
+#endif // RFLINK_PORTAL_DISABLED
@@ -0,0 +1,74 @@
+#ifndef _19_EVENTS_H_
+#define _19_EVENTS_H_
+
+#include <Arduino.h>
+#include "RFLink.h"
+
+#ifndef RFLINK_PORTAL_DISABLED
+
+#include "2_Signal.h"
+#include "11_Config.h"
+#include "15_Messages.h"
+
+class AsyncWebServer;
+
+// Live events for the WebSocket clients of /api/events: queued messages (decoded signals, replies, debug traces) and,
+// when asked for, raw captures, as one JSON text frame each. Every client sets its own filters.
+// An event is only queued for a client whose message queue in the WebSocket library is not full: a slow browser gets
+// events dropped (and is told how many) instead of piling them up in RAM, and is disconnected once too many were
+// dropped in a row.
+#ifdef ESP32
+#define EVENTS_MAX_CLIENTS 4
+#else
+#define EVENTS_MAX_CLIENTS 2
+#endif
+#define EVENTS_MAX_DROPS 64     // events dropped in a row before a client is disconnected
+#define EVENTS_JSON_SIZE 512    // a rendered message
+#define EVENTS_COMMAND_SIZE 96  // filters sent by a client
+
+namespace RFLink {
+  namespace Events {
+
+    extern Config::ConfigItem configItems[];
+
+    namespace params {
+      extern bool enabled;
+    }
+
+    namespace counters {
+      extern unsigned long int sent;
+      extern unsigned long int dropped;      // events a client had no room for
+      extern unsigned long int disconnected; // clients closed for being too slow
+      extern unsigned long int refused;      // connections beyond EVENTS_MAX_CLIENTS or while disabled
+      extern unsigned long int captures;     // raw captures sent to at least one client
+    }
+
+    /**
+     * Registers /api/events on the portal web server
+     * */
+    void init(AsyncWebServer &server);
+    void setAuthentication(const char *user, const char *password); // empty strings to let anyone connect
+
+    void paramsUpdatedCallback();
+    void refreshParametersFromConfig(bool triggerChanges=true);
+
+    uint8_t clientsCount();
+
+    /**
+     * Sends a queued message to the clients subscribed to its class (and plugin for decoded signals)
+     * */
+    void broadcastMessage(const Messages::Message &message);
+
+    /**
+     * Sends the pulses of a signal just captured to the clients which asked for captures, nothing is formatted
+     * when there are none
+     * */
+    void publishCapture(const Signal::RawSignalStruct &signal);
+
+    void executeCliCommand(char *cmd);
+    void getStatusJsonString(JsonObject &output);
+  }
+}
+
+#endif // RFLINK_PORTAL_DISABLED
+#endif // _19_EVENTS_H_
@@ -10,6 +10,7 @@
 #include "1_Radio.h"
 #include "4_Display.h"
 #include "2_Signal.h"
+#include "20_Metrics.h"
 
 
 #include <SPI.h>
@@ -543,6 +544,8 @@ namespace RFLink { namespace Radio  {
 
     void set_Radio_mode(States new_State, bool force)
     {
+      States previous_State = current_State;
+
       if(hardware == HardwareType::HW_basic_t)
         set_Radio_mode_generic(new_State, force);
       else if( hardware == HardwareType::HW_RFM69CW_t || hardware == HardwareType::HW_RFM69HCW_t )
@@ -553,6 +556,11 @@ namespace RFLink { namespace Radio  {
         set_Radio_mode_SX1276(new_State, force);
       else
         Serial.printf_P(PSTR("Error while trying to switch Radio state: unknown hardware id '%i'\r\n"), new_State);
+
+      if (previous_State != Radio_TX && current_State == Radio_TX)
+        Metrics::txStarted();
+      else if (previous_State == Radio_TX && current_State != Radio_TX)
+        Metrics::txEnded();
     }
 
     void setup() {
@@ -0,0 +1,351 @@
+#include <Arduino.h>
+#include "RFLink.h"
+#include "6_MQTT.h"
+#include "14_TX.h"
+#include "15_Messages.h"
+#include "20_Metrics.h"
+
+namespace RFLink {
+  namespace Metrics {
+
+    namespace commands {
+      const char show[] PROGMEM = "show";
+      const char clear[] PROGMEM = "clear";
+    }
+
+    namespace runtime {
+      uint32_t cyclesPerMicrosecond = 80; // until setup() reads the CPU frequency
+      unsigned long txStarted_us = 0;
+    }
+
+    namespace counters {
+      unsigned long int captures[Signal::EndReasons::REASONS_EOF];
+      Histogram decode;
+      Histogram slicer;
+      Histogram txAirtime;
+      unsigned long long txAirtime_us = 0;
+      PluginCounters plugins[PLUGIN_MAX];
+      uint32_t heapLowWater = 0;
+    }
+
+    // groups of lines of the /metrics page, a family never spans two of them except the per plugin ones
+    enum Unit {
+      Unit_Uptime,
+      Unit_Heap,
+      Unit_Signals,
+      Unit_Captures,
+      Unit_Decode,
+      Unit_Slicer,
+      Unit_TXAirtime,
+      Unit_Queue,
+      Unit_SinkLag,
+      Unit_SinkSent,
+      Unit_SinkDropped,
+      Unit_TXRequests,
+      Unit_MQTTConnections,
+      Unit_MQTTPublishes,
+      Unit_Plugins, // followed by METRICS_PLUGIN_UNITS units per plugin family
+    };
+#define METRICS_PLUGINS_PER_UNIT 8 // 677 bytes at most with the family header, every plugin called and counters at their maximum
+#define METRICS_PLUGIN_UNITS ((PLUGIN_MAX + METRICS_PLUGINS_PER_UNIT - 1) / METRICS_PLUGINS_PER_UNIT)
+#define METRICS_PLUGIN_FAMILIES 3
+
+    uint32_t Histogram::percentile(uint8_t percent) const {
+      if (count == 0)
+        return 0;
+      uint32_t target = ((uint64_t) count * percent + 99) / 100;
+      uint32_t seen = 0;
+      for (uint8_t index = 0; index < METRICS_BUCKETS; index++) {
+        seen += buckets[index];
+        if (seen >= target)
+          return 1UL << (2 * index);
+      }
+      return max_us;
+    }
+
+    void Histogram::clear() {
+      memset(this, 0, sizeof(*this));
+    }
+
+    uint32_t heapLowWater() {
+#ifdef ESP32
+      return ESP.getMinFreeHeap(); // kept by the allocator, allocations made between two loops are seen too
+#else
+      return counters::heapLowWater;
+#endif
+    }
+
+    void setup() {
+      runtime::cyclesPerMicrosecond = ESP.getCpuFreqMHz();
+      counters::heapLowWater = ESP.getFreeHeap();
+      clear();
+    }
+
+    void mainLoop() {
+#ifndef ESP32
+      uint32_t heap = ESP.getFreeHeap();
+      if (heap < counters::heapLowWater)
+        counters::heapLowWater = heap;
+#endif
+    }
+
+    void clear() {
+      memset(counters::captures, 0, sizeof(counters::captures));
+      counters::decode.clear();
+      counters::slicer.clear();
+      counters::txAirtime.clear();
+      counters::txAirtime_us = 0;
+      memset(counters::plugins, 0, sizeof(counters::plugins));
+    }
+
+    void printFamily(Print &output, PGM_P name, PGM_P type, PGM_P help) {
+      output.print(F("# HELP "));
+      output.print(FPSTR(name));
+      output.write(' ');
+      output.print(FPSTR(help));
+      output.print(F("\n# TYPE "));
+      output.print(FPSTR(name));
+      output.write(' ');
+      output.print(FPSTR(type));
+      output.write('\n');
+    }
+
+    // value given in microseconds, printed in seconds
+    void printSeconds(Print &output, unsigned long long value_us) {
+      char buffer[24];
+      snprintf_P(buffer, sizeof(buffer), PSTR("%lu.%06lu"), (unsigned long) (value_us / 1000000ULL),
+                 (unsigned long) (value_us % 1000000ULL));
+      output.print(buffer);
+    }
+
+    /**
+     * @param labels 'name="value"' pairs without braces, nullptr for none
+     * */
+    void printSample(Print &output, PGM_P name, PGM_P suffix, const char *labels, unsigned long value) {
+      output.print(FPSTR(name));
+      if (suffix != nullptr)
+        output.print(FPSTR(suffix));
+      if (labels != nullptr) {
+        output.write('{');
+        output.print(labels);
+        output.write('}');
+      }
+      output.write(' ');
+      output.print(value);
+      output.write('\n');
+    }
+
+    void printHistogram(Print &output, PGM_P name, PGM_P help, const Histogram &histogram) {
+      printFamily(output, name, PSTR("histogram"), help);
+      uint32_t cumulative = 0;
+      for (uint8_t index = 0; index <= METRICS_BUCKETS; index++) {
+        cumulative += histogram.buckets[index];
+        output.print(FPSTR(name));
+        output.print(F("_bucket{le=\""));
+        if (index < METRICS_BUCKETS)
+          printSeconds(output, 1ULL << (2 * index));
+        else
+          output.print(F("+Inf"));
+        output.print(F("\"} "));
+        output.print(cumulative);
+        output.write('\n');
+      }
+      output.print(FPSTR(name));
+      output.print(F("_sum "));
+      printSeconds(output, histogram.sum_us);
+      output.write('\n');
+      printSample(output, name, PSTR("_count"), nullptr, histogram.count);
+    }
+
+    void printSinks(Print &output, PGM_P name, PGM_P type, PGM_P help, unsigned long (*value)(Messages::SinkId)) {
+      char labels[24];
+      printFamily(output, name, type, help);
+      for (int sink = 0; sink < Messages::Sink_EOF; sink++) {
+        snprintf_P(labels, sizeof(labels), PSTR("sink=\"%s\""), Messages::sinkNames[sink]);
+        printSample(output, name, nullptr, labels, value((Messages::SinkId) sink));
+      }
+    }
+
+    void printPlugins(Print &output, uint8_t family, uint8_t group) {
+      static PGM_P const names[METRICS_PLUGIN_FAMILIES] = {
+              PSTR("rflink_plugin_calls_total"), PSTR("rflink_plugin_decoded_total"), PSTR("rflink_plugin_decode_seconds_total")};
+      static PGM_P const helps[METRICS_PLUGIN_FAMILIES] = {
+              PSTR("Signals given to the plugin"), PSTR("Signals decoded by the plugin"),
+              PSTR("Time spent in the plugin decoder")};
+
+      if (group == 0)
+        printFamily(output, names[family], PSTR("counter"), helps[family]);
+
+      char labels[16];
+      uint8_t last = (group + 1) * METRICS_PLUGINS_PER_UNIT < PLUGIN_MAX ? (group + 1) * METRICS_PLUGINS_PER_UNIT : PLUGIN_MAX;
+      for (uint8_t x = group * METRICS_PLUGINS_PER_UNIT; x < last; x++) {
+        const PluginCounters &plugin = counters::plugins[x];
+        if (Plugin_id[x] == 0 || plugin.calls == 0)
+          continue;
+        snprintf_P(labels, sizeof(labels), PSTR("plugin=\"%03u\""), (unsigned int) Plugin_id[x]);
+        if (family == 0)
+          printSample(output, names[family], nullptr, labels, plugin.calls);
+        else if (family == 1)
+          printSample(output, names[family], nullptr, labels, plugin.decoded);
+        else {
+          output.print(FPSTR(names[family]));
+          output.write('{');
+          output.print(labels);
+          output.print(F("} "));
+          printSeconds(output, plugin.cycles / runtime::cyclesPerMicrosecond);
+          output.write('\n');
+        }
+      }
+    }
+
+    bool printUnit(Print &output, uint16_t unit) {
+      switch (unit) {
+        case Unit_Uptime:
+          printFamily(output, PSTR("rflink_uptime_seconds"), PSTR("gauge"), PSTR("Time since boot"));
+          printSample(output, PSTR("rflink_uptime_seconds"), nullptr, nullptr, millis() / 1000);
+          return true;
+
+        case Unit_Heap:
+          printFamily(output, PSTR("rflink_heap_free_bytes"), PSTR("gauge"), PSTR("Free heap"));
+          printSample(output, PSTR("rflink_heap_free_bytes"), nullptr, nullptr, ESP.getFreeHeap());
+          printFamily(output, PSTR("rflink_heap_min_free_bytes"), PSTR("gauge"), PSTR("Lowest free heap since boot"));
+          printSample(output, PSTR("rflink_heap_min_free_bytes"), nullptr, nullptr, heapLowWater());
+#ifdef ESP8266
+          printFamily(output, PSTR("rflink_heap_max_block_bytes"), PSTR("gauge"), PSTR("Largest block which can be allocated"));
+          printSample(output, PSTR("rflink_heap_max_block_bytes"), nullptr, nullptr, ESP.getMaxFreeBlockSize());
+#endif
+          return true;
+
+        case Unit_Signals:
+          printFamily(output, PSTR("rflink_signals_received_total"), PSTR("counter"), PSTR("Signals captured by the slicer"));
+          printSample(output, PSTR("rflink_signals_received_total"), nullptr, nullptr, Signal::counters::receivedSignalsCount);
+          printFamily(output, PSTR("rflink_signals_decoded_total"), PSTR("counter"), PSTR("Signals decoded by a plugin"));
+          printSample(output, PSTR("rflink_signals_decoded_total"), nullptr, nullptr, Signal::counters::successfullyDecodedSignalsCount);
+          return true;
+
+        case Unit_Captures: {
+          char labels[48];
+          printFamily(output, PSTR("rflink_captures_total"), PSTR("counter"), PSTR("Signals captured, per reason their capture ended"));
+          for (int reason = 0; reason < Signal::EndReasons::REASONS_EOF; reason++) {
+            snprintf_P(labels, sizeof(labels), PSTR("end_reason=\"%s\""), Signal::endReasonToString((Signal::EndReasons) reason));
+            printSample(output, PSTR("rflink_captures_total"), nullptr, labels, counters::captures[reason]);
+          }
+          return true;
+        }
+
+        case Unit_Decode:
+          printHistogram(output, PSTR("rflink_decode_seconds"), PSTR("Time the plugins took on a signal"), counters::decode);
+          return true;
+
+        case Unit_Slicer:
+          printHistogram(output, PSTR("rflink_slicer_seconds"), PSTR("Main loop time spent in the slicer per captured signal"), counters::slicer);
+          return true;
+
+        case Unit_TXAirtime:
+          printHistogram(output, PSTR("rflink_tx_airtime_seconds"), PSTR("Time the radio stayed in TX mode per transmission"), counters::txAirtime);
+          return true;
+
+        case Unit_Queue:
+          printFamily(output, PSTR("rflink_messages_queued"), PSTR("gauge"), PSTR("Messages not sent yet by every output"));
+          printSample(output, PSTR("rflink_messages_queued"), nullptr, nullptr, Messages::count());
+          printFamily(output, PSTR("rflink_messages_queue_high_watermark"), PSTR("gauge"), PSTR("Most messages queued at once"));
+          printSample(output, PSTR("rflink_messages_queue_high_watermark"), nullptr, nullptr, Messages::counters::highWatermark);
+          printFamily(output, PSTR("rflink_messages_dropped_total"), PSTR("counter"), PSTR("Messages dropped by the full queue"));
+          printSample(output, PSTR("rflink_messages_dropped_total"), nullptr, "policy=\"oldest\"", Messages::counters::droppedOldest);
+          printSample(output, PSTR("rflink_messages_dropped_total"), nullptr, "policy=\"newest\"", Messages::counters::droppedNewest);
+          return true;
+
+        case Unit_SinkLag:
+          printSinks(output, PSTR("rflink_sink_lag"), PSTR("gauge"), PSTR("Queued messages an output has not sent yet"),
+                     [](Messages::SinkId sink) -> unsigned long { return Messages::lag(sink); });
+          return true;
+
+        case Unit_SinkSent:
+          printSinks(output, PSTR("rflink_sink_sent_total"), PSTR("counter"), PSTR("Messages sent by an output"),
+                     [](Messages::SinkId sink) -> unsigned long { return Messages::counters::sinks[sink].sent; });
+          return true;
+
+        case Unit_SinkDropped:
+          printSinks(output, PSTR("rflink_sink_dropped_total"), PSTR("counter"), PSTR("Messages an output never sent"),
+                     [](Messages::SinkId sink) -> unsigned long { return Messages::counters::sinks[sink].dropped; });
+          return true;
+
+        case Unit_TXRequests:
+          printFamily(output, PSTR("rflink_tx_queued_requests"), PSTR("gauge"), PSTR("TX requests waiting to be transmitted"));
+          printSample(output, PSTR("rflink_tx_queued_requests"), nullptr, nullptr, TX::queuedRequests());
+          printFamily(output, PSTR("rflink_tx_requests_total"), PSTR("counter"), PSTR("TX requests, per outcome"));
+          printSample(output, PSTR("rflink_tx_requests_total"), nullptr, "result=\"sent\"", TX::counters::requestsSent);
+          printSample(output, PSTR("rflink_tx_requests_total"), nullptr, "result=\"rejected\"", TX::counters::requestsRejected);
+          return true;
+
+        case Unit_MQTTConnections:
+#ifndef RFLINK_MQTT_DISABLED
+          printFamily(output, PSTR("rflink_mqtt_connected"), PSTR("gauge"), PSTR("1 while connected to the broker"));
+          printSample(output, PSTR("rflink_mqtt_connected"), nullptr, nullptr, Mqtt::isConnected() ? 1 : 0);
+          printFamily(output, PSTR("rflink_mqtt_connection_attempts_total"), PSTR("counter"), PSTR("Connections attempted"));
+          printSample(output, PSTR("rflink_mqtt_connection_attempts_total"), nullptr, nullptr, Mqtt::counters::attempts);
+          printFamily(output, PSTR("rflink_mqtt_connections_total"), PSTR("counter"), PSTR("Connections established"));
+          printSample(output, PSTR("rflink_mqtt_connections_total"), nullptr, nullptr, Mqtt::counters::connections);
+#endif
+          return true;
+
+        case Unit_MQTTPublishes:
+#ifndef RFLINK_MQTT_DISABLED
+          printFamily(output, PSTR("rflink_mqtt_published_total"), PSTR("counter"), PSTR("PUBLISH packets sent, retransmissions included"));
+          printSample(output, PSTR("rflink_mqtt_published_total"), nullptr, nullptr, Mqtt::counters::published);
+          printFamily(output, PSTR("rflink_mqtt_retried_total"), PSTR("counter"), PSTR("QoS 1 retransmissions"));
+          printSample(output, PSTR("rflink_mqtt_retried_total"), nullptr, nullptr, Mqtt::counters::retried);
+          printFamily(output, PSTR("rflink_mqtt_lost_total"), PSTR("counter"), PSTR("QoS 1 messages never acknowledged"));
+          printSample(output, PSTR("rflink_mqtt_lost_total"), nullptr, nullptr, Mqtt::counters::lost);
+#endif
+          return true;
+
+        default:
+          break;
+      }
+
+      uint16_t index = unit - Unit_Plugins;
+      if (index >= METRICS_PLUGIN_FAMILIES * METRICS_PLUGIN_UNITS)
+        return false;
+      printPlugins(output, index / METRICS_PLUGIN_UNITS, index % METRICS_PLUGIN_UNITS);
+      return true;
+    }
+
+    void showHistogram(PGM_P name, const Histogram &histogram) {
+      sprintf_P(printBuf, PSTR("20;XX;DEBUG;METRICS;HISTOGRAM=%s;COUNT=%lu;P50=%lu;P90=%lu;P99=%lu;MAX=%lu;"), name,
+                (unsigned long) histogram.count, (unsigned long) histogram.percentile(50),
+                (unsigned long) histogram.percentile(90), (unsigned long) histogram.percentile(99),
+                (unsigned long) histogram.max_us);
+      sendRawPrint(printBuf, true);
+    }
+
+    void executeCliCommand(char *cmd) {
+      char *commaIndex = strchr(cmd, ';');
+
+      if (commaIndex == nullptr) {
+        Serial.println(F("Error : failed to find ending ';' for the command"));
+        return;
+      }
+
+      int commandSize = commaIndex - cmd;
+      *commaIndex = 0; // replace ';' with null termination
+
+      if (strncasecmp_P(cmd, commands::show, commandSize) == 0) {
+        showHistogram(PSTR("decode_us"), counters::decode);
+        showHistogram(PSTR("slicer_us"), counters::slicer);
+        showHistogram(PSTR("tx_airtime_us"), counters::txAirtime);
+        sprintf_P(printBuf, PSTR("20;XX;DEBUG;METRICS;TX_AIRTIME=%lums;HEAP_LOW_WATER=%lu;"),
+                  (unsigned long) (counters::txAirtime_us / 1000), (unsigned long) heapLowWater());
+        sendRawPrint(printBuf, true);
+      }
+      else if (strncasecmp_P(cmd, commands::clear, commandSize) == 0) {
+        clear();
+        sendRawPrint(F("20;XX;DEBUG;METRICS;CLEARED;"), true);
+      }
+      else {
+        Serial.printf_P(PSTR("Error : unknown command '%s'\r\n"), cmd);
+      }
+    }
+
+  } // end of Metrics namespace
+} // end of RFLink namespace
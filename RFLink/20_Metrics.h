@@ -0,0 +1,105 @@
+#ifndef _20_METRICS_H_
+#define _20_METRICS_H_
+
+#include <Arduino.h>
+#include "RFLink.h"
+#include "2_Signal.h"
+#include "5_Plugin.h"
+
+// Counters and fixed-bucket histograms of the receive, decode and transmit paths, exposed on /metrics in the
+// Prometheus text format. Recording a value is a couple of additions and a count-leading-zeros, plugins are timed
+// with the CPU cycle counter, so the hooks can stay in the capture and decode loops.
+#define METRICS_BUCKETS 13            // powers of 4 microseconds: 1us, 4us ... 16.7s, then +Inf
+#define METRICS_SECTION_SIZE 1280     // text of the largest group of lines printUnit() renders at once, 1041 bytes with all counters at their maximum
+
+namespace RFLink {
+  namespace Metrics {
+
+    struct Histogram {
+      uint32_t buckets[METRICS_BUCKETS + 1]; // not cumulative, the last one counts values above the largest bound
+      uint32_t count;
+      uint64_t sum_us;
+      uint32_t max_us;
+
+      inline void observe(uint32_t value_us) {
+        // smallest i with value_us <= 4^i
+        uint8_t index = value_us <= 1 ? 0 : (33 - __builtin_clz(value_us - 1)) / 2;
+        buckets[index < METRICS_BUCKETS ? index : METRICS_BUCKETS]++;
+        count++;
+        sum_us += value_us;
+        if (value_us > max_us)
+          max_us = value_us;
+      }
+
+      uint32_t percentile(uint8_t percent) const; // upper bound of the bucket holding it, in microseconds
+      void clear();
+    };
+
+    struct PluginCounters {
+      uint32_t calls;
+      uint32_t decoded;
+      uint64_t cycles;
+    };
+
+    namespace runtime {
+      extern uint32_t cyclesPerMicrosecond;
+      extern unsigned long txStarted_us;
+    }
+
+    namespace counters {
+      extern unsigned long int captures[Signal::EndReasons::REASONS_EOF]; // signals handed to the plugins, per end reason
+      extern Histogram decode;    // all plugins of one signal, until one decodes it
+      extern Histogram slicer;    // main loop time in the slicer for each captured signal
+      extern Histogram txAirtime; // time the radio stayed in TX mode, per transmission
+      extern unsigned long long txAirtime_us;
+      extern PluginCounters plugins[PLUGIN_MAX];
+      extern uint32_t heapLowWater;
+    }
+
+    void setup();
+    void mainLoop(); // samples the free heap
+
+    inline uint32_t cycles() {
+      return ESP.getCycleCount();
+    }
+
+    inline void countCapture(Signal::EndReasons reason) {
+      if (reason < Signal::EndReasons::REASONS_EOF)
+        counters::captures[reason]++;
+    }
+
+    inline void pluginCalled(uint8_t index, uint32_t spentCycles, bool decoded) {
+      PluginCounters &plugin = counters::plugins[index];
+      plugin.calls++;
+      plugin.cycles += spentCycles;
+      if (decoded)
+        plugin.decoded++;
+    }
+
+    inline void decodeDone(uint32_t spentCycles) {
+      counters::decode.observe(spentCycles / runtime::cyclesPerMicrosecond);
+    }
+
+    // called by Radio::set_Radio_mode() when the radio enters and leaves TX mode
+    inline void txStarted() {
+      runtime::txStarted_us = micros();
+    }
+
+    inline void txEnded() {
+      unsigned long airtime = micros() - runtime::txStarted_us;
+      counters::txAirtime.observe(airtime);
+      counters::txAirtime_us += airtime;
+    }
+
+    /**
+     * Prints one group of lines of the /metrics page, at most METRICS_SECTION_SIZE bytes, so it can be sent in chunks
+     * @return false once unit is past the last group
+     * */
+    bool printUnit(Print &output, uint16_t unit);
+
+    void clear();
+    void executeCliCommand(char *cmd);
+  }
+}
+
+#endif // _20_METRICS_H_
@@ -10,6 +10,10 @@
 #include "2_Signal.h"
 #include "5_Plugin.h"
 #include "4_Display.h"
+#include "14_TX.h"
+#include "15_Messages.h"
+#include "19_Events.h"
+#include "20_Metrics.h"
 
 unsigned long SignalCRC = 0L;   // holds the bitstream value for some plugins to identify RF repeats
 unsigned long SignalCRC_1 = 0L; // holds the previous SignalCRC (for mixed burst protocols)
@@ -34,6 +38,8 @@ namespace RFLink
       const char testRFMoveForward[] PROGMEM = "testRFMoveForward";
       const char enableVerboseSignalFetchLoop[] PROGMEM = "enableVerboseSignalFetchLoop";
       const char disableVerboseSignalFetchLoop[] PROGMEM = "disableVerboseSignalFetchLoop";
+      const char enableCompactDebug[] PROGMEM = "enableCompactDebug";
+      const char disableCompactDebug[] PROGMEM = "disableCompactDebug";
     }
 
     namespace counters {
@@ -43,6 +49,7 @@ namespace RFLink
 
     namespace runtime {
       bool verboseSignalFetchLoop = false;
+      bool compactDebug = false;
       Slicer_enum appliedSlicer = Slicer_enum::Default;
     }
 
@@ -602,6 +609,7 @@ namespace RFLink
         while (Timer > millis()) // || RepeatingTimer > millis())
         {
           bool success = false;
+          unsigned long slicerStarted = micros();
 
           if(runtime::appliedSlicer == Slicer_enum::Legacy)
             success = FetchSignal_sync();
@@ -613,7 +621,12 @@ namespace RFLink
 
           if (success)
           { // RF: *** data start ***
+            Metrics::counters::slicer.observe(micros() - slicerStarted);
             counters::receivedSignalsCount++;
+            Metrics::countCapture(RawSignal.endReason);
+#ifndef RFLINK_PORTAL_DISABLED
+            Events::publishCapture(RawSignal);
+#endif
             if (PluginRXCall(0, 0))
             { // Check all plugins to see which plugin can handle the received signal.
               counters::successfullyDecodedSignalsCount++;
@@ -635,16 +648,22 @@ namespace RFLink
         if (AsyncSignalScanner::nextPulseTimeoutTime_us > 0 && AsyncSignalScanner::nextPulseTimeoutTime_us < micros())
         { // may be current pulse has now timedout so we have a signal?
 
+          unsigned long slicerStarted = micros();
           AsyncSignalScanner::onPulseTimerTimeout(); // refresh signal properties
 
           if (!RawSignal.readyForDecoder) // still dont have a valid signal?
             return false;
+          Metrics::counters::slicer.observe(micros() - slicerStarted);
         }
         else
           return false;
       }
 
       counters::receivedSignalsCount++; // we have a signal, let's increment counters
+      Metrics::countCapture(RawSignal.endReason);
+#ifndef RFLINK_PORTAL_DISABLED
+      Events::publishCapture(RawSignal);
+#endif
 
       byte signalWasDecoded = PluginRXCall(0, 0); // Check all plugins to see which plugin can handle the received signal.
       if (signalWasDecoded)
@@ -842,46 +861,32 @@ namespace RFLink
         data = bitstream;
         if (cmd != 0xff)
           cmd = command;
-        digitalWrite(Radio::pins::TX_DATA, HIGH);
         //delayMicroseconds(fpulse);  //335
-        delayMicroseconds(335);
-        digitalWrite(Radio::pins::TX_DATA, LOW);
-        delayMicroseconds(AC_FPULSE * 10 + (AC_FPULSE >> 1)); //335*9=3015 //260*10=2600
+        TX::sendPulse(HIGH, 335);
+        TX::sendPulse(LOW, AC_FPULSE * 10 + (AC_FPULSE >> 1)); //335*9=3015 //260*10=2600
         for (unsigned short i = 0; i < 32; i++)
         {
           if (i == 27 && cmd != 0xff)
           { // DIM command, send special DIM sequence TTTT replacing on/off bit
-            digitalWrite(Radio::pins::TX_DATA, HIGH);
-            delayMicroseconds(AC_FPULSE);
-            digitalWrite(Radio::pins::TX_DATA, LOW);
-            delayMicroseconds(AC_FPULSE);
-            digitalWrite(Radio::pins::TX_DATA, HIGH);
-            delayMicroseconds(AC_FPULSE);
-            digitalWrite(Radio::pins::TX_DATA, LOW);
-            delayMicroseconds(AC_FPULSE);
+            TX::sendPulse(HIGH, AC_FPULSE);
+            TX::sendPulse(LOW, AC_FPULSE);
+            TX::sendPulse(HIGH, AC_FPULSE);
+            TX::sendPulse(LOW, AC_FPULSE);
           }
           else
             switch (data & B1)
             {
               case 0:
-                digitalWrite(Radio::pins::TX_DATA, HIGH);
-                delayMicroseconds(AC_FPULSE);
-                digitalWrite(Radio::pins::TX_DATA, LOW);
-                delayMicroseconds(AC_FPULSE);
-                digitalWrite(Radio::pins::TX_DATA, HIGH);
-                delayMicroseconds(AC_FPULSE);
-                digitalWrite(Radio::pins::TX_DATA, LOW);
-                delayMicroseconds(AC_FPULSE * 5); // 335*3=1005 260*5=1300  260*4=1040
+                TX::sendPulse(HIGH, AC_FPULSE);
+                TX::sendPulse(LOW, AC_FPULSE);
+                TX::sendPulse(HIGH, AC_FPULSE);
+                TX::sendPulse(LOW, AC_FPULSE * 5); // 335*3=1005 260*5=1300  260*4=1040
                 break;
               case 1:
-                digitalWrite(Radio::pins::TX_DATA, HIGH);
-                delayMicroseconds(AC_FPULSE);
-                digitalWrite(Radio::pins::TX_DATA, LOW);
-                delayMicroseconds(AC_FPULSE * 5);
-                digitalWrite(Radio::pins::TX_DATA, HIGH);
-                delayMicroseconds(AC_FPULSE);
-                digitalWrite(Radio::pins::TX_DATA, LOW);
-                delayMicroseconds(AC_FPULSE);
+                TX::sendPulse(HIGH, AC_FPULSE);
+                TX::sendPulse(LOW, AC_FPULSE * 5);
+                TX::sendPulse(HIGH, AC_FPULSE);
+                TX::sendPulse(LOW, AC_FPULSE);
                 break;
             }
           //Next bit
@@ -895,24 +900,16 @@ namespace RFLink
             switch (cmd & B1)
             {
               case 0:
-                digitalWrite(Radio::pins::TX_DATA, HIGH);
-                delayMicroseconds(AC_FPULSE);
-                digitalWrite(Radio::pins::TX_DATA, LOW);
-                delayMicroseconds(AC_FPULSE);
-                digitalWrite(Radio::pins::TX_DATA, HIGH);
-                delayMicroseconds(AC_FPULSE);
-                digitalWrite(Radio::pins::TX_DATA, LOW);
-                delayMicroseconds(AC_FPULSE * 5); // 335*3=1005 260*5=1300
+                TX::sendPulse(HIGH, AC_FPULSE);
+                TX::sendPulse(LOW, AC_FPULSE);
+                TX::sendPulse(HIGH, AC_FPULSE);
+                TX::sendPulse(LOW, AC_FPULSE * 5); // 335*3=1005 260*5=1300
                 break;
               case 1:
-                digitalWrite(Radio::pins::TX_DATA, HIGH);
-                delayMicroseconds(AC_FPULSE);
-                digitalWrite(Radio::pins::TX_DATA, LOW);
-                delayMicroseconds(AC_FPULSE * 5);
-                digitalWrite(Radio::pins::TX_DATA, HIGH);
-                delayMicroseconds(AC_FPULSE);
-                digitalWrite(Radio::pins::TX_DATA, LOW);
-                delayMicroseconds(AC_FPULSE);
+                TX::sendPulse(HIGH, AC_FPULSE);
+                TX::sendPulse(LOW, AC_FPULSE * 5);
+                TX::sendPulse(HIGH, AC_FPULSE);
+                TX::sendPulse(LOW, AC_FPULSE);
                 break;
             }
             //Next bit
@@ -920,10 +917,9 @@ namespace RFLink
           }
         }
         //Send termination/synchronisation-signal. Total length: 32 periods
-        digitalWrite(Radio::pins::TX_DATA, HIGH);
-        delayMicroseconds(AC_FPULSE);
-        digitalWrite(Radio::pins::TX_DATA, LOW);
-        delayMicroseconds(AC_FPULSE * 40); //31*335=10385 40*260=10400
+        TX::sendPulse(HIGH, AC_FPULSE);
+        TX::sendPulse(LOW, AC_FPULSE * 40); //31*335=10385 40*260=10400
+        TX::endFrame();
       }
       // End transmit
     }
@@ -932,7 +928,8 @@ namespace RFLink
     {
       int x;
 
-      Radio::set_Radio_mode(Radio::States::Radio_TX);
+      if (!TX::isRecording())
+        Radio::set_Radio_mode(Radio::States::Radio_TX);
 
       //RawSignal.Pulses[RawSignal.Number]=1;                                   // due to a bug in Arduino 1.0.1
 
@@ -942,64 +939,719 @@ namespace RFLink
         noInterrupts();
         while (x < signal->Number)
         {
-          digitalWrite(Radio::pins::TX_DATA, HIGH);
-          delayMicroseconds(signal->Pulses[x++] * signal->Multiply); // min een kleine correctie
-          digitalWrite(Radio::pins::TX_DATA, LOW);
-          delayMicroseconds(signal->Pulses[x++] * signal->Multiply); // min een kleine correctie
+          TX::sendPulse(HIGH, signal->Pulses[x++] * signal->Multiply); // corrected with board calibration table
+          TX::sendPulse(LOW, signal->Pulses[x++] * signal->Multiply);
         }
         interrupts();
-        if (y != signal->Repeats)
+        TX::endFrame(signal->Delay * 1000UL); // in a batch, other devices are sent during the delay
+        if (y != signal->Repeats && !TX::isRecording())
           delay(signal->Delay); // Delay buiten het gebied waar de interrupts zijn uitgeschakeld! Anders werkt deze funktie niet.
       }
 
-      Radio::set_Radio_mode(Radio::States::Radio_RX);
+      if (!TX::isRecording())
+        Radio::set_Radio_mode(Radio::States::Radio_RX);
     }
 
-    bool getSignalFromJson(RawSignalStruct &signal, const char *json_str)
+    /**
+     * Forward-only reader for the small JSON objects given to sendRF/testRF.
+     * It works in place on the command string and never allocates.
+     */
+    class JsonSignalReader
     {
-      int jsonSize = strlen(json_str) * 6;
-      DynamicJsonDocument json(jsonSize);
+    public:
+      const char *start;
+      const char *p;
+
+      explicit JsonSignalReader(const char *str) : start(str), p(str) {}
+
+      int position() const { return p - start; }
+
+      void skipBlanks()
+      {
+        while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')
+          p++;
+      }
+
+      bool consume(char c)
+      {
+        skipBlanks();
+        if (*p != c)
+          return false;
+        p++;
+        return true;
+      }
+
+      bool peek(char c)
+      {
+        skipBlanks();
+        return *p == c;
+      }
+
+      // reads a string, keeping at most size-1 chars of it
+      bool readString(char *destination, size_t size)
+      {
+        if (!consume('"'))
+          return false;
+        size_t length = 0;
+        while (*p != '"')
+        {
+          if (*p == 0)
+            return false;
+          if (*p == '\\' && *(p + 1) != 0)
+            p++;
+          if (length + 1 < size)
+            destination[length++] = *p;
+          p++;
+        }
+        p++;
+        destination[length] = 0;
+        return true;
+      }
+
+      // integer part of a JSON number, a fractional part is accepted and dropped
+      bool readNumber(long &value)
+      {
+        skipBlanks();
+        bool negative = false;
+        if (*p == '-')
+        {
+          negative = true;
+          p++;
+        }
+        if (!isdigit(*p))
+          return false;
+
+        value = 0;
+        while (isdigit(*p))
+        {
+          if (value > 100000000L) // way above anything we can store
+            return false;
+          value = value * 10 + (*p - '0');
+          p++;
+        }
+        if (*p == '.')
+        {
+          p++;
+          while (isdigit(*p))
+            p++;
+        }
+        if (*p == 'e' || *p == 'E')
+          return false;
+
+        if (negative)
+          value = -value;
+        return true;
+      }
+
+      // skips any value, including nested arrays and objects
+      bool skipValue()
+      {
+        char dummy[1];
+        skipBlanks();
+
+        if (*p == '"')
+          return readString(dummy, sizeof(dummy));
+
+        if (*p == '[' || *p == '{')
+        {
+          int depth = 0;
+          while (*p != 0)
+          {
+            if (*p == '"')
+            {
+              if (!readString(dummy, sizeof(dummy)))
+                return false;
+              continue;
+            }
+            if (*p == '[' || *p == '{')
+              depth++;
+            else if (*p == ']' || *p == '}')
+            {
+              if (--depth == 0)
+              {
+                p++;
+                return true;
+              }
+            }
+            p++;
+          }
+          return false;
+        }
+
+        // number, true, false or null
+        const char *valueStart = p;
+        while (isalnum(*p) || *p == '-' || *p == '+' || *p == '.')
+          p++;
+        return p != valueStart;
+      }
+    };
+
+    /**
+     * Reads the pulses array straight into signal.Pulses, converting to sample_rate units
+     */
+    bool readJsonPulses(JsonSignalReader &reader, RawSignalStruct &signal)
+    {
+      if (!reader.consume('['))
+        return false;
+      if (reader.consume(']'))
+        return true;
+
+      int pulsesCount = 0;
+      do
+      {
+        long value;
+        if (!reader.readNumber(value))
+          return false;
+
+        if (value < 0 || value / params::sample_rate > 0xFFFF)
+        {
+          Serial.printf_P(PSTR("error, pulse #%i (%li) is out of range\r\n"), pulsesCount + 1, value);
+          return false;
+        }
+
+        pulsesCount++;
+        // keep counting past the buffer so the error tells how big the signal really is
+        if (pulsesCount <= RAW_BUFFER_SIZE)
+          signal.Pulses[pulsesCount] = value / params::sample_rate;
+      } while (reader.consume(','));
 
-      if (deserializeJson(json, json_str) != DeserializationError::Ok)
+      if (!reader.consume(']'))
+        return false;
+
+      if (pulsesCount > RAW_BUFFER_SIZE)
       {
-        Serial.println(F("An error occured while reading json"));
+        Serial.printf_P(PSTR("error, your Signal has %i pulses while this supports only %i\r\n"), pulsesCount, RAW_BUFFER_SIZE);
+        signal.Number = 0;
         return false;
       }
 
+      signal.Number = pulsesCount;
+      return true;
+    }
+
+    bool readJsonByte(JsonSignalReader &reader, byte &destination, const char *name)
+    {
+      long value;
+      if (!reader.readNumber(value))
+        return false;
+      if (value < 0 || value > 0xFF)
+      {
+        Serial.printf_P(PSTR("error, '%s' must be between 0 and 255\r\n"), name);
+        return false;
+      }
+      destination = value;
+      return true;
+    }
+
+    bool getSignalFromJson(RawSignalStruct &signal, const char *json_str)
+    {
+      JsonSignalReader reader(json_str);
+      char key[16];
+      bool success = true;
+
       signal.Number = 0;
+      signal.Repeats = 0;
       signal.Delay = 0;
       signal.Multiply = params::sample_rate;
       signal.Time = 0UL;
 
-      auto &&root = json.as<JsonObject>();
-      JsonArrayConst pulsesJson = root.getMember("pulses");
+      if (!reader.consume('{'))
+        success = false;
+      else if (!reader.consume('}'))
+      {
+        do
+        {
+          if (!reader.readString(key, sizeof(key)) || !reader.consume(':'))
+            success = false;
+          else if (strcmp_P(key, PSTR("pulses")) == 0)
+            success = readJsonPulses(reader, signal);
+          else if (strcmp_P(key, PSTR("repeat")) == 0)
+            success = readJsonByte(reader, signal.Repeats, key);
+          else if (strcmp_P(key, PSTR("delay")) == 0)
+            success = readJsonByte(reader, signal.Delay, key);
+          else
+            success = reader.skipValue();
+        } while (success && reader.consume(','));
 
+        if (success && !reader.consume('}'))
+          success = false;
+      }
 
-      signal.Number = pulsesJson.size();
+      if (!success)
+      {
+        Serial.printf_P(PSTR("An error occured while reading json at position %i\r\n"), reader.position());
+        return false;
+      }
 
-      if(signal.Number < 2) {
+      if (signal.Number < 2)
+      {
         Serial.println(F("error, your signal has 0 pulse defined!"));
         return false;
       }
 
-      if(signal.Number > RAW_BUFFER_SIZE) {
-        Serial.printf_P(PSTR("error, your Signal has %i pulses while this supports only %i\r\n"), signal.Number, RAW_BUFFER_SIZE);
+      return true;
+    }
+
+    /*********************************************************************************************\
+     Compact signal format: base64 of
+       [0] version (1), bit 7 set when symbols are PackBits compressed
+       [1] repeat, [2] delay
+       [3] number of pulse classes (1..16), followed by each class duration in us (uint16 LE)
+       then pulses count (uint16 LE) and the class index of every pulse, packed on 1, 2 or 4 bits depending on
+       the number of classes, first pulse in the most significant bits
+    \*********************************************************************************************/
+    namespace compact
+    {
+      const uint8_t version = 1;
+      const uint8_t flagRle = 0x80;
+      const uint8_t maxClasses = 16;
+      const char base64Chars[] PROGMEM = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+      struct Classes
+      {
+        uint8_t count;
+        uint16_t duration_us[maxClasses];
+      };
+
+      inline uint32_t pulseDuration(const RawSignalStruct &signal, int index)
+      {
+        uint32_t duration = (uint32_t)signal.Pulses[index] * signal.Multiply;
+        return duration > 0xFFFF ? 0xFFFF : duration;
+      }
+
+      uint8_t nearestClass(const Classes &classes, uint32_t duration)
+      {
+        uint8_t best = 0;
+        uint32_t bestDistance = UINT32_MAX;
+        for (uint8_t i = 0; i < classes.count; i++)
+        {
+          uint32_t distance = duration > classes.duration_us[i] ? duration - classes.duration_us[i] : classes.duration_us[i] - duration;
+          if (distance < bestDistance)
+          {
+            bestDistance = distance;
+            best = i;
+          }
+        }
+        return best;
+      }
+
+      inline bool withinTolerance(uint32_t duration, uint32_t reference)
+      {
+        uint32_t distance = duration > reference ? duration - reference : reference - duration;
+        return distance * 8 <= reference;
+      }
+
+      // pulses within 12.5% of a class average join it, false when a pulse ends up further than that from its class
+      // (more than 16 classes needed, or a class average drifted away), the signal has no compact form then
+      bool buildClasses(const RawSignalStruct &signal, Classes &classes)
+      {
+        uint32_t sums[maxClasses];
+        uint16_t counts[maxClasses];
+        classes.count = 0;
+
+        for (int i = 1; i <= signal.Number; i++)
+        {
+          uint32_t duration = pulseDuration(signal, i);
+          uint8_t index = nearestClass(classes, duration);
+
+          if (classes.count == 0 || !withinTolerance(duration, classes.duration_us[index]))
+          {
+            if (classes.count == maxClasses)
+              return false;
+            index = classes.count++;
+            sums[index] = 0;
+            counts[index] = 0;
+          }
+
+          sums[index] += duration;
+          counts[index]++;
+          classes.duration_us[index] = (sums[index] + counts[index] / 2) / counts[index];
+        }
+
+        for (int i = 1; i <= signal.Number; i++)
+        {
+          uint32_t duration = pulseDuration(signal, i);
+          if (!withinTolerance(duration, classes.duration_us[nearestClass(classes, duration)]))
+            return false;
+        }
+        return true;
+      }
+
+      inline uint8_t symbolBits(uint8_t classesCount)
+      {
+        return classesCount <= 2 ? 1 : (classesCount <= 4 ? 2 : 4);
+      }
+
+      inline int symbolBytesCount(int pulsesCount, uint8_t classesCount)
+      {
+        int perByte = 8 / symbolBits(classesCount);
+        return (pulsesCount + perByte - 1) / perByte;
+      }
+
+      uint8_t symbolByte(const RawSignalStruct &signal, const Classes &classes, int byteIndex)
+      {
+        uint8_t bits = symbolBits(classes.count);
+        uint8_t perByte = 8 / bits;
+        int first = byteIndex * perByte + 1;
+        uint8_t value = 0;
+        for (uint8_t i = 0; i < perByte; i++)
+        {
+          value <<= bits;
+          if (first + i <= signal.Number)
+            value |= nearestClass(classes, pulseDuration(signal, first + i));
+        }
+        return value;
+      }
+
+      /**
+       * Encodes 3 bytes in 4 chars and prints them by small chunks, so no buffer is needed for the whole signal
+       */
+      class Base64Writer
+      {
+        char out[65];
+        uint8_t outLength = 0;
+        uint32_t bits = 0;
+        uint8_t bytesCount = 0;
+
+        void put(char c)
+        {
+          out[outLength++] = c;
+          if (outLength >= sizeof(out) - 1)
+            flush();
+        }
+
+        void emit(uint32_t sextet)
+        {
+          put(pgm_read_byte(&base64Chars[sextet & 0x3F]));
+        }
+
+        void flush()
+        {
+          out[outLength] = 0;
+          RFLink::sendRawPrint(out);
+          outLength = 0;
+        }
+
+      public:
+        void write(uint8_t value)
+        {
+          bits = (bits << 8) | value;
+          if (++bytesCount == 3)
+          {
+            emit(bits >> 18);
+            emit(bits >> 12);
+            emit(bits >> 6);
+            emit(bits);
+            bits = 0;
+            bytesCount = 0;
+          }
+        }
+
+        void finish()
+        {
+          if (bytesCount == 1)
+          {
+            emit(bits >> 2);
+            emit(bits << 4);
+            put('=');
+            put('=');
+          }
+          else if (bytesCount == 2)
+          {
+            emit(bits >> 10);
+            emit(bits >> 4);
+            emit(bits << 2);
+            put('=');
+          }
+          bits = 0;
+          bytesCount = 0;
+          flush();
+        }
+      };
+
+      class Base64Reader
+      {
+        const char *p;
+        uint32_t bits = 0;
+        uint8_t bitsCount = 0;
+
+        static int8_t sextet(char c)
+        {
+          if (c >= 'A' && c <= 'Z')
+            return c - 'A';
+          if (c >= 'a' && c <= 'z')
+            return c - 'a' + 26;
+          if (c >= '0' && c <= '9')
+            return c - '0' + 52;
+          if (c == '+' || c == '-')
+            return 62;
+          if (c == '/' || c == '_')
+            return 63;
+          return -1;
+        }
+
+      public:
+        explicit Base64Reader(const char *str) : p(str) {}
+
+        bool read(uint8_t &value)
+        {
+          while (bitsCount < 8)
+          {
+            int8_t v = sextet(*p);
+            if (v < 0)
+              return false;
+            p++;
+            bits = (bits << 6) | v;
+            bitsCount += 6;
+          }
+          bitsCount -= 8;
+          value = bits >> bitsCount;
+          bits &= (1UL << bitsCount) - 1;
+          return true;
+        }
+
+        bool read16(uint16_t &value)
+        {
+          uint8_t low, high;
+          if (!read(low) || !read(high))
+            return false;
+          value = low | (high << 8);
+          return true;
+        }
+
+        // only padding, command terminator or blanks may follow
+        bool atEnd() const
+        {
+          for (const char *c = p; *c != 0; c++)
+            if (*c != '=' && *c != ';' && *c != ' ' && *c != '\r' && *c != '\n')
+              return false;
+          return true;
+        }
+      };
+
+      /**
+       * PackBits: n in 0..127 is followed by n+1 literal bytes, n in 129..255 repeats the next byte 257-n times
+       * @param writer nullptr to only compute the encoded size
+       */
+      unsigned int writeRle(const RawSignalStruct &signal, const Classes &classes, int bytesCount, Base64Writer *writer)
+      {
+        unsigned int size = 0;
+        int k = 0;
+        while (k < bytesCount)
+        {
+          uint8_t value = symbolByte(signal, classes, k);
+          int run = 1;
+          while (k + run < bytesCount && run < 128 && symbolByte(signal, classes, k + run) == value)
+            run++;
+
+          if (run >= 3)
+          {
+            if (writer != nullptr)
+            {
+              writer->write(257 - run);
+              writer->write(value);
+            }
+            size += 2;
+            k += run;
+            continue;
+          }
+
+          // literals up to the next run of 3
+          int start = k;
+          int length = 0;
+          while (k < bytesCount && length < 128)
+          {
+            if (k + 2 < bytesCount)
+            {
+              uint8_t b = symbolByte(signal, classes, k);
+              if (b == symbolByte(signal, classes, k + 1) && b == symbolByte(signal, classes, k + 2))
+                break;
+            }
+            k++;
+            length++;
+          }
+          if (writer != nullptr)
+          {
+            writer->write(length - 1);
+            for (int i = start; i < start + length; i++)
+              writer->write(symbolByte(signal, classes, i));
+          }
+          size += 1 + length;
+        }
+        return size;
+      }
+
+      class RleReader
+      {
+        Base64Reader &source;
+        bool enabled;
+        uint8_t literals = 0;
+        uint8_t repeats = 0;
+        uint8_t repeated = 0;
+
+      public:
+        RleReader(Base64Reader &reader, bool rle) : source(reader), enabled(rle) {}
+
+        bool read(uint8_t &value)
+        {
+          if (!enabled)
+            return source.read(value);
+
+          if (literals == 0 && repeats == 0)
+          {
+            uint8_t control;
+            if (!source.read(control) || control == 128)
+              return false;
+            if (control < 128)
+              literals = control + 1;
+            else
+            {
+              repeats = 257 - control;
+              if (!source.read(repeated))
+                return false;
+            }
+          }
+
+          if (literals > 0)
+          {
+            literals--;
+            return source.read(value);
+          }
+          repeats--;
+          value = repeated;
+          return true;
+        }
+      };
+    } // end of compact namespace
+
+    bool printCompactSignal(const RawSignalStruct &signal)
+    {
+      compact::Classes classes;
+      if (!compact::buildClasses(signal, classes))
+        return false;
+
+      RFLink::sendRawPrint(F(";Compact="));
+
+      int bytesCount = compact::symbolBytesCount(signal.Number, classes.count);
+      bool rle = compact::writeRle(signal, classes, bytesCount, nullptr) < (unsigned int)bytesCount;
+
+      compact::Base64Writer writer;
+      writer.write(compact::version | (rle ? compact::flagRle : 0));
+      writer.write(signal.Repeats);
+      writer.write(signal.Delay);
+      writer.write(classes.count);
+      for (uint8_t i = 0; i < classes.count; i++)
+      {
+        writer.write(classes.duration_us[i] & 0xFF);
+        writer.write(classes.duration_us[i] >> 8);
+      }
+      writer.write(signal.Number & 0xFF);
+      writer.write(signal.Number >> 8);
+
+      if (rle)
+        compact::writeRle(signal, classes, bytesCount, &writer);
+      else
+        for (int k = 0; k < bytesCount; k++)
+          writer.write(compact::symbolByte(signal, classes, k));
+
+      writer.finish();
+      return true;
+    }
+
+    bool getSignalFromCompact(RawSignalStruct &signal, const char *str)
+    {
+      compact::Base64Reader reader(str);
+      uint8_t header, classesCount;
+      uint16_t classes[compact::maxClasses];
+      uint16_t pulsesCount;
+
+      signal.Number = 0;
+      signal.Multiply = params::sample_rate;
+      signal.Time = 0UL;
+
+      if (!reader.read(header) || (header & ~compact::flagRle) != compact::version)
+      {
+        Serial.println(F("error, compact signal has an unsupported version"));
+        return false;
+      }
+
+      if (!reader.read(signal.Repeats) || !reader.read(signal.Delay) || !reader.read(classesCount) ||
+          classesCount == 0 || classesCount > compact::maxClasses)
+      {
+        Serial.println(F("error, compact signal has an invalid header"));
+        return false;
+      }
+
+      for (uint8_t i = 0; i < classesCount; i++)
+      {
+        if (!reader.read16(classes[i]))
+        {
+          Serial.println(F("error, compact signal is truncated"));
+          return false;
+        }
+      }
+
+      if (!reader.read16(pulsesCount))
+      {
+        Serial.println(F("error, compact signal is truncated"));
+        return false;
+      }
+
+      if (pulsesCount < 2)
+      {
+        Serial.println(F("error, your signal has 0 pulse defined!"));
+        return false;
+      }
+
+      if (pulsesCount > RAW_BUFFER_SIZE)
+      {
+        Serial.printf_P(PSTR("error, your Signal has %i pulses while this supports only %i\r\n"), pulsesCount, RAW_BUFFER_SIZE);
         return false;
       }
 
-      int index = 0;
-      for (JsonVariantConst pulse : pulsesJson)
+      compact::RleReader symbols(reader, header & compact::flagRle);
+      uint8_t bits = compact::symbolBits(classesCount);
+      uint8_t mask = (1 << bits) - 1;
+      uint8_t value = 0;
+      uint8_t bitsLeft = 0;
+      for (int i = 1; i <= pulsesCount; i++)
       {
-        index++;
-        signal.Pulses[index] = pulse.as<signed long int>() / params::sample_rate;
-        //Serial.printf("Pulse=%i\r\n",signal.Pulses[index]);
+        if (bitsLeft == 0)
+        {
+          if (!symbols.read(value))
+          {
+            Serial.printf_P(PSTR("error, compact signal is truncated at pulse #%i\r\n"), i);
+            return false;
+          }
+          bitsLeft = 8;
+        }
+        bitsLeft -= bits;
+        uint8_t symbol = (value >> bitsLeft) & mask;
+        if (symbol >= classesCount)
+        {
+          Serial.printf_P(PSTR("error, compact signal is corrupted at pulse #%i\r\n"), i);
+          return false;
+        }
+        signal.Pulses[i] = classes[symbol] / params::sample_rate;
       }
 
-      signal.Repeats = root.getMember("repeat").as<signed int>();
-      signal.Delay = root.getMember("delay").as<signed int>();
+      if (!reader.atEnd())
+      {
+        Serial.println(F("error, unexpected data after compact signal"));
+        return false;
+      }
 
+      signal.Number = pulsesCount;
       return true;
+    }
 
+    bool getSignalFromString(RawSignalStruct &signal, const char *str)
+    {
+      while (*str == ' ')
+        str++;
+      if (*str == '{')
+        return getSignalFromJson(signal, str);
+      return getSignalFromCompact(signal, str);
     }
 
     void executeCliCommand(char *cmd)
@@ -1022,7 +1674,7 @@ namespace RFLink
 
       if (strncasecmp_P(cmd, commands::sendRF, commandSize) == 0)
       {
-        if(!getSignalFromJson(signal, commaIndex + 1)) {
+        if(!getSignalFromString(signal, commaIndex + 1)) {
           RFLink::sendRawPrint(FPSTR(error_command_aborted), true);
           return;
         }
@@ -1035,7 +1687,7 @@ namespace RFLink
       {
         RawSignal.readyForDecoder = true;
 
-        if(!getSignalFromJson(RawSignal, commaIndex+1)) {
+        if(!getSignalFromString(RawSignal, commaIndex+1)) {
           Serial.println(FPSTR(error_command_aborted));
           RawSignal.readyForDecoder = false;
           return;
@@ -1053,7 +1705,7 @@ namespace RFLink
       }
       else if (strncasecmp_P(cmd, commands::testRFMoveForward, commandSize) == 0)
       {
-        if(!getSignalFromJson(RawSignal, commaIndex+1)) {
+        if(!getSignalFromString(RawSignal, commaIndex+1)) {
           Serial.println(FPSTR(error_command_aborted));
           RawSignal.readyForDecoder = false;
           return;
@@ -1089,6 +1741,14 @@ namespace RFLink
         sendRawPrint(PSTR("30;verboseSignalFetchLoop"));
         sendRawPrint(PSTR(" disabled;"),true);
       }
+      else if (strncasecmp_P(cmd, commands::enableCompactDebug, commandSize) == 0) {
+        runtime::compactDebug = true;
+        sendRawPrint(PSTR("30;compactDebug enabled;"), true);
+      }
+      else if (strncasecmp_P(cmd, commands::disableCompactDebug, commandSize) == 0) {
+        runtime::compactDebug = false;
+        sendRawPrint(PSTR("30;compactDebug disabled;"), true);
+      }
       else
       {
         Serial.printf_P(PSTR("Error : unknown command '%s'\r\n"), cmd);
@@ -1105,30 +1765,22 @@ namespace RFLink
     }
 
     void displaySignal(RawSignalStruct &signal) {
+      uint8_t previousClass = Messages::beginPulsesDump();
       RFLink::sendRawPrint(F("20;XX;DEBUG;Pulses=")); // debug data
       RFLink::sendRawPrint(signal.Number);         // print number of pulses
-      RFLink::sendRawPrint(F(";Pulses(uSec)="));      // print pulse durations
-      // ----------------------------------
       char dbuffer[10];
 
-      for (int i = 1; i < signal.Number + 1; i++)
+      if (!runtime::compactDebug || !printCompactSignal(signal))
       {
-        if (QRFDebug == true)
-        {
-          sprintf(dbuffer, "%02x", signal.Pulses[i]);
-          RFLink::sendRawPrint(dbuffer);
-        }
-        else
-        {
-          RFLink::sendRawPrint(signal.Pulses[i] * signal.Multiply);
-          if (i < signal.Number)
-            RFLink::sendRawPrint(',');
-        }
+        RFLink::sendRawPrint(F(";Pulses(uSec)="));      // print pulse durations
+        // ----------------------------------
+        RFLink::sendRawPrint(&signal.Pulses[1], signal.Number, signal.Multiply, QRFDebug);
       }
       RFLink::sendRawPrint(F(";RSSI="));
       sprintf_P(dbuffer, PSTR("%i;"), (int)signal.rssi);
       RFLink::sendRawPrint(dbuffer);
       RFLink::sendRawPrint(F("\r\n"));
+      Messages::setClass(previousClass);
     }
 
     const char * const EndReasonsStrings[] PROGMEM = {
@@ -91,6 +91,7 @@ namespace RFLink {
 
     namespace runtime {
       extern bool verboseSignalFetchLoop;
+      extern bool compactDebug; // debug output prints signals in compact format instead of pulses list
       extern Slicer_enum appliedSlicer;
     }
 
@@ -115,6 +116,17 @@ namespace RFLink {
 
     void displaySignal(RawSignalStruct &signal);
 
+    /**
+     * Prints ";Compact=" and the signal in compact format (pulse classes + packed symbols, base64) as accepted by
+     * sendRF/testRF. Prints nothing and returns false when some pulse is not within 12.5% of one of 16 classes.
+     */
+    bool printCompactSignal(const RawSignalStruct &signal);
+    bool getSignalFromCompact(RawSignalStruct &signal, const char *str);
+    /**
+     * Reads a signal given either as json ({"pulses":[...]}) or in compact format
+     */
+    bool getSignalFromString(RawSignalStruct &signal, const char *str);
+
     const char * endReasonToString(EndReasons reason);
 
     inline void setVerboseSignalFetchLoop(bool value=true) {
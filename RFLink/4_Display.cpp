@@ -9,6 +9,11 @@
 #include "RFLink.h"
 #include "3_Serial.h"
 #include "4_Display.h"
+#include "2_Signal.h"
+#include "15_Messages.h"
+#include "16_Binary.h"
+
+namespace Binary = RFLink::Binary;
 
 byte PKSequenceNumber = 0;       // 1 byte packet counter
 char dbuffer[60];                // Buffer for message chunk data
@@ -18,344 +23,452 @@ char pbuffer[PRINT_BUFFER_SIZE]; // Buffer for complete message data
 // Display shared func //
 // ------------------- //
 
-#if (defined(__AVR_ATmega328P__) || defined(__AVR_ATmega2560__))
-#error "For AVR plaforms, in all sprintf_P above, please replace %s with %S"
-#endif
+// Messages are built in pbuffer through an append cursor: each field is written in place right after the
+// previous one, without going through dbuffer, sprintf_P nor strcat (which rescans pbuffer each time).
+// Senders empty the buffer with pbuffer[0] = 0 once the message is out, the cursor follows such resets.
+static size_t pbufferLength = 0;
+
+static inline char *display_Cursor(void)
+{
+  if (pbuffer[0] == 0)
+    pbufferLength = 0;
+  else if (pbufferLength >= PRINT_BUFFER_SIZE || pbuffer[pbufferLength] != 0 || pbuffer[pbufferLength - 1] == 0)
+    pbufferLength = strnlen(pbuffer, PRINT_BUFFER_SIZE - 1); // pbuffer was written or truncated by someone else
+  return &pbuffer[pbufferLength];
+}
+
+static inline size_t display_Room(void)
+{
+  return PRINT_BUFFER_SIZE - 1 - pbufferLength;
+}
+
+void display_Append(const char *input)
+{
+  char *cursor = display_Cursor();
+  size_t room = display_Room();
+  size_t length = 0;
+
+  while (length < room && input[length] != 0)
+  {
+    cursor[length] = input[length];
+    length++;
+  }
+  cursor[length] = 0;
+  pbufferLength += length;
+}
+
+void display_Append_P(PGM_P input)
+{
+  char *cursor = display_Cursor();
+  size_t room = display_Room();
+  size_t length = 0;
+  char c;
+
+  while (length < room && (c = pgm_read_byte(input + length)) != 0)
+    cursor[length++] = c;
+  cursor[length] = 0;
+  pbufferLength += length;
+}
+
+static void display_AppendDigits(unsigned long input, byte minDigits, byte base, boolean upperCase)
+{
+  static const char lowerDigits[] PROGMEM = "0123456789abcdef";
+  static const char upperDigits[] PROGMEM = "0123456789ABCDEF";
+  PGM_P digits = upperCase ? upperDigits : lowerDigits;
+  char reversed[11]; // enough for 32 bits in decimal
+  byte count = 0;
+
+  // same output as %0<minDigits>lx / %0<minDigits>lu: zero padded, never truncated
+  do
+  {
+    reversed[count++] = pgm_read_byte(digits + (input % base));
+    input /= base;
+  } while (input != 0 && count < sizeof(reversed));
+  while (count < minDigits && count < sizeof(reversed))
+    reversed[count++] = '0';
+
+  char *cursor = display_Cursor();
+  if (count > display_Room())
+    count = display_Room();
+  for (byte i = 0; i < count; i++)
+    cursor[i] = reversed[count - 1 - i];
+  cursor[count] = 0;
+  pbufferLength += count;
+}
+
+void display_AppendHex(unsigned long input, byte minDigits, boolean upperCase)
+{
+  display_AppendDigits(input, minDigits, 16, upperCase);
+}
+
+void display_AppendDec(unsigned long input, byte minDigits)
+{
+  display_AppendDigits(input, minDigits, 10, false);
+}
 
 // Common Header
 void display_Header(void)
 {
-  sprintf_P(dbuffer, PSTR("%s%02X"), PSTR("20;"), PKSequenceNumber++);
-  strcat(pbuffer, dbuffer);
+  Binary::beginEvent(PKSequenceNumber);
+  display_Append_P(PSTR("20;"));
+  display_AppendHex(PKSequenceNumber++, 2, true);
 }
 
 // Plugin Name
 void display_Name(const char *input)
 {
-  sprintf_P(dbuffer, PSTR(";%s"), input);
-  strcat(pbuffer, dbuffer);
+  display_Append_P(PSTR(";"));
+  display_Append_P(input); // names are flash strings most of the time, pgm_read_byte() works on RAM ones as well
+  Binary::addName(input);
 }
 
-// Common Footer
+// Common Footer, the message is complete and goes to the outbound queue
 void display_Footer(void)
 {
-  sprintf_P(dbuffer, PSTR("%s"), PSTR(";\r\n"));
-  strcat(pbuffer, dbuffer);
+  display_Append_P(PSTR(";\r\n"));
+  uint8_t messageClass = RFLink::Messages::runtime::currentClass;
+  Binary::endEvent(messageClass,
+                   messageClass == RFLink::Messages::Class_Decode ? RFLink::Signal::RawSignal.rssi : -9999.0F,
+                   RFLink::Messages::runtime::currentPlugin);
+  RFLink::Messages::commitBuffer();
 }
 
 // Start message
 void display_Splash(void)
 {
-  sprintf_P(dbuffer, PSTR("%s%d.%d;BUILD=%s"), PSTR(";RFLink_ESP;VER="), BUILDNR, REVNR, PSTR(RFLINK_BUILDNAME));
-  strcat(pbuffer, dbuffer);
+  display_Append_P(PSTR(";RFLink_ESP;VER="));
+  display_AppendDec(BUILDNR, 1);
+  display_Append_P(PSTR("."));
+  display_AppendDec(REVNR, 1);
+  display_Append_P(PSTR(";BUILD="));
+  display_Append_P(PSTR(RFLINK_BUILDNAME));
 }
 
 // ID=9999 => device ID (often a rolling code and/or device channel number) (Hexadecimal)
 void display_IDn(unsigned long input, byte n)
 {
+  display_Append_P(PSTR(";ID="));
   switch (n)
   {
   case 2:
-    sprintf_P(dbuffer, PSTR("%s%02lx"), PSTR(";ID="), input);
-    break;
   case 4:
-    sprintf_P(dbuffer, PSTR("%s%04lx"), PSTR(";ID="), input);
-    break;
   case 6:
-    sprintf_P(dbuffer, PSTR("%s%06lx"), PSTR(";ID="), input);
+    display_AppendHex(input, n);
     break;
   case 8:
   default:
-    sprintf_P(dbuffer, PSTR("%s%08lx"), PSTR(";ID="), input);
+    display_AppendHex(input, 8);
   }
-  strcat(pbuffer, dbuffer);
+  Binary::addNumber(Binary::Tag_ID, input, (n == 2 || n == 4 || n == 6) ? n / 2 : 4);
 }
 
 void display_IDc(const char *input)
 {
-  sprintf_P(dbuffer, PSTR("%s"), PSTR(";ID="));
-  strcat(pbuffer, dbuffer);
-  strcat(pbuffer, input);
+  display_Append_P(PSTR(";ID="));
+  display_Append(input);
+  Binary::addText(Binary::Tag_IDText, input, false);
 }
 
 // SWITCH=A16 => House/Unit code like A1, P2, B16 or a button number etc.
 void display_SWITCH(byte input)
 {
-  sprintf_P(dbuffer, PSTR("%s%02x"), PSTR(";SWITCH="), input);
-  strcat(pbuffer, dbuffer);
+  display_Append_P(PSTR(";SWITCH="));
+  display_AppendHex(input, 2);
+  Binary::addNumber(Binary::Tag_Switch, input);
 }
 
 // SWITCH=A16 => House/Unit code like A1, P2, B16 or a button number etc.
 void display_SWITCHc(const char *input)
 {
-  sprintf_P(dbuffer, PSTR("%s"), PSTR(";SWITCH="));
-  strcat(pbuffer, dbuffer);
-  strcat(pbuffer, input);
+  display_Append_P(PSTR(";SWITCH="));
+  display_Append(input);
+  Binary::addText(Binary::Tag_SwitchText, input, false);
 }
 
-// CMD=ON => Command (ON/OFF/ALLON/ALLOFF) Additional for Milight: DISCO+/DISCO-/MODE0 - MODE8
-void display_CMD(boolean all, byte on)
+// Name of a CMD_OnOff value, without the ALL prefix
+PGM_P display_CMDName(byte on)
 {
-  sprintf_P(dbuffer, PSTR("%s"), PSTR(";CMD="));
-  strcat(pbuffer, dbuffer);
-
-  if (all == CMD_All)
-  {
-    sprintf_P(dbuffer, PSTR("%s"), PSTR("ALL"));
-    strcat(pbuffer, dbuffer);
-  }
-
   switch (on)
   {
   case CMD_On:
-    sprintf_P(dbuffer, PSTR("%s"), PSTR("ON"));
-    break;
+    return PSTR("ON");
   case CMD_Off:
-    sprintf_P(dbuffer, PSTR("%s"), PSTR("OFF"));
-    break;
+    return PSTR("OFF");
   case CMD_Bright:
-    sprintf_P(dbuffer, PSTR("%s"), PSTR("BRIGHT"));
-    break;
+    return PSTR("BRIGHT");
   case CMD_Dim:
-    sprintf_P(dbuffer, PSTR("%s"), PSTR("DIM"));
-    break;
+    return PSTR("DIM");
   case CMD_Up:
-    sprintf_P(dbuffer, PSTR("%s"), PSTR("UP"));
-    break;
+    return PSTR("UP");
   case CMD_Down:
-    sprintf_P(dbuffer, PSTR("%s"), PSTR("DOWN"));
-    break;
+    return PSTR("DOWN");
   case CMD_Stop:
-    sprintf_P(dbuffer, PSTR("%s"), PSTR("STOP"));
-    break;
+    return PSTR("STOP");
   case CMD_Pair:
-    sprintf_P(dbuffer, PSTR("%s"), PSTR("PAIR"));
-    break;
+    return PSTR("PAIR");
   case CMD_Unknown:
   default:
-    sprintf_P(dbuffer, PSTR("%s"), PSTR("UNKNOWN"));
+    return PSTR("UNKNOWN");
   }
-  strcat(pbuffer, dbuffer);
+}
+
+// CMD=ON => Command (ON/OFF/ALLON/ALLOFF) Additional for Milight: DISCO+/DISCO-/MODE0 - MODE8
+void display_CMD(boolean all, byte on)
+{
+  display_Append_P(PSTR(";CMD="));
+
+  if (all == CMD_All)
+    display_Append_P(PSTR("ALL"));
+
+  display_Append_P(display_CMDName(on));
+  Binary::addNumber(Binary::Tag_Cmd, (all == CMD_All ? 0x80 : 0) | on);
 }
 
 // SET_LEVEL=15 => Direct dimming level setting value (decimal value: 0-15)
 void display_SET_LEVEL(byte input)
 {
-  sprintf_P(dbuffer, PSTR("%s%02d"), PSTR(";SET_LEVEL="), input);
-  strcat(pbuffer, dbuffer);
+  display_Append_P(PSTR(";SET_LEVEL="));
+  display_AppendDec(input, 2);
+  Binary::addNumber(Binary::Tag_SetLevel, input);
 }
 
 // TEMP=9999 => Temperature celcius (hexadecimal), high bit contains negative sign, needs division by 10
 void display_TEMP(unsigned int input)
 {
-  sprintf_P(dbuffer, PSTR("%s%04x"), PSTR(";TEMP="), input);
-  strcat(pbuffer, dbuffer);
+  display_Append_P(PSTR(";TEMP="));
+  display_AppendHex(input, 4);
+  Binary::addNumber(Binary::Tag_Temp, input);
 }
 
 // HUM=99 => Humidity (decimal value: 0-100 to indicate relative humidity in %)
 void display_HUM(byte input)
 {
-  sprintf_P(dbuffer, PSTR("%s%02d"), PSTR(";HUM="), input);
-  strcat(pbuffer, dbuffer);
+  display_Append_P(PSTR(";HUM="));
+  display_AppendDec(input, 2);
+  Binary::addNumber(Binary::Tag_Hum, input);
 }
 
 // BARO=9999 => Barometric pressure (hexadecimal)
 void display_BARO(unsigned int input)
 {
-  sprintf_P(dbuffer, PSTR("%s%04x"), PSTR(";BARO="), input);
-  strcat(pbuffer, dbuffer);
+  display_Append_P(PSTR(";BARO="));
+  display_AppendHex(input, 4);
+  Binary::addNumber(Binary::Tag_Baro, input);
 }
 
 // HSTATUS=99 => 0=Normal, 1=Comfortable, 2=Dry, 3=Wet
 void display_HSTATUS(byte input)
 {
-  sprintf_P(dbuffer, PSTR("%s%02x"), PSTR(";HSTATUS="), input);
-  strcat(pbuffer, dbuffer);
+  display_Append_P(PSTR(";HSTATUS="));
+  display_AppendHex(input, 2);
+  Binary::addNumber(Binary::Tag_HStatus, input);
 }
 
 // BFORECAST=99 => 0=No Info/Unknown, 1=Sunny, 2=Partly Cloudy, 3=Cloudy, 4=Rain
 void display_BFORECAST(byte input)
 {
-  sprintf_P(dbuffer, PSTR("%s%02x"), PSTR(";BFORECAST="), input);
-  strcat(pbuffer, dbuffer);
+  display_Append_P(PSTR(";BFORECAST="));
+  display_AppendHex(input, 2);
+  Binary::addNumber(Binary::Tag_BForecast, input);
 }
 
 // UV=9999 => UV intensity (hexadecimal)
 void display_UV(unsigned int input)
 {
-  sprintf_P(dbuffer, PSTR("%s%04x"), PSTR(";UV="), input);
-  strcat(pbuffer, dbuffer);
+  display_Append_P(PSTR(";UV="));
+  display_AppendHex(input, 4);
+  Binary::addNumber(Binary::Tag_UV, input);
 }
 
 // LUX=9999 => Light intensity (hexadecimal)
 void display_LUX(unsigned int input)
 {
-  sprintf_P(dbuffer, PSTR("%s%04x"), PSTR(";LUX="), input);
-  strcat(pbuffer, dbuffer);
+  display_Append_P(PSTR(";LUX="));
+  display_AppendHex(input, 4);
+  Binary::addNumber(Binary::Tag_Lux, input);
 }
 
 // BAT=OK => Battery status indicator (OK/LOW)
 void display_BAT(boolean input)
 {
   if (input == true)
-    sprintf_P(dbuffer, PSTR("%s"), PSTR(";BAT=OK"));
+    display_Append_P(PSTR(";BAT=OK"));
   else
-    sprintf_P(dbuffer, PSTR("%s"), PSTR(";BAT=LOW"));
-  strcat(pbuffer, dbuffer);
+    display_Append_P(PSTR(";BAT=LOW"));
+  Binary::addNumber(Binary::Tag_Bat, input == true ? 1 : 0);
 }
 
 // RAIN=1234 => Total rain in mm. (hexadecimal) 0x8d = 141 decimal = 14.1 mm (needs division by 10)
 void display_RAIN(unsigned int input)
 {
-  sprintf_P(dbuffer, PSTR("%s%04x"), PSTR(";RAIN="), input);
-  strcat(pbuffer, dbuffer);
+  display_Append_P(PSTR(";RAIN="));
+  display_AppendHex(input, 4);
+  Binary::addNumber(Binary::Tag_Rain, input);
 }
 
 // RAINRATE=1234 => Rain rate in mm. (hexadecimal) 0x8d = 141 decimal = 14.1 mm (needs division by 10)
 void display_RAINRATE(unsigned int input)
 {
-  sprintf_P(dbuffer, PSTR("%s%04x"), PSTR(";RAINRATE="), input);
-  strcat(pbuffer, dbuffer);
+  display_Append_P(PSTR(";RAINRATE="));
+  display_AppendHex(input, 4);
+  Binary::addNumber(Binary::Tag_RainRate, input);
 }
 
 // WINSP=9999 => Wind speed in km. p/h (hexadecimal) needs division by 10
 void display_WINSP(unsigned int input)
 {
-  sprintf_P(dbuffer, PSTR("%s%04x"), PSTR(";WINSP="), input);
-  strcat(pbuffer, dbuffer);
+  display_Append_P(PSTR(";WINSP="));
+  display_AppendHex(input, 4);
+  Binary::addNumber(Binary::Tag_WinSp, input);
 }
 
 // AWINSP=9999 => Average Wind speed in km. p/h (hexadecimal) needs division by 10
 void display_AWINSP(unsigned int input)
 {
-  sprintf_P(dbuffer, PSTR("%s%04x"), PSTR(";AWINSP="), input);
-  strcat(pbuffer, dbuffer);
+  display_Append_P(PSTR(";AWINSP="));
+  display_AppendHex(input, 4);
+  Binary::addNumber(Binary::Tag_AWinSp, input);
 }
 
 // WINGS=9999 => Wind Gust in km. p/h (hexadecimal)
 void display_WINGS(unsigned int input)
 {
-  sprintf_P(dbuffer, PSTR("%s%04x"), PSTR(";WINGS="), input);
-  strcat(pbuffer, dbuffer);
+  display_Append_P(PSTR(";WINGS="));
+  display_AppendHex(input, 4);
+  Binary::addNumber(Binary::Tag_WinGs, input);
 }
 
 // WINDIR=123 => Wind direction (integer value from 0-15) reflecting 0-360 degrees in 22.5 degree steps
 void display_WINDIR(unsigned int input)
 {
-  sprintf_P(dbuffer, PSTR("%s%03d"), PSTR(";WINDIR="), input);
-  strcat(pbuffer, dbuffer);
+  display_Append_P(PSTR(";WINDIR="));
+  display_AppendDec(input, 3);
+  Binary::addNumber(Binary::Tag_WinDir, input);
 }
 
 // WINCHL => wind chill (hexadecimal, see TEMP)
 void display_WINCHL(unsigned int input)
 {
-  sprintf_P(dbuffer, PSTR("%s%04x"), PSTR(";WINCHL="), input);
-  strcat(pbuffer, dbuffer);
+  display_Append_P(PSTR(";WINCHL="));
+  display_AppendHex(input, 4);
+  Binary::addNumber(Binary::Tag_WinChl, input);
 }
 
 // WINTMP=1234 => Wind meter temperature reading (hexadecimal, see TEMP)
 void display_WINTMP(unsigned int input)
 {
-  sprintf_P(dbuffer, PSTR("%s%04x"), PSTR(";WINTMP="), input);
-  strcat(pbuffer, dbuffer);
+  display_Append_P(PSTR(";WINTMP="));
+  display_AppendHex(input, 4);
+  Binary::addNumber(Binary::Tag_WinTmp, input);
 }
 
 // CHIME=123 => Chime/Doorbell melody number
 void display_CHIME(unsigned int input)
 {
-  sprintf_P(dbuffer, PSTR("%s%03d"), PSTR(";CHIME="), input);
-  strcat(pbuffer, dbuffer);
+  display_Append_P(PSTR(";CHIME="));
+  display_AppendDec(input, 3);
+  Binary::addNumber(Binary::Tag_Chime, input);
 }
 
 // SMOKEALERT=ON => ON/OFF
 void display_SMOKEALERT(boolean input)
 {
   if (input == SMOKE_On)
-    sprintf_P(dbuffer, PSTR("%s"), PSTR(";SMOKEALERT=ON"));
+    display_Append_P(PSTR(";SMOKEALERT=ON"));
   else
-    sprintf_P(dbuffer, PSTR("%s"), PSTR(";SMOKEALERT=OFF"));
-  strcat(pbuffer, dbuffer);
+    display_Append_P(PSTR(";SMOKEALERT=OFF"));
+  Binary::addNumber(Binary::Tag_SmokeAlert, input == SMOKE_On ? 1 : 0);
 }
 
 // PIR=ON => ON/OFF
 void display_PIR(boolean input)
 {
   if (input == PIR_On)
-    sprintf_P(dbuffer, PSTR("%s"), PSTR(";PIR=ON"));
+    display_Append_P(PSTR(";PIR=ON"));
   else
-    sprintf_P(dbuffer, PSTR("%s"), PSTR(";PIR=OFF"));
-  strcat(pbuffer, dbuffer);
+    display_Append_P(PSTR(";PIR=OFF"));
+  Binary::addNumber(Binary::Tag_PIR, input == PIR_On ? 1 : 0);
 }
 
 // CO2=1234 => CO2 air quality
 void display_CO2(unsigned int input)
 {
-  sprintf_P(dbuffer, PSTR("%s%04d"), PSTR(";CO2="), input);
-  strcat(pbuffer, dbuffer);
+  display_Append_P(PSTR(";CO2="));
+  display_AppendDec(input, 4);
+  Binary::addNumber(Binary::Tag_CO2, input);
 }
 
 // SOUND=1234 => Noise level
 void display_SOUND(unsigned int input)
 {
-  sprintf_P(dbuffer, PSTR("%s%04d"), PSTR(";SOUND="), input);
-  strcat(pbuffer, dbuffer);
+  display_Append_P(PSTR(";SOUND="));
+  display_AppendDec(input, 4);
+  Binary::addNumber(Binary::Tag_Sound, input);
 }
 
 // KWATT=9999 => KWatt (hexadecimal)
 void display_KWATT(unsigned int input)
 {
-  sprintf_P(dbuffer, PSTR("%s%04x"), PSTR(";KWATT="), input);
-  strcat(pbuffer, dbuffer);
+  display_Append_P(PSTR(";KWATT="));
+  display_AppendHex(input, 4);
+  Binary::addNumber(Binary::Tag_KWatt, input);
 }
 
 // WATT=9999 => Watt (hexadecimal)
 void display_WATT(unsigned int input)
 {
-  sprintf_P(dbuffer, PSTR("%s%04x"), PSTR(";WATT="), input);
-  strcat(pbuffer, dbuffer);
+  display_Append_P(PSTR(";WATT="));
+  display_AppendHex(input, 4);
+  Binary::addNumber(Binary::Tag_Watt, input);
 }
 
 // CURRENT=1234 => Current phase 1
 void display_CURRENT(unsigned int input)
 {
-  sprintf_P(dbuffer, PSTR("%s%04d"), PSTR(";CURRENT="), input);
-  strcat(pbuffer, dbuffer);
+  display_Append_P(PSTR(";CURRENT="));
+  display_AppendDec(input, 4);
+  Binary::addNumber(Binary::Tag_Current, input);
 }
 
 // DIST=1234 => Distance
 void display_DIST(unsigned int input)
 {
-  sprintf_P(dbuffer, PSTR("%s%04d"), PSTR(";DIST="), input);
-  strcat(pbuffer, dbuffer);
+  display_Append_P(PSTR(";DIST="));
+  display_AppendDec(input, 4);
+  Binary::addNumber(Binary::Tag_Dist, input);
 }
 
 // METER=1234 => Meter values (water/electricity etc.)
 void display_METER(unsigned int input)
 {
-  sprintf_P(dbuffer, PSTR("%s%04d"), PSTR(";METER="), input);
-  strcat(pbuffer, dbuffer);
+  display_Append_P(PSTR(";METER="));
+  display_AppendDec(input, 4);
+  Binary::addNumber(Binary::Tag_Meter, input);
 }
 
 // VOLT=1234 => Voltage
 void display_VOLT(unsigned int input)
 {
-  sprintf_P(dbuffer, PSTR("%s%04d"), PSTR(";VOLT="), input);
-  strcat(pbuffer, dbuffer);
+  display_Append_P(PSTR(";VOLT="));
+  display_AppendDec(input, 4);
+  Binary::addNumber(Binary::Tag_Volt, input);
 }
 
 // RGBW=9999 => Milight: provides 1 byte color and 1 byte brightness value
 void display_RGBW(unsigned int input)
 {
-  sprintf_P(dbuffer, PSTR("%s%04x"), PSTR(";RGBW="), input);
-  strcat(pbuffer, dbuffer);
+  display_Append_P(PSTR(";RGBW="));
+  display_AppendHex(input, 4);
+  Binary::addNumber(Binary::Tag_RGBW, input);
 }
 
 
 // Channel
 void display_CHAN(byte channel)
 {
-  sprintf_P(dbuffer, PSTR("%s%04x"), PSTR(";CHN="), channel);
-  strcat(pbuffer, dbuffer);
+  display_Append_P(PSTR(";CHN="));
+  display_AppendHex(channel, 4);
+  Binary::addNumber(Binary::Tag_Channel, channel);
 }
 
 // --------------------- //
@@ -15,6 +15,13 @@
 // extern byte PKSequenceNumber;     // 1 byte packet counter
 extern char pbuffer[PRINT_BUFFER_SIZE]; // Buffer for printing data
 
+// Append-only message builder writing to pbuffer at a tracked cursor, output is silently truncated
+// at PRINT_BUFFER_SIZE-1 characters. Digits are zero padded to minDigits, like %0Nlx / %0Nlu would.
+void display_Append(const char *);
+void display_Append_P(PGM_P);
+void display_AppendHex(unsigned long, byte minDigits, boolean upperCase = false);
+void display_AppendDec(unsigned long, byte minDigits);
+
 void display_Header(void);
 void display_Name(const char *);
 void display_Footer(void);
@@ -42,6 +49,7 @@ enum CMD_OnOff
     CMD_Pair
 };
 void display_CMD(boolean, byte);
+PGM_P display_CMDName(byte);
 void display_SET_LEVEL(byte);
 void display_TEMP(unsigned int);
 void display_HUM(byte);
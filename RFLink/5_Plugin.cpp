@@ -10,6 +10,8 @@
 #include "2_Signal.h"
 #include "5_Plugin.h"
 #include "7_Utils.h"
+#include "15_Messages.h"
+#include "20_Metrics.h"
 
 using namespace RFLink::Utils;
 using namespace RFLink::Signal;
@@ -2277,18 +2279,27 @@ byte PluginTXInitCall(byte Function, char *str)
  \*********************************************************************************************/
 byte PluginRXCall(byte Function, const char *str)
 {
+  uint32_t started = RFLink::Metrics::cycles();
   for (byte x = 0; x < PLUGIN_MAX; x++)
   {
     if ((Plugin_id[x] != 0) && (Plugin_State[x] >= P_Enabled))
     {
       SignalHash = x; // store plugin number
-      if (Plugin_ptr[x](Function, str))
+      RFLink::Messages::runtime::currentPlugin = Plugin_id[x];
+      uint32_t pluginStarted = RFLink::Metrics::cycles();
+      bool decoded = Plugin_ptr[x](Function, str);
+      RFLink::Metrics::pluginCalled(x, RFLink::Metrics::cycles() - pluginStarted, decoded);
+      if (decoded)
       {
         SignalHashPrevious = SignalHash; // store previous plugin number after success
+        RFLink::Messages::runtime::currentPlugin = 0;
+        RFLink::Metrics::decodeDone(RFLink::Metrics::cycles() - started);
         return true;
       }
     }
   }
+  RFLink::Messages::runtime::currentPlugin = 0;
+  RFLink::Metrics::decodeDone(RFLink::Metrics::cycles() - started);
   return false;
 }
 /*********************************************************************************************\
@@ -14,6 +14,9 @@
 #include "4_Display.h"
 #include "6_MQTT.h"
 #include "6_Credentials.h"
+#include "16_Binary.h"
+#include "14_TX.h"
+#include "17_Cache.h"
 
 
 #ifdef ESP32
@@ -26,17 +29,63 @@
 #include <WiFiClientSecure.h>
 #include <WiFiClient.h>
 WiFiClient WIFIClient;
+#ifdef ESP32
+#include <lwip/sockets.h>
+
+// gives the socket of the TLS connection, so its send space can be checked like the one of WIFIClient
+class SecureClient : public WiFiClientSecure {
+  public:
+    int socket() { return sslclient->socket; }
+};
+SecureClient WIFIClientSecure;
+#else
 WiFiClientSecure WIFIClientSecure;
+#endif
 
 
 // MQTT_KEEPALIVE : keepAlive interval in Seconds
 #define MQTT_KEEPALIVE 60
 
-// MQTT_SOCKET_TIMEOUT: socket timeout interval in Seconds
-#define MQTT_SOCKET_TIMEOUT 60
+// MQTT_SOCKET_TIMEOUT: socket timeout interval in Seconds, bounds the wait for the broker CONNACK
+#define MQTT_SOCKET_TIMEOUT 2
+
+// MQTT_CONNECT_TIMEOUT_MS: DNS lookup (ESP8266 only) and TCP (and TLS) connection timeout
+#define MQTT_CONNECT_TIMEOUT_MS 3000
+
+// delay before a new connection attempt, doubled after each failure up to MQTT_BACKOFF_MAX_MS
+#define MQTT_BACKOFF_MIN_MS 2000
+#define MQTT_BACKOFF_MAX_MS 300000
+
+// inbound packets read per checkMQTTloop() call at most, when several commands arrived together
+#define MQTT_INBOUND_BURST 4
+
+// command latency histogram: bucket 0 is below 1 ms, bucket i from 2^(i-1) to 2^i ms, the last one has the rest
+#define MQTT_LATENCY_BUCKETS 12
+
+// QoS 1 publishing: messages are kept until their PUBACK, at most inflight_window of them
+#ifdef ESP32
+#define MQTT_INFLIGHT_MAX 8
+#define MQTT_BATCH_SIZE 1460 // one TCP segment, publishes of a batch are written together up to this size
+#else
+#define MQTT_INFLIGHT_MAX 4
+#define MQTT_BATCH_SIZE 536
+#endif
+#define MQTT_RETRY_MS 5000  // PUBACK wait before the message is sent again
+#define MQTT_MAX_RETRIES 3  // retransmissions before the message is counted as lost
+
+// MQTT_BUFFER_SIZE: max size of a MQTT packet, inbound batch commands can be several hundred bytes long
+#ifndef MQTT_BUFFER_SIZE
+#define MQTT_BUFFER_SIZE 1024
+#endif
+
+// JSON output of decoded signals: topic_out/<protocol>/<id>[/<switch>] and its payload
+#define MQTT_DEVICE_TOPIC_SIZE 128
+#define MQTT_JSON_PAYLOAD_SIZE 320
+// largest PUBLISH of a queued message: fixed header, topic, packet id and payload (text ones are shorter than JSON)
+#define MQTT_PUBLISH_MAX_SIZE (5 + 2 + MQTT_DEVICE_TOPIC_SIZE + 2 + MQTT_JSON_PAYLOAD_SIZE)
+static_assert(MQTT_JSON_PAYLOAD_SIZE >= PRINT_BUFFER_SIZE, "text messages must not be larger than JSON ones");
 
 #include <PubSubClient.h>
-boolean bResub; // uplink reSubscribe after setup only
 
 // Update these with values suitable for your network.
 
@@ -52,6 +101,9 @@ namespace RFLink { namespace Mqtt {
 
     String topic_out;
     String topic_in;
+    bool json_enabled;
+    int qos;
+    int inflight_window;
 
     bool lwt_enabled;
     String topic_lwt;
@@ -71,6 +123,9 @@ const char json_name_password[] = "password";
 
 const char json_name_topic_in[] = "topic_in";
 const char json_name_topic_out[] = "topic_out";
+const char json_name_json_enabled[] = "json_enabled";
+const char json_name_qos[] = "qos";
+const char json_name_inflight_window[] = "inflight_window";
 
 const char json_name_lwt_enabled[] = "lwt_enabled";
 const char json_name_topic_lwt[] = "topic_lwt";
@@ -80,9 +135,47 @@ const char json_name_ssl_insecure[] = "ssl_insecure";
 const char json_name_ca_cert[] = "ca_cert";
 // end of json variable names
 
-struct timeval lastMqttConnectionAttemptTime;
 bool paramsHaveChanged = true; 
 
+// a QoS 1 message waiting for its PUBACK
+struct InFlight {
+  uint16_t packetId; // 0 for a free slot
+  uint8_t retries;
+  unsigned long sentAt;
+  Messages::Message message; // rendered again when it has to be retransmitted
+};
+
+namespace runtime {
+  ConnectionState state = State_Disabled;
+  unsigned long nextAttempt = 0;
+  unsigned long backoff = MQTT_BACKOFF_MIN_MS;
+  IPAddress serverIP;
+  volatile bool reconnectRequested = false; // may be set from the WiFi events task
+  bool inboundWaiting = false;   // bytes were seen on the socket and are not all processed yet
+  unsigned long inboundSince = 0; // millis() when they were first seen
+  InFlight inFlight[MQTT_INFLIGHT_MAX];
+  uint16_t lastPacketId = 0;
+}
+
+namespace counters {
+  unsigned long int attempts = 0;
+  unsigned long int failures = 0;
+  unsigned long int connections = 0;
+  unsigned long int commands = 0;
+  unsigned long int latency[MQTT_LATENCY_BUCKETS] = {0}; // from the bytes seen on the socket to the command done
+  unsigned long int latencyMax = 0;
+  unsigned long int published = 0;    // PUBLISH packets, retransmissions included
+  unsigned long int segments = 0;     // network writes, batches of publishes count once
+  unsigned long int acknowledged = 0;
+  unsigned long int retried = 0;
+  unsigned long int lost = 0;         // QoS 1 messages still not acknowledged after MQTT_MAX_RETRIES
+}
+
+namespace commands {
+  const char show[] PROGMEM = "show";
+  const char clear[] PROGMEM = "clear";
+}
+
 Config::ConfigItem configItems[] =  {
   Config::ConfigItem(json_name_enabled, Config::SectionId::MQTT_id, RFLink_default_MQTT_ENABLED, paramsUpdatedCallback),
   Config::ConfigItem(json_name_server,  Config::SectionId::MQTT_id, MQTT_SERVER, paramsUpdatedCallback),
@@ -93,6 +186,9 @@ Config::ConfigItem configItems[] =  {
 
   Config::ConfigItem(json_name_topic_in,   Config::SectionId::MQTT_id, MQTT_TOPIC_IN, paramsUpdatedCallback),
   Config::ConfigItem(json_name_topic_out,  Config::SectionId::MQTT_id, MQTT_TOPIC_OUT, paramsUpdatedCallback),
+  Config::ConfigItem(json_name_json_enabled, Config::SectionId::MQTT_id, false, paramsUpdatedCallback),
+  Config::ConfigItem(json_name_qos, Config::SectionId::MQTT_id, 0, paramsUpdatedCallback),
+  Config::ConfigItem(json_name_inflight_window, Config::SectionId::MQTT_id, 4, paramsUpdatedCallback),
 
   Config::ConfigItem(json_name_lwt_enabled, Config::SectionId::MQTT_id, RFLink_default_MQTT_LWT, paramsUpdatedCallback),
   Config::ConfigItem(json_name_topic_lwt,   Config::SectionId::MQTT_id, MQTT_TOPIC_LWT, paramsUpdatedCallback),
@@ -104,6 +200,148 @@ Config::ConfigItem configItems[] =  {
   Config::ConfigItem()
 };
 
+void acknowledged(uint16_t packetId);
+
+/**
+ * Network client given to PubSubClient. While a batch is open it holds writes back, so the publishes of a burst share
+ * TCP segments, and it watches inbound packets for the PUBACKs PubSubClient reads but does not handle.
+ * */
+class Transport : public Client {
+  public:
+    Client *inner = &WIFIClient;
+    bool batching = false;
+
+    using Print::write;
+    int connect(IPAddress ip, uint16_t port) override { return inner->connect(ip, port); }
+    int connect(const char *host, uint16_t port) override { return inner->connect(host, port); }
+    size_t write(uint8_t byte) override { return write(&byte, 1); }
+    size_t write(const uint8_t *data, size_t size) override;
+    int available() override { return inner->available(); }
+    int read() override;
+    int read(uint8_t *data, size_t size) override;
+    int peek() override { return inner->peek(); }
+    void flush() override { sendBatch(); } // not forwarded, flush() drops inbound data on ESP32
+    void stop() override;
+    uint8_t connected() override { return inner->connected(); }
+    operator bool() override { return (bool) *inner; }
+
+    bool sendBatch(); // writes what the batch holds
+    size_t writable(); // bytes which can be written without waiting for the broker, batched ones deducted
+
+  private:
+    uint8_t batch[MQTT_BATCH_SIZE];
+    size_t batchLength = 0;
+
+    // inbound packet being read
+    uint8_t step = 0; // 0: fixed header, 1: remaining length, 2: body
+    uint8_t type = 0;
+    uint8_t shift = 0;
+    uint32_t remaining = 0;
+    uint32_t position = 0;
+    uint16_t packetId = 0; // first two bytes of the body
+
+    void watch(uint8_t byte);
+};
+
+size_t Transport::write(const uint8_t *data, size_t size)
+{
+  if (!batching) {
+    counters::segments++;
+    return inner->write(data, size);
+  }
+  if (batchLength + size > sizeof(batch) && !sendBatch())
+    return 0;
+  if (size > sizeof(batch)) {
+    counters::segments++;
+    return inner->write(data, size);
+  }
+  memcpy(&batch[batchLength], data, size);
+  batchLength += size;
+  return size;
+}
+
+bool Transport::sendBatch()
+{
+  if (batchLength == 0)
+    return true;
+  counters::segments++;
+  bool ok = inner->write(batch, batchLength) == batchLength;
+  batchLength = 0;
+  return ok;
+}
+
+size_t Transport::writable()
+{
+  size_t room;
+#ifdef ESP8266
+  room = inner->availableForWrite();
+#else
+  // ESP32 clients can't tell their free send space: lwIP reports a socket writable once TCP_SNDLOWAT bytes are free
+  int fd = inner == &WIFIClientSecure ? WIFIClientSecure.socket() : WIFIClient.fd();
+  fd_set set;
+  FD_ZERO(&set);
+  struct timeval timeout = {0, 0};
+  if (fd >= 0)
+    FD_SET(fd, &set);
+  room = fd >= 0 && select(fd + 1, nullptr, &set, nullptr, &timeout) > 0 ? TCP_SNDLOWAT : 0;
+#endif
+  return room > batchLength ? room - batchLength : 0;
+}
+
+int Transport::read()
+{
+  int byte = inner->read();
+  if (byte >= 0)
+    watch(byte);
+  return byte;
+}
+
+int Transport::read(uint8_t *data, size_t size)
+{
+  int count = inner->read(data, size);
+  for (int i = 0; i < count; i++)
+    watch(data[i]);
+  return count;
+}
+
+void Transport::stop()
+{
+  batchLength = 0;
+  step = 0;
+  inner->stop();
+}
+
+void Transport::watch(uint8_t byte)
+{
+  switch (step) {
+    case 0:
+      type = byte & 0xF0;
+      remaining = 0;
+      shift = 0;
+      position = 0;
+      packetId = 0;
+      step = 1;
+      return;
+    case 1:
+      remaining |= (uint32_t) (byte & 0x7F) << shift;
+      shift += 7;
+      if ((byte & 0x80) == 0)
+        step = remaining > 0 ? 2 : 0;
+      return;
+    default:
+      if (position < 2)
+        packetId = (packetId << 8) | byte;
+      if (++position < remaining)
+        return;
+      if (type == MQTTPUBACK && remaining == 2)
+        acknowledged(packetId);
+      step = 0;
+      return;
+  }
+}
+
+Transport transport;
+
 PubSubClient MQTTClient; // MQTTClient(WIFIClient);
 
 void callback(char *, byte *, unsigned int);
@@ -165,6 +403,24 @@ void refreshParametersFromConfig(bool triggerChanges) {
       params::topic_out = item->getCharValue();
     }
 
+    // only changes what is published next, no need to reconnect
+    item = Config::findConfigItem(json_name_json_enabled, Config::SectionId::MQTT_id);
+    params::json_enabled = item->getBoolValue();
+
+    item = Config::findConfigItem(json_name_qos, Config::SectionId::MQTT_id);
+    params::qos = item->getLongIntValue();
+    if (params::qos < 0 || params::qos > 1) {
+      Serial.println(F("MQTT qos must be 0 or 1, using 1"));
+      params::qos = 1;
+    }
+
+    item = Config::findConfigItem(json_name_inflight_window, Config::SectionId::MQTT_id);
+    params::inflight_window = item->getLongIntValue();
+    if (params::inflight_window < 1 || params::inflight_window > MQTT_INFLIGHT_MAX) {
+      params::inflight_window = constrain(params::inflight_window, 1, MQTT_INFLIGHT_MAX);
+      Serial.printf_P(PSTR("MQTT inflight_window must be from 1 to %i, using %i\r\n"), MQTT_INFLIGHT_MAX, params::inflight_window);
+    }
+
     item = Config::findConfigItem(json_name_lwt_enabled, Config::SectionId::MQTT_id);
     if( item->getBoolValue() != params::lwt_enabled) {
       changesDetected = true;
@@ -214,9 +470,13 @@ void setup_MQTT()
 {
   refreshParametersFromConfig(false);
 
-  lastMqttConnectionAttemptTime.tv_sec = 0;
-
   MQTTClient.setKeepAlive(MQTT_KEEPALIVE);
+  MQTTClient.setSocketTimeout(MQTT_SOCKET_TIMEOUT);
+#ifdef ESP8266
+  WIFIClient.setTimeout(MQTT_CONNECT_TIMEOUT_MS);
+  WIFIClientSecure.setTimeout(MQTT_CONNECT_TIMEOUT_MS);
+#endif
+  MQTTClient.setBufferSize(MQTT_BUFFER_SIZE);
 
   Serial.print(F("MQTT setup SSL mode :\t\t\t"));
   if(params::ssl_enabled) {
@@ -234,73 +494,241 @@ void setup_MQTT()
     params::port = 1883;
 
   if(params::ssl_enabled)
-    MQTTClient.setClient(WIFIClientSecure);
+    transport.inner = &WIFIClientSecure;
   else
-    MQTTClient.setClient(WIFIClient);
+    transport.inner = &WIFIClient;
+  MQTTClient.setClient(transport);
 
   MQTTClient.setServer(params::server.c_str(), params::port);
   MQTTClient.setCallback(callback);
-  bResub = true;
 }
 
-void callback(char *topic, byte *payload, unsigned int length)
+void recordLatency(unsigned long latency)
 {
-  payload[length] = 0;
-  CheckMQTT(payload);
+  uint8_t bucket = 0;
+  while (bucket < MQTT_LATENCY_BUCKETS - 1 && latency >= (1UL << bucket))
+    bucket++;
+  counters::latency[bucket]++;
+  counters::commands++;
+  if (latency > counters::latencyMax)
+    counters::latencyMax = latency;
 }
 
-
-void reconnect(int retryCount, bool force)
+/**
+ * @return upper bound in ms of the bucket holding the given percentile of the recorded latencies
+ * */
+unsigned long latencyPercentile(uint8_t percent)
 {
-  if(!params::enabled)
-    return;
+  if (counters::commands == 0)
+    return 0;
+  unsigned long rank = (counters::commands * percent + 99) / 100, seen = 0;
+  for (uint8_t bucket = 0; bucket < MQTT_LATENCY_BUCKETS - 1; bucket++) {
+    seen += counters::latency[bucket];
+    if (seen >= rank)
+      return min(1UL << bucket, counters::latencyMax);
+  }
+  return counters::latencyMax;
+}
 
-  struct timeval currentTime;
-  gettimeofday(&currentTime, nullptr);
+/**
+ * Reads topic_in/<protocol>/<id>[/<switch>]/set and its payload (ON, OFF, ... or a level) into a TX request
+ * @return false if the topic is not a command topic or a field does not fit
+ * */
+bool parseCommandTopic(const char *topic, const byte *payload, unsigned int length, TX::Request &request)
+{
+  size_t prefixLength = params::topic_in.length();
+  if (strncmp(topic, params::topic_in.c_str(), prefixLength) != 0 || topic[prefixLength] != '/')
+    return false;
+
+  char levels[MQTT_DEVICE_TOPIC_SIZE];
+  if (strlcpy(levels, &topic[prefixLength + 1], sizeof(levels)) >= sizeof(levels))
+    return false;
+  char *fields[4];
+  uint8_t count = 0;
+  char *position = levels;
+  for (char *level = strsep(&position, "/"); level != nullptr; level = strsep(&position, "/")) {
+    if (count == 4)
+      return false;
+    fields[count++] = level;
+  }
+  if (count < 3 || strcmp(fields[count - 1], "set") != 0)
+    return false;
+
+  // payload trimmed and in upper case, "on" is ON
+  while (length > 0 && isspace(payload[length - 1]))
+    length--;
+  while (length > 0 && isspace(*payload)) {
+    payload++;
+    length--;
+  }
+  if (length == 0 || length >= sizeof(request.command))
+    return false;
+  for (unsigned int i = 0; i < length; i++)
+    request.command[i] = toupper(payload[i]);
+  request.command[length] = 0;
+
+  return strlcpy(request.protocol, fields[0], sizeof(request.protocol)) < sizeof(request.protocol) &&
+         strlcpy(request.id, fields[1], sizeof(request.id)) < sizeof(request.id) &&
+         strlcpy(request.switchId, count == 4 ? fields[2] : "", sizeof(request.switchId)) < sizeof(request.switchId);
+}
 
-  if(!force) {
-    if(currentTime.tv_sec- lastMqttConnectionAttemptTime.tv_sec < 30) {
-      return;
+void callback(char *topic, byte *payload, unsigned int length)
+{
+  if (strcmp(topic, params::topic_in.c_str()) != 0) {
+    // command topics go straight to the TX queue, without building and parsing a 10;... line
+    TX::Request request;
+    if (!parseCommandTopic(topic, payload, length, request) || !TX::queueRequest(request)) {
+      uint8_t previousClass = Messages::setClass(Messages::Class_Reply);
+      display_Header();
+      display_Name(PSTR("CMD UNKNOWN"));
+      display_Footer();
+      Messages::setClass(previousClass);
     }
+    if (runtime::inboundWaiting)
+      recordLatency(millis() - runtime::inboundSince); // up to the request being queued
+    return;
   }
 
-  int retryLeft = retryCount;
-  bResub = true;
+  payload[length] = 0;
+  CheckMQTT(payload); // the command is executed (and transmitted) before it returns
+  if (runtime::inboundWaiting)
+    recordLatency(millis() - runtime::inboundSince);
+}
 
-  if(force && MQTTClient.connected()) {
-    MQTTClient.disconnect();
+bool inboundAvailable()
+{
+  return transport.available() > 0;
+}
+
+
+PGM_P stateName(ConnectionState state)
+{
+  switch (state) {
+    case State_Disabled: return PSTR("disabled");
+    case State_WaitRetry: return PSTR("waiting");
+    case State_Resolve: return PSTR("resolving");
+    case State_Connect: return PSTR("connecting");
+    case State_Handshake: return PSTR("handshake");
+    case State_Subscribe: return PSTR("subscribing");
+    case State_Connected: return PSTR("connected");
+    default: return PSTR("unknown");
   }
+}
 
+void closeConnection()
+{
+  if (MQTTClient.connected())
+    MQTTClient.disconnect();
+  transport.stop();
+  WIFIClient.stop();
+  WIFIClientSecure.stop();
+}
 
-  while (!MQTTClient.connected() && (retryCount<=0 || retryLeft>0))
-  {
-    retryLeft--;
-    lastMqttConnectionAttemptTime.tv_sec = currentTime.tv_sec;
+// the current step failed: start over after the backoff delay, which doubles up to MQTT_BACKOFF_MAX_MS
+void connectionFailed(PGM_P step)
+{
+  counters::failures++;
+  Serial.printf_P(PSTR("Failed (%s, rc=%i), next attempt in %lu s\r\n"), step, MQTTClient.state(), runtime::backoff / 1000);
+  closeConnection();
+  runtime::nextAttempt = millis() + runtime::backoff;
+  runtime::backoff = min(runtime::backoff * 2, (unsigned long) MQTT_BACKOFF_MAX_MS);
+  runtime::state = State_WaitRetry;
+}
 
-    Serial.print(F("Trying to connect to MQTT Server '"));
-    Serial.print(params::server.c_str());
-    Serial.print(F("' ... "));
+void requestReconnect()
+{
+  runtime::reconnectRequested = true;
+}
 
-    bool connectOK;
+/**
+ * Runs one step of the connection, so a step which has to wait on the network (each of them is bounded by
+ * MQTT_CONNECT_TIMEOUT_MS or MQTT_SOCKET_TIMEOUT, except the DNS lookup on ESP32: 4 s) is never followed by another
+ * one in the same loop
+ * */
+void stepConnection()
+{
+  bool ok;
+
+  switch (runtime::state) {
+    case State_Disabled:
+    case State_WaitRetry:
+      if ((long) (millis() - runtime::nextAttempt) < 0)
+        return;
+      if (WiFi.status() != WL_CONNECTED) {
+        runtime::nextAttempt = millis() + MQTT_BACKOFF_MIN_MS;
+        return;
+      }
+      counters::attempts++;
+      Serial.print(F("Trying to connect to MQTT Server '"));
+      Serial.print(params::server.c_str());
+      Serial.print(F("' ... "));
+      // TLS checks the certificate against the server name, the secure client resolves it by itself
+      runtime::state = params::ssl_enabled ? State_Connect : State_Resolve;
+      return;
 
-    if(params::lwt_enabled) {
-      #ifdef ESP32
-      connectOK = MQTTClient.connect(params::id.c_str(), params::user.c_str(), params::password.c_str(), (params::topic_lwt).c_str(), 2, true, PSTR("Offline"));
-      #elif defined(ESP8266)
-      connectOK = MQTTClient.connect(params::id.c_str(), params::user.c_str(), params::password.c_str(), (params::topic_lwt).c_str(), 2, true, "Offline");
-      #endif // ESP
+    case State_Resolve:
+      if (runtime::serverIP.fromString(params::server.c_str())) {
+        runtime::state = State_Connect;
+        return;
+      }
+#ifdef ESP32
+      // the ESP32 core has no timeout argument, its lookup gives up after its own fixed 4 s (the secure client
+      // resolves the server name with the same call), more than MQTT_CONNECT_TIMEOUT_MS but still bounded
+      ok = WiFi.hostByName(params::server.c_str(), runtime::serverIP) == 1;
+#else
+      // the default timeout of the ESP8266 core is 10 s
+      ok = WiFi.hostByName(params::server.c_str(), runtime::serverIP, MQTT_CONNECT_TIMEOUT_MS) == 1;
+#endif
+      if (!ok)
+        return connectionFailed(PSTR("DNS lookup"));
+      runtime::state = State_Connect;
+      return;
 
-    } else {
-      connectOK = MQTTClient.connect(params::id.c_str(), params::user.c_str(), params::password.c_str());
-    }
+    case State_Connect:
+#ifdef ESP32
+      if (params::ssl_enabled)
+        ok = WIFIClientSecure.connect(params::server.c_str(), params::port, MQTT_CONNECT_TIMEOUT_MS);
+      else
+        ok = WIFIClient.connect(runtime::serverIP, params::port, MQTT_CONNECT_TIMEOUT_MS);
+#else
+      // bounded by the clients timeout, set to MQTT_CONNECT_TIMEOUT_MS by setup_MQTT()
+      if (params::ssl_enabled)
+        ok = WIFIClientSecure.connect(params::server.c_str(), params::port);
+      else
+        ok = WIFIClient.connect(runtime::serverIP, params::port);
+#endif
+      if (!ok)
+        return connectionFailed(params::ssl_enabled ? PSTR("TLS connection") : PSTR("TCP connection"));
+      runtime::state = State_Handshake;
+      return;
+
+    case State_Handshake:
+      // the network client is connected already, PubSubClient only sends CONNECT and waits for CONNACK
+      if(params::lwt_enabled) {
+        #ifdef ESP32
+        ok = MQTTClient.connect(params::id.c_str(), params::user.c_str(), params::password.c_str(), (params::topic_lwt).c_str(), 2, true, PSTR("Offline"));
+        #elif defined(ESP8266)
+        ok = MQTTClient.connect(params::id.c_str(), params::user.c_str(), params::password.c_str(), (params::topic_lwt).c_str(), 2, true, "Offline");
+        #endif // ESP
+      } else {
+        ok = MQTTClient.connect(params::id.c_str(), params::user.c_str(), params::password.c_str());
+      }
+      if (!ok)
+        return connectionFailed(PSTR("MQTT handshake"));
 
-    if(connectOK)
-    {
       Serial.println(F("Established"));
       Serial.print(F("MQTT ID :\t\t"));
       Serial.println(params::id.c_str());
       Serial.print(F("MQTT Username :\t\t"));
       Serial.println(params::user.c_str());
+      runtime::state = State_Subscribe;
+      return;
+
+    case State_Subscribe:
+      MQTTClient.subscribe(params::topic_in.c_str());
+      // topic_in/<protocol>/<id>/set and topic_in/<protocol>/<id>/<switch>/set, "#" would also match topic_in itself
+      MQTTClient.subscribe((params::topic_in + "/+/+/set").c_str());
+      MQTTClient.subscribe((params::topic_in + "/+/+/+/set").c_str());
       if(params::lwt_enabled) {
         #ifdef ESP32
               MQTTClient.publish((params::topic_lwt).c_str(), PSTR("Online"), true);
@@ -308,72 +736,330 @@ void reconnect(int retryCount, bool force)
               MQTTClient.publish((params::topic_lwt).c_str(), "Online", true);
         #endif // ESP
       }
-    }
-    else
-    {
-      Serial.print(F("Failed - rc="));
-      Serial.println(MQTTClient.state());
-    }
+      counters::connections++;
+      runtime::backoff = MQTT_BACKOFF_MIN_MS;
+      // the broker starts a clean session: messages not acknowledged before are sent again right away
+      for (auto &slot : runtime::inFlight)
+        slot.sentAt = millis() - MQTT_RETRY_MS;
+      runtime::state = State_Connected;
+      return;
+
+    case State_Connected:
+      if (!MQTTClient.connected()) {
+        Serial.printf_P(PSTR("MQTT connection lost (rc=%i)\r\n"), MQTTClient.state());
+        closeConnection();
+        runtime::nextAttempt = millis();
+        runtime::state = State_WaitRetry;
+      }
+      return;
   }
 }
 
-void publishMsg()
+bool publishMsg(const char *message)
 {
   if(!params::enabled)
-    return;
+    return false;
 
   static boolean MQTT_RETAINED = MQTT_RETAINED_0;
 
-  if (!MQTTClient.connected())
-    reconnect(1);
-  MQTTClient.publish(params::topic_out.c_str(), pbuffer, MQTT_RETAINED);
+  if (!MQTTClient.connected() || transport.writable() < 9 + params::topic_out.length() + strlen(message))
+    return false;
+  return MQTTClient.publish(params::topic_out.c_str(), message, MQTT_RETAINED);
+}
+
+// topic and payload a message is published with
+struct Rendered {
+  const char *topic;
+  const uint8_t *payload;
+  size_t length;
+  char topicBuffer[MQTT_DEVICE_TOPIC_SIZE];
+  char jsonBuffer[MQTT_JSON_PAYLOAD_SIZE];
+};
+
+Rendered rendered; // too large for the stack, shared by publishMsg() and retransmit()
+
+// replies, debug traces and signals without a complete frame are neither cached nor sent as JSON
+inline bool isDecoded(const Messages::Message &message)
+{
+  return message.messageClass == Messages::Class_Decode && message.frameLength > 0;
+}
+
+// decoded signal as JSON on its device topic when json_enabled, text on topic_out otherwise or when it cannot be routed
+void render(const Messages::Message &message, Rendered &output)
+{
+  output.topic = params::topic_out.c_str();
+  output.payload = (const uint8_t *) message.text;
+  output.length = message.length;
+  if (!isDecoded(message) || !params::json_enabled)
+    return;
+
+  size_t prefixLength = strlcpy(output.topicBuffer, params::topic_out.c_str(), sizeof(output.topicBuffer));
+  if (prefixLength + 1 >= sizeof(output.topicBuffer))
+    return;
+  output.topicBuffer[prefixLength++] = '/';
+  if (!Binary::frameDeviceTopic(message.frame, message.frameLength, &output.topicBuffer[prefixLength],
+                                sizeof(output.topicBuffer) - prefixLength))
+    return; // no ID to route it with
+
+  StaticJsonDocument<384> json;
+  JsonObject payload = json.to<JsonObject>();
+  Binary::frameToJson(message.frame, message.frameLength, payload);
+
+  size_t length = serializeJson(json, output.jsonBuffer, sizeof(output.jsonBuffer));
+  if (json.overflowed() || length >= sizeof(output.jsonBuffer) - 1)
+    return;
+
+  output.topic = output.topicBuffer;
+  output.payload = (const uint8_t *) output.jsonBuffer;
+  output.length = length;
+}
+
+/**
+ * Writes a QoS 1 PUBLISH packet, PubSubClient only sends QoS 0 ones. Pieces go through the transport, which joins
+ * them when a batch is open.
+ * */
+bool writePublish(const Rendered &message, uint16_t packetId, bool duplicate)
+{
+  size_t topicLength = strlen(message.topic);
+  size_t remaining = 2 + topicLength + 2 + message.length;
+  if (remaining + 5 > MQTT_BUFFER_SIZE)
+    return false; // the broker would not take it from PubSubClient either
+
+  uint8_t header[7];
+  uint8_t size = 0;
+  header[size++] = MQTTPUBLISH | MQTTQOS1 | (duplicate ? 0x08 : 0) | (MQTT_RETAINED_0 ? 1 : 0);
+  do {
+    uint8_t digit = remaining % 128;
+    remaining /= 128;
+    header[size++] = remaining > 0 ? digit | 0x80 : digit;
+  } while (remaining > 0);
+  header[size++] = topicLength >> 8;
+  header[size++] = topicLength & 0xFF;
+  uint8_t id[2] = {(uint8_t) (packetId >> 8), (uint8_t) (packetId & 0xFF)};
+
+  counters::published++;
+  return transport.write(header, size) == size &&
+         transport.write((const uint8_t *) message.topic, topicLength) == topicLength &&
+         transport.write(id, sizeof(id)) == sizeof(id) &&
+         transport.write(message.payload, message.length) == message.length;
+}
+
+uint8_t inFlightCount()
+{
+  uint8_t count = 0;
+  for (auto &slot : runtime::inFlight) {
+    if (slot.packetId != 0)
+      count++;
+  }
+  return count;
+}
+
+void acknowledged(uint16_t packetId)
+{
+  for (auto &slot : runtime::inFlight) {
+    if (slot.packetId == packetId) {
+      slot.packetId = 0;
+      counters::acknowledged++;
+      return;
+    }
+  }
+  // late PUBACK of a message already counted as lost, or sent before a reboot
+}
+
+// sends again the QoS 1 messages whose PUBACK is overdue, gives up after MQTT_MAX_RETRIES
+void retransmit()
+{
+  for (auto &slot : runtime::inFlight) {
+    if (slot.packetId == 0 || millis() - slot.sentAt < MQTT_RETRY_MS)
+      continue;
+    if (slot.retries >= MQTT_MAX_RETRIES) {
+      slot.packetId = 0;
+      counters::lost++;
+      continue;
+    }
+    if (transport.writable() < MQTT_PUBLISH_MAX_SIZE)
+      return; // the send buffer is full, tried again on the next loop
+    render(slot.message, rendered);
+    if (!writePublish(rendered, slot.packetId, true))
+      return; // stepConnection() deals with the broken connection
+    slot.retries++;
+    slot.sentAt = millis();
+    counters::retried++;
+  }
+}
+
+bool publishRendered(const Messages::Message &message)
+{
+  if (params::qos == 0) {
+    counters::published++;
+    return MQTTClient.publish(rendered.topic, rendered.payload, rendered.length, MQTT_RETAINED_0);
+  }
+
+  InFlight *target = nullptr;
+  for (auto &slot : runtime::inFlight) {
+    if (slot.packetId == 0) {
+      target = &slot;
+      break;
+    }
+  }
+  if (target == nullptr || inFlightCount() >= params::inflight_window)
+    return false; // the message waits in the queue for a PUBACK
+
+  if (++runtime::lastPacketId == 0)
+    runtime::lastPacketId = 1;
+  if (!writePublish(rendered, runtime::lastPacketId, false))
+    return false;
+  target->packetId = runtime::lastPacketId;
+  target->retries = 0;
+  target->sentAt = millis();
+  target->message = message;
+  return true;
+}
+
+bool publishMsg(const Messages::Message &message)
+{
+  if (!canPublish())
+    return false;
+
+  bool decoded = isDecoded(message);
+  if (decoded && Cache::isRedundant(message.frame, message.frameLength))
+    return true; // nothing new, counted by the cache rather than as a drop
+
+  render(message, rendered);
+  bool published = publishRendered(message);
+  if (decoded && published)
+    Cache::remember(message.frame, message.frameLength);
+  return published;
+}
+
+bool isConnected()
+{
+  return params::enabled && runtime::state == State_Connected && MQTTClient.connected();
+}
+
+bool canPublish()
+{
+  // PubSubClient and writePublish() would wait for room in the send buffer, the broker being slow to read
+  return isConnected() && (params::qos == 0 || inFlightCount() < params::inflight_window) &&
+         transport.writable() >= MQTT_PUBLISH_MAX_SIZE;
+}
+
+void beginBatch()
+{
+  transport.batching = true;
+}
+
+void endBatch()
+{
+  transport.batching = false;
+  transport.sendBatch();
 }
 
 void checkMQTTloop()
 {
   if(!params::enabled) {
+    if (runtime::state != State_Disabled) {
+      closeConnection();
+      runtime::state = State_Disabled;
+    }
     return;
   }
 
   if(paramsHaveChanged) {
     paramsHaveChanged = false;
+    closeConnection(); // before the network client is swapped
     if(params::ssl_enabled)
-      MQTTClient.setClient(WIFIClientSecure);
+      transport.inner = &WIFIClientSecure;
     else {
-      MQTTClient.setClient(WIFIClient);
+      transport.inner = &WIFIClient;
     }
     MQTTClient.setServer(params::server.c_str(), params::port);
-    reconnect(1, true);
-    gettimeofday(&lastMqttConnectionAttemptTime, nullptr);
+    runtime::reconnectRequested = true;
+  }
+
+  if (runtime::reconnectRequested) {
+    runtime::reconnectRequested = false;
+    closeConnection();
+    runtime::backoff = MQTT_BACKOFF_MIN_MS;
+    runtime::nextAttempt = millis();
+    runtime::state = State_WaitRetry;
+  }
+
+  if (runtime::state != State_Connected) {
+    stepConnection();
     return;
   }
 
+  // a command published to topic_in is handled in the loop its bytes arrive, not on the next keepalive check
+  if (inboundAvailable()) {
+    if (!runtime::inboundWaiting) {
+      runtime::inboundWaiting = true;
+      runtime::inboundSince = millis();
+    }
+    for (uint8_t packet = 0; packet < MQTT_INBOUND_BURST && inboundAvailable(); packet++)
+      MQTTClient.loop();
+    if (!inboundAvailable())
+      runtime::inboundWaiting = false;
+  }
+
+  beginBatch();
+  retransmit();
+  endBatch();
+
   static unsigned long lastCheck = millis();
 
-  if (millis() > lastCheck + MQTT_LOOP_MS)
+  if (millis() - lastCheck >= MQTT_LOOP_MS)
   {
-    if (!MQTTClient.connected()) {
-      reconnect(1);
-    }
-
-    if (bResub)
-    {
-      // Once connected, resubscribe
-      MQTTClient.subscribe(params::topic_in.c_str());
-      bResub = false;
-      delay(10);
-    }
-    MQTTClient.loop();
+    stepConnection(); // notices a lost connection
+    MQTTClient.loop(); // keepalive
     lastCheck = millis();
   }
 
 }
 
+void executeCliCommand(char *cmd)
+{
+  char *commaIndex = strchr(cmd, ';');
+
+  if (commaIndex == nullptr) {
+    Serial.println(F("Error : failed to find ending ';' for the command"));
+    return;
+  }
+
+  int commandSize = commaIndex - cmd;
+  *commaIndex = 0; // replace ';' with null termination
+
+  if (strncasecmp_P(cmd, commands::show, commandSize) == 0) {
+    sprintf_P(printBuf, PSTR("20;XX;DEBUG;MQTT;STATE=%s;COMMANDS=%lu;P50=%lums;P90=%lums;P99=%lums;MAX=%lums;"),
+              stateName(runtime::state), counters::commands, latencyPercentile(50), latencyPercentile(90),
+              latencyPercentile(99), counters::latencyMax);
+    sendRawPrint(printBuf, true);
+    sprintf_P(printBuf, PSTR("20;XX;DEBUG;MQTT;QOS=%i;INFLIGHT=%u/%i;PUBLISHED=%lu;SEGMENTS=%lu;ACKNOWLEDGED=%lu;RETRIED=%lu;LOST=%lu;"),
+              params::qos, (unsigned int) inFlightCount(), params::inflight_window, counters::published,
+              counters::segments, counters::acknowledged, counters::retried, counters::lost);
+    sendRawPrint(printBuf, true);
+  }
+  else if (strncasecmp_P(cmd, commands::clear, commandSize) == 0) {
+    counters::commands = 0;
+    counters::latencyMax = 0;
+    memset(counters::latency, 0, sizeof(counters::latency));
+    counters::published = 0;
+    counters::segments = 0;
+    counters::acknowledged = 0;
+    counters::retried = 0;
+    counters::lost = 0;
+    sendRawPrint(F("20;XX;DEBUG;MQTT;CLEARED;"), true);
+  }
+  else {
+    Serial.printf_P(PSTR("Error : unknown command '%s'\r\n"), cmd);
+  }
+}
+
 void getStatusJsonString(JsonObject &output) {
   auto && mqtt = output.createNestedObject("mqtt");
 
   if(params::enabled) {
-    if( MQTTClient.connected() ) {
+    if( runtime::state == State_Connected ) {
       mqtt["status"] = "connected";
     } else {
       mqtt["status"] = "error";
@@ -381,6 +1067,27 @@ void getStatusJsonString(JsonObject &output) {
   } else {
     mqtt["status"] = "disabled";
   }
+  mqtt[F("state")] = reinterpret_cast<const __FlashStringHelper *>(stateName(runtime::state));
+  mqtt[F("attempts")] = counters::attempts;
+  mqtt[F("failures")] = counters::failures;
+  mqtt[F("connections")] = counters::connections;
+  if (runtime::state == State_WaitRetry)
+    mqtt[F("next_attempt_s")] = (long) (runtime::nextAttempt - millis()) > 0 ? (runtime::nextAttempt - millis()) / 1000 : 0;
+  mqtt["format"] = params::json_enabled ? "json" : "text";
+  auto && latency = mqtt.createNestedObject(F("command_latency_ms"));
+  latency[F("count")] = counters::commands;
+  latency[F("p50")] = latencyPercentile(50);
+  latency[F("p90")] = latencyPercentile(90);
+  latency[F("p99")] = latencyPercentile(99);
+  latency[F("max")] = counters::latencyMax;
+  mqtt[F("qos")] = params::qos;
+  mqtt[F("inflight")] = inFlightCount();
+  mqtt[F("inflight_window")] = params::inflight_window;
+  mqtt[F("published")] = counters::published;
+  mqtt[F("segments")] = counters::segments;
+  mqtt[F("acknowledged")] = counters::acknowledged;
+  mqtt[F("retried")] = counters::retried;
+  mqtt[F("lost")] = counters::lost;
 
 
 }
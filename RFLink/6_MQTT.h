@@ -23,6 +23,7 @@
 
 #include "4_Display.h"
 #include "11_Config.h"
+#include "15_Messages.h"
 
 #include <time.h>
 #include <sys/time.h>
@@ -32,7 +33,17 @@ extern char MQTTbuffer[PRINT_BUFFER_SIZE]; // Buffer for MQTT message
 namespace RFLink { namespace Mqtt {
 
     extern Config::ConfigItem configItems[];
-    extern struct timeval lastMqttConnectionAttemptTime;
+
+    // connection steps, checkMQTTloop() runs at most one of them per call
+    enum ConnectionState {
+      State_Disabled,
+      State_WaitRetry, // until the backoff delay is over
+      State_Resolve,   // DNS lookup of the server name
+      State_Connect,   // TCP connection, including the TLS handshake when ssl_enabled
+      State_Handshake, // MQTT CONNECT / CONNACK
+      State_Subscribe, // topic_in subscription and LWT "Online"
+      State_Connected,
+    };
 
     namespace params {
         extern bool enabled;
@@ -44,6 +55,9 @@ namespace RFLink { namespace Mqtt {
 
         extern String topic_out;
         extern String topic_in;
+        extern bool json_enabled; // decoded signals go to topic_out/<protocol>/<id>[/<switch>] as JSON
+        extern int qos;             // 0, or 1 to retransmit messages until the broker acknowledges them
+        extern int inflight_window; // QoS 1 messages sent and not acknowledged yet, at most
 
         extern bool lwt_enabled;
         extern String topic_lwt;
@@ -53,10 +67,28 @@ namespace RFLink { namespace Mqtt {
         extern String ca_cert;
     }
 
+    namespace counters {
+        extern unsigned long int attempts;
+        extern unsigned long int failures;
+        extern unsigned long int connections;
+        extern unsigned long int published;    // PUBLISH packets, retransmissions included
+        extern unsigned long int acknowledged;
+        extern unsigned long int retried;
+        extern unsigned long int lost;         // QoS 1 messages still not acknowledged after MQTT_MAX_RETRIES
+    }
+
 void setup_MQTT();
-void reconnect(int retryCount=-1, bool force=false);
-void publishMsg();
-void checkMQTTloop();
+void requestReconnect(); // drops the current connection, the next checkMQTTloop() calls connect again, never blocks
+bool publishMsg(const char *message); // does not try to reconnect, returns false if the message could not be sent
+bool publishMsg(const Messages::Message &message); // as JSON on a per-device topic when json_enabled, as text otherwise
+bool isConnected();
+bool canPublish(); // connected, with room in the in-flight window when qos is 1 and in the TCP send buffer
+
+// publishes between these two calls are written to the network together, in as few TCP segments as possible
+void beginBatch();
+void endBatch();
+void checkMQTTloop(); // handles inbound commands as soon as they arrive, keepalive every MQTT_LOOP_MS
+void executeCliCommand(char *cmd);
 
 void paramsUpdatedCallback();
 void refreshParametersFromConfig(bool triggerChanges=true);
@@ -13,6 +13,7 @@
 
 #include "4_Display.h"
 #include "8_OLED.h"
+#include "16_Binary.h"
 #include <U8x8lib.h> // Comment to avoid dependency graph inclusion
 
 #define U8X8_PIN_NONE 255
@@ -22,10 +23,22 @@
 U8X8_SSD1306_128X64_NONAME_HW_I2C u8x8(/* reset=*/U8X8_PIN_NONE, /* clock=*/PIN_OLED_SCL, /* data=*/PIN_OLED_SDA);
 // U8X8_SSD1306_128X64_VCOMH0_HW_I2C u8x8(/* reset=*/U8X8_PIN_NONE, /* clock=*/PIN_OLED_SCL, /* data=*/PIN_OLED_SDA);
 
-#define U8LOG_WIDTH 16
-#define U8LOG_HEIGHT 8
-uint8_t u8log_buffer[U8LOG_WIDTH * U8LOG_HEIGHT];
-U8X8LOG u8x8log;
+#define OLED_COLUMNS 16
+#define OLED_ROWS 8
+#define OLED_REFRESH_MS 100 // a new screen is not started before this delay, later events only update the view
+#define OLED_SLICE_CHARS 4  // characters sent per loop_OLED() call, about 1 ms of I2C at 400 kHz
+
+// What the screen should show, filled from decoded events, and what it actually shows. loop_OLED() sends the
+// characters which differ, a few at a time, so an event never costs a full screen redraw in one go.
+namespace view
+{
+    char rows[OLED_ROWS][OLED_COLUMNS];
+    char shown[OLED_ROWS][OLED_COLUMNS]; // zeros never match a character, everything is drawn after the splash
+    uint8_t dirtyRows = 0;               // one bit per row which may differ from the screen
+    uint8_t nextRow = 0;
+    bool rendering = false;
+    unsigned long lastScreen = 0;
+}
 
 void setup_OLED()
 {
@@ -33,10 +46,7 @@ void setup_OLED()
     u8x8.setPowerSave(1);
     u8x8.setContrast(OLED_CONTRAST);
     u8x8.setFlipMode(OLED_FLIP);
-
-    u8x8log.begin(u8x8, U8LOG_WIDTH, U8LOG_HEIGHT, u8log_buffer);
-    u8x8log.setRedrawMode(0); // 0: Update screen with newline, 1: Update screen for every char
-    u8x8log.setLineHeightOffset(0);
+    u8x8.setFont(u8x8_font_amstrad_cpc_extended_r);
 }
 
 void splash_OLED()
@@ -53,31 +63,146 @@ void splash_OLED()
     u8x8.setPowerSave(0);
 }
 
-void print_OLED()
+static void setRow(uint8_t row, const char *text, size_t length, bool upperCase = false)
+{
+    if (row >= OLED_ROWS)
+        return;
+    for (uint8_t column = 0; column < OLED_COLUMNS; column++)
+    {
+        char c = column < length ? text[column] : ' ';
+        view::rows[row][column] = upperCase ? toupper(c) : c;
+    }
+    view::dirtyRows |= 1 << row;
+}
+
+static void clearRows(uint8_t firstRow)
+{
+    for (uint8_t row = firstRow; row < OLED_ROWS; row++)
+        setRow(row, "", 0);
+}
+
+void print_OLED(const char *message)
+{
+    // one field per row, long fields wrap, the 20;XX; prefix is left out
+    if (strncmp_P(message, PSTR("20;"), 3) == 0)
+    {
+        const char *afterSequence = strchr(message + 3, ';');
+        if (afterSequence != nullptr)
+            message = afterSequence + 1;
+    }
+
+    uint8_t row = 0;
+    while (*message != 0 && *message != '\r' && row < OLED_ROWS)
+    {
+        size_t length = strcspn(message, ";\r");
+        if (length == 0)
+        {
+            message++;
+            continue;
+        }
+        for (size_t offset = 0; offset < length && row < OLED_ROWS; offset += OLED_COLUMNS)
+            setRow(row++, message + offset, min((size_t) OLED_COLUMNS, length - offset));
+        message += length;
+    }
+    clearRows(row);
+}
+
+void show_OLED(const RFLink::Messages::Message &message)
 {
-    /*
-    static char delim[2] = ";";
-    static char *ptr;
-    static boolean ret;
+    namespace Binary = RFLink::Binary;
 
- 
-    ptr = strtok(pbuffer, delim);
-    ret = false;
+    if (message.messageClass != RFLink::Messages::Class_Decode || message.frameLength == 0)
+    {
+        print_OLED(message.text);
+        return;
+    }
+
+    // protocol, then device, then one value per row
+    char line[OLED_COLUMNS + 1];
+    uint8_t row = 2;
+    size_t idLength = 0;
+    size_t switchLength = 0;
+    char id[OLED_COLUMNS + 1];
+    char sw[OLED_COLUMNS + 1];
+    id[0] = sw[0] = 0;
+    setRow(0, "", 0); // in case the frame has no name
 
-    while ((ptr != NULL) && (ptr[0] != '\r'))
+    Binary::forEachField(message.frame, message.frameLength, [&](uint8_t tag, const uint8_t *value, uint8_t size) {
+        switch (tag)
+        {
+        case Binary::Tag_Name:
+            setRow(0, (const char *)value, size);
+            return;
+        case Binary::Tag_NameId:
+            setRow(0, line, Binary::formatField(tag, value, size, line, sizeof(line)));
+            return;
+        case Binary::Tag_ID:
+        case Binary::Tag_IDText:
+            idLength = Binary::formatField(tag, value, size, id, sizeof(id));
+            return;
+        case Binary::Tag_Switch:
+        case Binary::Tag_SwitchText:
+            switchLength = Binary::formatField(tag, value, size, sw, sizeof(sw));
+            return;
+        case Binary::Tag_Sequence:
+        case Binary::Tag_Timestamp:
+        case Binary::Tag_Plugin:
+            return;
+        }
+        PGM_P name = Binary::fieldName(tag);
+        if (name == nullptr || row >= OLED_ROWS)
+            return;
+        size_t length = strlcpy_P(line, name, sizeof(line));
+        if (length < sizeof(line) - 1)
+            line[length++] = ' ';
+        length += Binary::formatField(tag, value, size, &line[length], sizeof(line) - length);
+        setRow(row++, line, length, true);
+    });
+
+    int length = snprintf_P(line, sizeof(line), switchLength > 0 ? PSTR("ID %s SW %s") : PSTR("ID %s"), id, sw);
+    setRow(1, line, idLength > 0 ? min(length, OLED_COLUMNS) : 0);
+    clearRows(row);
+}
+
+void loop_OLED()
+{
+    if (view::dirtyRows == 0)
+        return;
+
+    if (!view::rendering)
+    {
+        if (millis() - view::lastScreen < OLED_REFRESH_MS)
+            return;
+        view::rendering = true;
+        view::lastScreen = millis();
+        view::nextRow = 0;
+    }
+
+    for (; view::nextRow < OLED_ROWS; view::nextRow++)
     {
-        u8x8log.print(ptr);
-        u8x8log.print(delim);
-        if (ret)
-            u8x8log.print("\n");
-        else
-            ret = true;
-        ptr = strtok(NULL, delim);
+        uint8_t row = view::nextRow;
+        if (!(view::dirtyRows & (1 << row)))
+            continue;
+
+        uint8_t first = 0;
+        while (first < OLED_COLUMNS && view::rows[row][first] == view::shown[row][first])
+            first++;
+        if (first == OLED_COLUMNS)
+        {
+            view::dirtyRows &= ~(1 << row); // up to date, costs nothing
+            continue;
+        }
+
+        // one slice, the rest of the row is compared again on the next call
+        char slice[OLED_SLICE_CHARS + 1];
+        uint8_t count = min(OLED_SLICE_CHARS, OLED_COLUMNS - first);
+        memcpy(slice, &view::rows[row][first], count);
+        slice[count] = 0;
+        u8x8.drawString(first, row, slice);
+        memcpy(&view::shown[row][first], slice, count);
+        return;
     }
-*/
-    u8x8log.print('\f');
-    replacechar(pbuffer, ';', '\n');
-    u8x8log.print(pbuffer);
+    view::rendering = false; // rows changed meanwhile are drawn with the next screen
 }
 
 #endif // OLED_ENABLED
\ No newline at end of file
@@ -10,6 +10,7 @@
 
 #include <Arduino.h>
 #include "RFLink.h"
+#include "15_Messages.h"
 
 #ifdef OLED_ENABLED
 
@@ -25,7 +26,9 @@
 
 void setup_OLED();
 void splash_OLED();
-void print_OLED();
+void print_OLED(const char *message);                        // one text field per row
+void show_OLED(const RFLink::Messages::Message &message);     // decoded fields, from the binary frame when there is one
+void loop_OLED();                                             // sends a few changed characters to the screen
 
 #endif // OLED_ENABLED
 #endif // OLED_h
\ No newline at end of file
@@ -1,5 +1,6 @@
 #include "9_Serial2Net.h"
 #include "RFLink.h"
+#include "15_Messages.h"
 
 #ifndef RFLINK_SERIAL2NET_DISABLED
 
@@ -11,30 +12,243 @@
 namespace RFLink {
   namespace Serial2Net {
 
+    namespace counters {
+      unsigned long int writes = 0;       // write() calls to the TCP stack, roughly one segment each with NoDelay
+      unsigned long int lines = 0;        // end of lines sent
+      unsigned long int bytes = 0;
+      unsigned long int droppedBytes = 0; // output discarded because a client did not read fast enough
+      unsigned long int backpressure = 0; // flushes which could not be completed because of a full TCP window
+    }
+
+    namespace commands {
+      const char prefix[] PROGMEM = "10;serial2net;"; // commands handled for the client which sent them
+      const char subscribe[] PROGMEM = "subscribe";
+      const char plugins[] PROGMEM = "plugins";
+      const char show[] PROGMEM = "show";
+      const char format[] PROGMEM = "format";
+    }
+
     class Serial2NetClient : public WiFiClient {
 
     private:
       #ifdef ESP32
       static const uint16_t __buffer_size = 1024;
       #else
-      static const uint16_t __buffer_size = 128;
+      static const uint16_t __buffer_size = 512; // room for batch commands
       #endif
       uint16_t buffer_end;
 
+      char *output = nullptr; // SERIAL2NET_OUTPUT_BUFFER_SIZE bytes, after those of buffer
+      uint16_t output_end;
+      unsigned long output_since; // millis() when the oldest pending byte was queued
+
+      /**
+       * Writes no more than the TCP window accepts right now, without waiting for it
+       * @return number of bytes accepted
+       * */
+      size_t writeAvailable(const uint8_t *data, size_t length) {
+        #ifdef ESP8266
+        size_t room = availableForWrite();
+        return room == 0 ? 0 : write(data, length < room ? length : room);
+        #else
+        // WiFiClient::write() retries until all is sent, up to 10 times 1 s when the client stopped reading
+        int sent = send(fd(), data, length, MSG_DONTWAIT);
+        return sent > 0 ? sent : 0; // EAGAIN when the window is full, errors are seen by connected() later
+        #endif
+      }
+
+      uint8_t subscriptions = MESSAGE_CLASS_ALL;
+      bool pluginsFiltered = false; // when set, decoded signals are sent only for plugins flagged in 'plugins'
+      uint8_t plugins[256 / 8];
+
     public:
+      bool binary = false; // queued messages are sent as binary frames, other output is not sent at all
       bool ignore = true;
-      char buffer[__buffer_size + 1];
+      char *buffer = nullptr; // command being received, allocated with output while a client is connected
 
       Serial2NetClient() : WiFiClient::WiFiClient() {
-        buffer[__buffer_size] = 0;
         buffer_end = 0;
+        output_end = 0;
       }
 
-      Serial2NetClient &operator=(const WiFiClient &other) {
+      /**
+       * Takes the connection, and allocates its buffers: free slots don't hold them
+       * @return false if there isn't enough memory, the slot stays free then
+       * */
+      bool accept(const WiFiClient &other) {
+        buffer = (char *) malloc(__buffer_size + 1 + SERIAL2NET_OUTPUT_BUFFER_SIZE);
+        if (buffer == nullptr)
+          return false;
+        output = &buffer[__buffer_size + 1];
+        buffer[__buffer_size] = 0;
+
         WiFiClient::operator=(other);
         ignore = false;
         buffer_end = 0;
-        return *this;
+        output_end = 0;
+        subscriptions = params::defaultSubscriptions;
+        pluginsFiltered = false;
+        binary = false;
+        return true;
+      }
+
+      void release() {
+        ignore = true;
+        buffer_end = 0;
+        output_end = 0;
+        free(buffer);
+        buffer = nullptr;
+        output = nullptr;
+      }
+
+      bool wants(uint8_t messageClass, uint8_t pluginId) const {
+        if ((subscriptions & messageClass) == 0)
+          return false;
+        if (messageClass == Messages::Class_Decode && pluginsFiltered)
+          return plugins[pluginId >> 3] & (1 << (pluginId & 7));
+        return true;
+      }
+
+      void showSubscriptions() {
+        char classes[40];
+        Messages::classesToString(subscriptions, classes);
+        int length = snprintf_P(printBuf, sizeof(printBuf), PSTR("20;XX;DEBUG;SERIAL2NET;FORMAT=%s;SUBSCRIPTIONS=%s;PLUGINS="),
+                                binary ? "binary" : "text", classes);
+
+        if (!pluginsFiltered)
+          length += snprintf_P(&printBuf[length], sizeof(printBuf) - length, PSTR("all"));
+        for (int pluginId = 0; pluginsFiltered && pluginId < 256 && length < (int) sizeof(printBuf) - 8; pluginId++) {
+          if (plugins[pluginId >> 3] & (1 << (pluginId & 7)))
+            length += snprintf_P(&printBuf[length], sizeof(printBuf) - length, PSTR("%03i,"), pluginId);
+        }
+        if (pluginsFiltered && printBuf[length - 1] == ',')
+          length--;
+        length += snprintf_P(&printBuf[length], sizeof(printBuf) - length, PSTR(";\r\n"));
+        queue(printBuf, length);
+      }
+
+      /**
+       * Handles "10;serial2net;..." commands, which only change this client settings
+       * */
+      void executeLocalCommand(char *cmd) {
+        char *commaIndex = strchr(cmd, ';');
+        if (commaIndex == nullptr) {
+          queue_P(PSTR("Error : failed to find ending ';' for the command\r\n"));
+          return;
+        }
+
+        int commandSize = commaIndex - cmd;
+        char *arguments = commaIndex + 1;
+
+        if (strncasecmp_P(cmd, commands::subscribe, commandSize) == 0) {
+          uint8_t classes = Messages::parseClasses(arguments);
+          if (classes == 0xFF) {
+            queue_P(PSTR("Error : unknown message class, expected decode, reply, debug, pulses, all or none\r\n"));
+            return;
+          }
+          subscriptions = classes;
+        }
+        else if (strncasecmp_P(cmd, commands::plugins, commandSize) == 0) {
+          if (strncasecmp_P(arguments, PSTR("all"), 3) == 0)
+            pluginsFiltered = false;
+          else {
+            memset(plugins, 0, sizeof(plugins));
+            char *end;
+            for (char *ptr = arguments; *ptr != 0 && *ptr != ';'; ptr = end) {
+              unsigned long pluginId = strtoul(ptr, &end, 10);
+              if (end == ptr || pluginId > 255 || (*end != ',' && *end != ';' && *end != 0)) {
+                queue_P(PSTR("Error : expected a comma separated list of plugin numbers or 'all'\r\n"));
+                return;
+              }
+              plugins[pluginId >> 3] |= 1 << (pluginId & 7);
+              if (*end == ',')
+                end++;
+            }
+            pluginsFiltered = true;
+          }
+        }
+        else if (strncasecmp_P(cmd, commands::format, commandSize) == 0) {
+          if (strncasecmp_P(arguments, PSTR("binary"), 6) == 0)
+            binary = true;
+          else if (strncasecmp_P(arguments, PSTR("text"), 4) == 0)
+            binary = false;
+          else {
+            queue_P(PSTR("Error : expected 'binary' or 'text'\r\n"));
+            return;
+          }
+        }
+        else if (strncasecmp_P(cmd, commands::show, commandSize) != 0) {
+          queue_P(PSTR("Error : unknown serial2net command\r\n"));
+          return;
+        }
+        showSubscriptions();
+      }
+
+      /**
+       * Appends to the output buffer, which is sent at end of line, when SERIAL2NET_FLUSH_THRESHOLD is reached
+       * or SERIAL2NET_FLUSH_DELAY_MS after its first byte. A binary frame is a complete message by itself,
+       * it is sent right away whatever bytes it contains.
+       * */
+      void queue(const char *data, size_t length, bool fromFlash = false, bool isFrame = false) {
+        if (output == nullptr)
+          return;
+        while (length > SERIAL2NET_OUTPUT_BUFFER_SIZE) {
+          queue(data, SERIAL2NET_OUTPUT_BUFFER_SIZE, fromFlash);
+          data += SERIAL2NET_OUTPUT_BUFFER_SIZE;
+          length -= SERIAL2NET_OUTPUT_BUFFER_SIZE;
+        }
+        if (length == 0)
+          return;
+
+        if (output_end + length > SERIAL2NET_OUTPUT_BUFFER_SIZE)
+          flushOutput();
+        if (output_end + length > SERIAL2NET_OUTPUT_BUFFER_SIZE) { // client is not reading, don't let it hold the others
+          counters::droppedBytes += length;
+          return;
+        }
+
+        if (output_end == 0)
+          output_since = millis();
+        if (fromFlash)
+          memcpy_P(&output[output_end], data, length);
+        else
+          memcpy(&output[output_end], data, length);
+        output_end += length;
+
+        if (isFrame || output[output_end - 1] == '\n') {
+          counters::lines++;
+          flushOutput();
+        }
+        else if (output_end >= SERIAL2NET_FLUSH_THRESHOLD)
+          flushOutput();
+      }
+
+      void queue_P(PGM_P text) {
+        queue(text, strlen_P(text), true);
+      }
+
+      /**
+       * Sends as much of the output buffer as the TCP window accepts, the rest is kept for later
+       * */
+      void flushOutput() {
+        if (output_end == 0)
+          return;
+
+        size_t written = writeAvailable((const uint8_t *) output, output_end);
+        if (written > 0) {
+          counters::writes++;
+          counters::bytes += written;
+        }
+
+        if (written < output_end) {
+          counters::backpressure++;
+          memmove(output, &output[written], output_end - written);
+        }
+        output_end -= written;
+      }
+
+      bool outputIsDue() {
+        return output_end > 0 && millis() - output_since >= SERIAL2NET_FLUSH_DELAY_MS;
       }
 
       void enabledTcpKeepalive() {
@@ -52,7 +266,7 @@ namespace RFLink {
         setOption(TCP_KEEPCNT, &keepCount);
         #endif
 
-        println(F("This is RFLink32, welcome!"));
+        queue_P(PSTR("This is RFLink32, welcome!\r\n"));
       }
 
       /**
@@ -62,7 +276,7 @@ namespace RFLink {
         int newBytesCount = available();
 
         if (!connected()) { // some errors happened during read operations
-          ignore = true;
+          release();
           return false;
         }
 
@@ -88,7 +302,9 @@ namespace RFLink {
           }
           if (buffer_end >= __buffer_size) {
             buffer_end = 0;
-            printf(PSTR("Error: command is too long, max supported length is %u\r\n"), __buffer_size - 1);
+            char message[72];
+            queue(message, snprintf_P(message, sizeof(message), PSTR("Error: command is too long, max supported length is %u\r\n"),
+                                      __buffer_size - 1));
             return false;
           }
           readByte = timedRead();
@@ -106,32 +322,38 @@ namespace RFLink {
       }
 
       void disconnectAndClear() {
+        flushOutput();
         this->stop();
-        ignore = true;
-        buffer_end = 0;
+        release();
       }
     };
 
     namespace params {
       bool enabled = false;
       unsigned int port;
+      unsigned int maxClients = 2;
+      uint8_t defaultSubscriptions = MESSAGE_CLASS_ALL;
     }
 
     // All json variable names
     const char json_name_enabled[] = "enabled";
     const char json_name_port[] = "port";
+    const char json_name_max_clients[] = "max_clients";
+    const char json_name_default_subscriptions[] = "default_subscriptions";
 
     Config::ConfigItem configItems[] = {
             Config::ConfigItem(json_name_enabled, Config::SectionId::Serial2Net_id, false, paramsUpdatedCallback),
             Config::ConfigItem(json_name_port, Config::SectionId::Serial2Net_id, SERIAL2NET_PORT,
                                paramsUpdatedCallback),
+            Config::ConfigItem(json_name_max_clients, Config::SectionId::Serial2Net_id, 2, paramsUpdatedCallback),
+            Config::ConfigItem(json_name_default_subscriptions, Config::SectionId::Serial2Net_id, "all",
+                               paramsUpdatedCallback),
             Config::ConfigItem()};
 
     WiFiServer server(1900);
 
     boolean alreadyConnected = false;
-    const unsigned short clientsMax = 2;
-    Serial2NetClient clients[clientsMax];
+    Serial2NetClient clients[SERIAL2NET_MAX_CLIENTS];
 
     void paramsUpdatedCallback() {
       refreshParametersFromConfig();
@@ -153,6 +375,26 @@ namespace RFLink {
         params::port = item->getLongIntValue();
       }
 
+      item = Config::findConfigItem(json_name_max_clients, Config::SectionId::Serial2Net_id);
+      long int maxClients = item->getLongIntValue();
+      if (maxClients < 1 || maxClients > SERIAL2NET_MAX_CLIENTS) {
+        Serial.printf_P(PSTR("Serial2Net max_clients must be between 1 and %i, using %i\r\n"), SERIAL2NET_MAX_CLIENTS, SERIAL2NET_MAX_CLIENTS);
+        maxClients = SERIAL2NET_MAX_CLIENTS;
+      }
+      if ((unsigned int) maxClients != params::maxClients) {
+        changesDetected = true;
+        params::maxClients = maxClients;
+      }
+
+      // applies to clients connecting from now on
+      item = Config::findConfigItem(json_name_default_subscriptions, Config::SectionId::Serial2Net_id);
+      uint8_t subscriptions = Messages::parseClasses(item->getCharValue());
+      if (subscriptions == 0xFF) {
+        Serial.println(F("Invalid Serial2Net default_subscriptions, all messages will be sent"));
+        subscriptions = MESSAGE_CLASS_ALL;
+      }
+      params::defaultSubscriptions = subscriptions;
+
       if (triggerChanges && changesDetected) {
         Serial.println(F("Serial2Net parameters have changed."));
         if (params::enabled)
@@ -175,9 +417,11 @@ namespace RFLink {
      *
      * */
     bool registerClient(WiFiClient &newClient) {
-      for (auto &client : clients) {
+      for (unsigned int index = 0; index < params::maxClients; index++) {
+        auto &client = clients[index];
         if (client.ignore && !client.connected()) {
-          client = newClient;
+          if (!client.accept(newClient))
+            break;
           client.enabledTcpKeepalive();
           #if defined(RFLINK_SERIAL2NET_DEBUG) || defined(DEBUG)
           Serial.println(F("Client accepted"));
@@ -185,7 +429,7 @@ namespace RFLink {
           return true;
         }
       }
-      newClient.println(F("Too many clients connected, goodbye!"));
+      newClient.println(F("Too many clients connected or not enough memory, goodbye!"));
       newClient.stop();
       #if defined(RFLINK_SERIAL2NET_DEBUG) || defined(DEBUG)
       Serial.println("Client rejected due to lack of room");
@@ -203,10 +447,10 @@ namespace RFLink {
       String debugmsg;
 #endif
 
-      WiFiClient newClient = server.available();
+      if (server.hasClient()) {
+        WiFiClient newClient = server.available();
 
-      if (newClient.connected()) {
-        if (isNewClient(newClient)) {
+        if (newClient.connected() && isNewClient(newClient)) {
 #if defined(RFLINK_SERIAL2NET_DEBUG) || defined(DEBUG)
           Serial.printf(PSTR("Serial2Net: new client detected IP=%s port=%i\r\n"), newClient.remoteIP().toString().c_str(), newClient.remotePort());
 #endif
@@ -218,7 +462,15 @@ namespace RFLink {
       // Let's see if any client has sent some data
       for (auto & client : clients) {
         if (!client.ignore) {
+          if (client.outputIsDue())
+            client.flushOutput();
           if (client.hasCommandAvailable()) {
+            size_t prefixLength = strlen_P(commands::prefix);
+            if (strncasecmp_P(client.buffer, commands::prefix, prefixLength) == 0) {
+              client.executeLocalCommand(client.buffer + prefixLength);
+              client.consumeCommand();
+              continue;
+            }
             RFLink::sendRawPrint(F("\33[2K\r"));
             //Serial.flush();
             RFLink::sendRawPrint(F("Message arrived [Ser2Net]:"));
@@ -232,26 +484,55 @@ namespace RFLink {
       }
     }
 
+    bool hasBinaryClient() {
+      for (auto & client : clients) {
+        if (!client.ignore && client.binary)
+          return true;
+      }
+      return false;
+    }
+
+    void broadcastMessage(const Messages::Message &message) {
+      for (auto & client : clients) {
+        if (!client.ignore && client.wants(message.messageClass, message.pluginId) && client.connected()) {
+          if (!client.binary)
+            client.queue(message.text, message.length);
+          else if (message.frameLength > 0)
+            client.queue((const char *) message.frame, message.frameLength, false, true);
+        }
+      }
+    }
+
     void broadcastMessage(const char *msg) {
+      uint8_t messageClass = Messages::rawPrintClass();
+      size_t length = 0; // computed only if someone wants it
       for (auto & client : clients) {
-        if (!client.ignore && client.connected()) {
-          client.print(msg);
+        if (!client.ignore && !client.binary && client.wants(messageClass, 0) && client.connected()) {
+          if (length == 0)
+            length = strlen(msg);
+          client.queue(msg, length);
         }
       }
     }
 
     void broadcastMessage(const __FlashStringHelper *buf) {
+      PGM_P msg = reinterpret_cast<PGM_P>(buf);
+      uint8_t messageClass = Messages::rawPrintClass();
+      size_t length = 0;
       for (auto & client : clients) {
-        if (!client.ignore && client.connected()) {
-          client.print(buf);
+        if (!client.ignore && !client.binary && client.wants(messageClass, 0) && client.connected()) {
+          if (length == 0)
+            length = strlen_P(msg);
+          client.queue(msg, length, true);
         }
       }
     }
 
     void broadcastMessage(char c) {
+      uint8_t messageClass = Messages::rawPrintClass();
       for (auto & client : clients) {
-        if (!client.ignore && client.connected()) {
-          client.write(c);
+        if (!client.ignore && !client.binary && client.wants(messageClass, 0) && client.connected()) {
+          client.queue(&c, 1);
         }
       }
     }
@@ -260,7 +541,8 @@ namespace RFLink {
     void restartServer() {
       for (auto & client : clients) {
         if (!client.ignore && client.connected()) {
-          client.printf(PSTR("\nSerial2Net will restart on port %u\r\n"), params::port);
+          char message[48];
+          client.queue(message, snprintf_P(message, sizeof(message), PSTR("\nSerial2Net will restart on port %u\r\n"), params::port));
         }
       }
       stopServer(false);
@@ -275,9 +557,8 @@ namespace RFLink {
     void stopServer(bool show_message) {
       for (auto & client : clients) {
         if (!client.ignore && client.connected()) {
-          if (show_message) {
-            client.printf(PSTR("\nSerial2Net will now stop!\n"));
-          }
+          if (show_message)
+            client.queue_P(PSTR("\nSerial2Net will now stop!\n"));
           client.disconnectAndClear();
         }
       }
@@ -301,6 +582,14 @@ namespace RFLink {
         signal[F("status")] = F("disabled");
 
       signal[F("clients_count")] = countClient;
+      signal[F("max_clients")] = params::maxClients;
+      signal[F("writes")] = counters::writes;
+      signal[F("lines")] = counters::lines;
+      signal[F("bytes")] = counters::bytes;
+      signal[F("dropped_bytes")] = counters::droppedBytes;
+      signal[F("backpressure")] = counters::backpressure;
+      if (counters::lines > 0)
+        signal[F("writes_per_line")] = (float) counters::writes / counters::lines;
     }
 
   } // end Serial2Net namespace
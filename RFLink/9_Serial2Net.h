@@ -7,7 +7,24 @@
 #define SERIAL2NET_PORT 1900
 #endif
 
+// client output is sent in one write per line, or when this many bytes are pending, or after this delay
+#ifdef ESP32
+#define SERIAL2NET_OUTPUT_BUFFER_SIZE 1024
+#else
+#define SERIAL2NET_OUTPUT_BUFFER_SIZE 512
+#endif
+#define SERIAL2NET_FLUSH_THRESHOLD 256
+#define SERIAL2NET_FLUSH_DELAY_MS 20
+
+// size of the clients pool, how many of them are accepted is set by the max_clients config item
+#ifdef ESP32
+#define SERIAL2NET_MAX_CLIENTS 6
+#else
+#define SERIAL2NET_MAX_CLIENTS 3
+#endif
+
 #include "11_Config.h"
+#include "15_Messages.h"
 
 //#define RFLINK_SERIAL2NET_DEBUG
 
@@ -18,6 +35,17 @@ namespace RFLink {
         {
             extern bool enabled;
             extern unsigned int port;
+            extern unsigned int maxClients;
+            extern uint8_t defaultSubscriptions; // Messages::MessageClass flags given to new clients
+        }
+
+        namespace counters
+        {
+            extern unsigned long int writes;
+            extern unsigned long int lines;
+            extern unsigned long int bytes;
+            extern unsigned long int droppedBytes;
+            extern unsigned long int backpressure;
         }
 
         extern Config::ConfigItem configItems[];
@@ -32,12 +60,19 @@ namespace RFLink {
         void serverLoop();
 
         /**
-         * Send a message to all connected clients
+         * Send a queued message to all connected clients subscribed to its class (and plugin for decoded signals),
+         * as text or as a binary frame depending on each client format
+         * */
+        void broadcastMessage(const Messages::Message &message);
+        /**
+         * Send sendRawPrint() output, its class is given by Messages::rawPrintClass()
          * */
         void broadcastMessage(const char *msg);
         void broadcastMessage(const __FlashStringHelper *buf);
         void broadcastMessage(char c);
 
+        bool hasBinaryClient();
+
         void paramsUpdatedCallback();
         void refreshParametersFromConfig(bool triggerChanges=true);
 
@@ -216,25 +216,17 @@ boolean Plugin_001(byte function, const char *string)
       //display_Name(PSTR("DEBUG"));
       //display_Footer();
       // ----------------------------------
+      uint8_t previousClass = Messages::beginPulsesDump();
       RFLink::sendRawPrint(F("20;XX;DEBUG;Pulses=")); // debug data
       RFLink::sendRawPrint(RawSignal.Number);         // print number of pulses
-      RFLink::sendRawPrint(F(";Pulses(uSec)="));      // print pulse durations
-      // ----------------------------------
       char dbuffer[10];
 
-      for (i = 1; i < RawSignal.Number + 1; i++)
+      // pulse classes + packed symbols, as accepted by sendRF, pulses list when they do not fit in 16 classes
+      if (!Signal::runtime::compactDebug || !Signal::printCompactSignal(RawSignal))
       {
-         if (QRFDebug == true)
-         {
-            sprintf(dbuffer, "%02x", RawSignal.Pulses[i]);
-            RFLink::sendRawPrint(dbuffer);
-         }
-         else
-         {
-            RFLink::sendRawPrint(RawSignal.Pulses[i] * RawSignal.Multiply);
-            if (i < RawSignal.Number)
-               RFLink::sendRawPrint(',');
-         }
+         RFLink::sendRawPrint(F(";Pulses(uSec)="));      // print pulse durations
+         // ----------------------------------
+         RFLink::sendRawPrint(&RawSignal.Pulses[1], RawSignal.Number, RawSignal.Multiply, QRFDebug);
       }
       RFLink::sendRawPrint(F(";RSSI="));
       sprintf_P(dbuffer, PSTR("%i;"), (int)RawSignal.rssi);
@@ -257,6 +249,7 @@ boolean Plugin_001(byte function, const char *string)
       }
       RFLink::sendRawPrint(F(";\r\n"));
       #endif
+      Messages::setClass(previousClass);
 
 
       // ----------------------------------
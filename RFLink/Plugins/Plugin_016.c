@@ -5,6 +5,7 @@
 #ifdef PLUGIN_016
 #include "../4_Display.h"
 #include "../1_Radio.h"
+#include "../14_TX.h"
 #include "../7_Utils.h"
 
 #define PLUGIN_016_ID "Silvercrest"
@@ -204,10 +205,8 @@ boolean PluginTX_016(byte function, const char *string)
    for (byte repeatIndex = 0; repeatIndex < RepeatCount; repeatIndex++)
    {
       // Send preamble
-      digitalWrite(Radio::pins::TX_DATA, HIGH);
-      delayMicroseconds(PreambleHighTime);
-      digitalWrite(Radio::pins::TX_DATA, LOW);
-      delayMicroseconds(PreambleLowTime);
+      TX::sendPulse(HIGH, PreambleHighTime);
+      TX::sendPulse(LOW, PreambleLowTime);
 
       // Send bits
       int bitMask = 1 << (SLVCR_BitCount - 1);
@@ -221,13 +220,12 @@ boolean PluginTX_016(byte function, const char *string)
             LowTime = OneBitLowTime;
          }
 
-         digitalWrite(Radio::pins::TX_DATA, HIGH);
-         delayMicroseconds(HighTime);
-         digitalWrite(Radio::pins::TX_DATA, LOW);
-         delayMicroseconds(LowTime);
+         TX::sendPulse(HIGH, HighTime);
+         TX::sendPulse(LOW, LowTime);
 
          bitMask >>= 1;
       }
+      TX::endFrame();
    }
 
    return true;
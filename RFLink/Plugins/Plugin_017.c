@@ -6,6 +6,7 @@
 #ifdef PLUGIN_017
 #include "../4_Display.h"
 #include "../1_Radio.h"
+#include "../14_TX.h"
 #include "../7_Utils.h"
 #ifdef ESP8266
 #include <LittleFS.h>
@@ -312,17 +313,19 @@ const byte RTS_ConfigFileRecordCount = 32;
 void sendFrame(uint8_t* frame, bool isFirst);
 void saveRTSRecord(uint8_t eepromRecordNumber, uint32_t address, uint16_t rollingCode);
 
-boolean PluginTX_017(byte function, const char *string)
+// RAM copy of the storage file so sending a command does not have to scan flash, only the updated record is written back
+struct RTS_Record
 {
-    // Original RFLink has these commands
-    //10;RTSCLEAN; => Clean Rolling code table stored in internal EEPROM
-    //10;RTSRECCLEAN=9 => Clean Rolling code record number (value from 0 - 31)
-    //10;RTSSHOW; => Show Rolling code table stored in internal EEPROM (includes RTS settings)
-    //10;RTSINVERT; => Toggle RTS ON/OFF inversion
-    //10;RTSLONGTX; => Toggle RTS long transmit ON/OFF 
-    //10;RTS;1a602a;0;UP; => RTS protocol, address, unused, command
-    //10;RTS;1b602b;0123;PAIR; => Pairing for RTS rolling code: RTS protocol, address, rolling code number (hex), PAIR command (eeprom record number is set to 0)
-    //10;RTS;1b602b;0123;0;PAIR; => Extended Pairing for RTS rolling code: RTS protocol, address, rolling code number (hex), eeprom record number (hex), PAIR command    
+    uint32_t address;
+    uint16_t rollingCode;
+};
+RTS_Record RTS_Records[RTS_ConfigFileRecordCount];
+bool RTS_RecordsLoaded = false;
+
+bool loadRTSRecords()
+{
+    if (RTS_RecordsLoaded)
+        return true;
 
     // create default file if it does not exist
     if (!LittleFS.exists(RTS_ConfigFileName))
@@ -334,6 +337,50 @@ boolean PluginTX_017(byte function, const char *string)
         file.close();
     }
 
+    File file = LittleFS.open(RTS_ConfigFileName, "r");
+    for (int recordNumber = 0; recordNumber < RTS_ConfigFileRecordCount; recordNumber++)
+    {
+        uint32_t addressInFile = 0;
+        if (file.read((uint8_t*)&addressInFile, RTS_AddressSize) != RTS_AddressSize)
+        {
+            #ifdef PLUGIN_017_DEBUG
+            Serial.println(F(PLUGIN_017_ID ": Storage file too short for address!"));
+            #endif 
+            file.close();
+            return false;
+        }
+            
+        uint16_t codeInFile;
+        if (file.read((uint8_t*)&codeInFile, RTS_RollingCodeSize) != RTS_RollingCodeSize)
+        {
+            #ifdef PLUGIN_017_DEBUG
+            Serial.println(F(PLUGIN_017_ID ": Storage file too short for code!"));
+            #endif
+            file.close();
+            return false;
+        }
+
+        RTS_Records[recordNumber].address = addressInFile & 0xFFFFFF;
+        RTS_Records[recordNumber].rollingCode = codeInFile;
+    }
+    file.close();
+
+    RTS_RecordsLoaded = true;
+    return true;
+}
+
+boolean PluginTX_017(byte function, const char *string)
+{
+    // Original RFLink has these commands
+    //10;RTSCLEAN; => Clean Rolling code table stored in internal EEPROM
+    //10;RTSRECCLEAN=9 => Clean Rolling code record number (value from 0 - 31)
+    //10;RTSSHOW; => Show Rolling code table stored in internal EEPROM (includes RTS settings)
+    //10;RTSINVERT; => Toggle RTS ON/OFF inversion
+    //10;RTSLONGTX; => Toggle RTS long transmit ON/OFF 
+    //10;RTS;1a602a;0;UP; => RTS protocol, address, unused, command
+    //10;RTS;1b602b;0123;PAIR; => Pairing for RTS rolling code: RTS protocol, address, rolling code number (hex), PAIR command (eeprom record number is set to 0)
+    //10;RTS;1b602b;0123;0;PAIR; => Extended Pairing for RTS rolling code: RTS protocol, address, rolling code number (hex), eeprom record number (hex), PAIR command    
+
     retrieve_Init();
 
     if (!retrieve_Name("10"))
@@ -342,9 +389,14 @@ boolean PluginTX_017(byte function, const char *string)
     if (retrieve_Name("RTSCLEAN"))
     {
         LittleFS.remove(RTS_ConfigFileName);
+        RTS_RecordsLoaded = false;
         return true;
     }
-    else if (retrieve_hasPrefix("RTSRECCLEAN="))
+
+    if (!loadRTSRecords())
+        return false;
+
+    if (retrieve_hasPrefix("RTSRECCLEAN="))
     {
         unsigned long eepromRecordNumber;
         if (!retrieve_decimalNumber(eepromRecordNumber, 2))
@@ -358,31 +410,11 @@ boolean PluginTX_017(byte function, const char *string)
     }
     else if (retrieve_Name("RTSSHOW"))
     {
-        File file = LittleFS.open(RTS_ConfigFileName, "r");
         for (int recordNumber = 0; recordNumber < RTS_ConfigFileRecordCount; recordNumber++)
         {
-            uint32_t addressInFile;
-            if (file.read((uint8_t*)&addressInFile, RTS_AddressSize) != RTS_AddressSize)
-            {
-                #ifdef PLUGIN_017_DEBUG
-                Serial.println(F(PLUGIN_017_ID ": Storage file too short for address!"));
-                #endif 
-                return false;
-            }
-            
-            uint16_t codeInFile;
-            if (file.read((uint8_t*)&codeInFile, RTS_RollingCodeSize) != RTS_RollingCodeSize)
-            {
-                #ifdef PLUGIN_017_DEBUG
-                Serial.println(F(PLUGIN_017_ID ": Storage file too short for code!"));
-                #endif
-                return false;
-            }
-
-            sprintf(printBuf, PSTR("RTS Record: %d  Address: %06X  RC: %04X"), recordNumber, (addressInFile & 0xFFFFFF), codeInFile);
+            sprintf(printBuf, PSTR("RTS Record: %d  Address: %06X  RC: %04X"), recordNumber, RTS_Records[recordNumber].address, RTS_Records[recordNumber].rollingCode);
             sendRawPrint(printBuf, true);
         }
-        file.close();
         return true;
     }
     else if (retrieve_Name("RTSINVERT"))
@@ -420,30 +452,12 @@ boolean PluginTX_017(byte function, const char *string)
     // not pairing? retrieve the next code from the address by checking all records, along with the record number for future reuse
     if (command != VALUE_PAIR)
     {
-        File file = LittleFS.open(RTS_ConfigFileName, "r");
-
-        uint32_t addressInFile = 0xFFFFFFFF;
         for (int recordNumber = 0; recordNumber < RTS_ConfigFileRecordCount; recordNumber++)
         {
-            if (file.read((uint8_t*)&addressInFile, RTS_AddressSize) != RTS_AddressSize)
-            {
-                #ifdef PLUGIN_017_DEBUG
-                Serial.println(F(PLUGIN_017_ID ": Storage file too short for address!"));
-                #endif 
-                return false;
-            }
-            
-            if (file.read((uint8_t*)&code, sizeof(code)) != sizeof(code))
-            {
-                #ifdef PLUGIN_017_DEBUG
-                Serial.println(F(PLUGIN_017_ID ": Storage file too short for code!"));
-                #endif
-                return false;
-            }
-
-            if ((addressInFile & 0xFFFFFF) == address)
+            if (RTS_Records[recordNumber].address == address)
             {
                 eepromRecordNumber = recordNumber;
+                code = RTS_Records[recordNumber].rollingCode;
                 break;
             }
             else if (recordNumber == RTS_ConfigFileRecordCount - 1)
@@ -454,8 +468,6 @@ boolean PluginTX_017(byte function, const char *string)
                 return false;
             }
         }
-
-        file.close();
     }
 
     // map command to button value
@@ -536,6 +548,9 @@ boolean PluginTX_017(byte function, const char *string)
     for(uint8_t i = 1; i < RTS_ExpectedByteCount; i++) 
         frame[i] ^= frame[i-1];
 
+    // rolling code changes every time, this must never be replayed from the TX cache
+    TX::markVolatile();
+
     // send first occurence
     sendFrame(frame, true);
 
@@ -551,6 +566,9 @@ boolean PluginTX_017(byte function, const char *string)
 
 void saveRTSRecord(uint8_t eepromRecordNumber, uint32_t address, uint16_t rollingCode)
 {
+    RTS_Records[eepromRecordNumber].address = address & 0xFFFFFF;
+    RTS_Records[eepromRecordNumber].rollingCode = rollingCode;
+
     File file = LittleFS.open(RTS_ConfigFileName, "r+");
     file.seek(RTS_ConfigFileRecordSize * eepromRecordNumber, SeekSet);
     file.write((uint8_t*)&address, RTS_AddressSize);
@@ -560,7 +578,7 @@ void saveRTSRecord(uint8_t eepromRecordNumber, uint32_t address, uint16_t rollin
 
 void sendFrame(uint8_t* frame, bool isFirst)
 {
-    uint32_t originalFrequency = Radio::setFrequency(433420000);
+    uint32_t originalFrequency = TX::setFrequency(433420000);
     RawSignal.Multiply = 1;
 
     const int RTS_HalfBitPulseDuration = 640 / RawSignal.Multiply;
@@ -572,50 +590,40 @@ void sendFrame(uint8_t* frame, bool isFirst)
     // wake up pulse, only for first frame
     if (isFirst) 
     { 
-        digitalWrite(Radio::pins::TX_DATA, HIGH);
-        delayMicroseconds(RTS_WakeUpPulseDuration);
-        digitalWrite(Radio::pins::TX_DATA, LOW);
-        delayMicroseconds(RTS_WakeUpSilenceDuration);
+        TX::sendPulse(HIGH, RTS_WakeUpPulseDuration);
+        TX::sendPulse(LOW, RTS_WakeUpSilenceDuration);
     }
 
     // Hardware sync: two sync for the first frame, seven for the following ones.
     for (int i = 0; i < (isFirst ? 2 : 7) ; i++) {
-        digitalWrite(Radio::pins::TX_DATA, HIGH);
-        delayMicroseconds(4 * RTS_HalfBitPulseDuration);
-        digitalWrite(Radio::pins::TX_DATA, LOW);
-        delayMicroseconds(4 * RTS_HalfBitPulseDuration);
+        TX::sendPulse(HIGH, 4 * RTS_HalfBitPulseDuration);
+        TX::sendPulse(LOW, 4 * RTS_HalfBitPulseDuration);
     }
 
     // Software sync
-    digitalWrite(Radio::pins::TX_DATA, HIGH);
-    delayMicroseconds(RTS_SoftwareSyncPulseDuration);
-    digitalWrite(Radio::pins::TX_DATA, LOW);
-    delayMicroseconds(RTS_HalfBitPulseDuration);
+    TX::sendPulse(HIGH, RTS_SoftwareSyncPulseDuration);
+    TX::sendPulse(LOW, RTS_HalfBitPulseDuration);
 
     // Data: bits are sent one by one, starting with the MSB.
     for(byte i = 0; i < RTS_ExpectedBitCount; i++) 
     {
         if(((frame[i/8] >> (7 - (i%8))) & 1) == 1) 
         {
-            digitalWrite(Radio::pins::TX_DATA, LOW);
-            delayMicroseconds(RTS_HalfBitPulseDuration);
-            digitalWrite(Radio::pins::TX_DATA, HIGH);
-            delayMicroseconds(RTS_HalfBitPulseDuration);
+            TX::sendPulse(LOW, RTS_HalfBitPulseDuration);
+            TX::sendPulse(HIGH, RTS_HalfBitPulseDuration);
         }
         else 
         {
-            digitalWrite(Radio::pins::TX_DATA, HIGH);
-            delayMicroseconds(RTS_HalfBitPulseDuration);
-            digitalWrite(Radio::pins::TX_DATA, LOW);
-            delayMicroseconds(RTS_HalfBitPulseDuration);
+            TX::sendPulse(HIGH, RTS_HalfBitPulseDuration);
+            TX::sendPulse(LOW, RTS_HalfBitPulseDuration);
         }
     }
 
-    digitalWrite(Radio::pins::TX_DATA, LOW);
-    delayMicroseconds(RTS_InterframeSilenceDuration); // Inter-frame silence
+    TX::sendPulse(LOW, RTS_InterframeSilenceDuration); // Inter-frame silence
+    TX::endFrame();
 
     RawSignal.Multiply = RFLink::Signal::params::sample_rate; // restore setting
-    Radio::setFrequency(originalFrequency);
+    TX::setFrequency(originalFrequency);
 }
 
 #endif //PLUGIN_TX_017
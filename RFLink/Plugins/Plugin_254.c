@@ -27,8 +27,6 @@
 
 boolean Plugin_254(byte function, const char *string)
 {
-   int i;
-
    if ((RFUDebug == false) && (QRFUDebug == false)) // debug is on?
       return false;
 
@@ -42,27 +40,18 @@ boolean Plugin_254(byte function, const char *string)
    //display_Name(PSTR("DEBUG"));
    //display_Footer();
    // ----------------------------------
+   uint8_t previousClass = Messages::beginPulsesDump();
    RFLink::sendRawPrint(F("20;XX;DEBUG;Pulses=")); // debug data
    RFLink::sendRawPrint(RawSignal.Number);         // print number of pulses
-   RFLink::sendRawPrint(F(";Pulses(uSec)="));      // print pulse durations
-   // ----------------------------------
-   char dbuffer[3];
-
-   for (i = 1; i < RawSignal.Number + 1; i++)
+   // pulse classes + packed symbols, as accepted by sendRF, pulses list when they do not fit in 16 classes
+   if (!Signal::runtime::compactDebug || !Signal::printCompactSignal(RawSignal))
    {
-      if (QRFUDebug == true)
-      {
-         sprintf(dbuffer, "%02x", RawSignal.Pulses[i]);
-         RFLink::sendRawPrint(dbuffer);
-      }
-      else
-      {
-         RFLink::sendRawPrint(RawSignal.Pulses[i] * RawSignal.Multiply);
-         if (i < RawSignal.Number)
-            RFLink::sendRawPrint(',');
-      }
+      RFLink::sendRawPrint(F(";Pulses(uSec)="));      // print pulse durations
+      // ----------------------------------
+      RFLink::sendRawPrint(&RawSignal.Pulses[1], RawSignal.Number, RawSignal.Multiply, QRFUDebug);
    }
    RFLink::sendRawPrint(F(";\r\n"));
+   Messages::setClass(previousClass);
    // ----------------------------------
    RawSignal.Number = 0; // Last plugin, kill packet
    return true;          // stop processing
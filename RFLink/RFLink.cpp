@@ -31,6 +31,13 @@
 #include "11_Config.h"
 #include "12_Portal.h"
 #include "13_OTA.h"
+#include "14_TX.h"
+#include "15_Messages.h"
+#include "16_Binary.h"
+#include "17_Cache.h"
+#include "18_Outbox.h"
+#include "19_Events.h"
+#include "20_Metrics.h"
 
 #if (defined(__AVR_ATmega328P__) || defined(__AVR_ATmega2560__))
 #include <avr/power.h>
@@ -116,8 +123,9 @@ namespace RFLink {
       display_Footer();
 
 #ifdef SERIAL_ENABLED
-      Serial.print(pbuffer);
+      Serial.flush(); // let the boot banner go out so the splash message fits in the TX buffer
 #endif
+      Messages::drain(Messages::Sink_Serial); // other outputs are not set up yet
 #ifdef OLED_ENABLED
       splash_OLED();
 #endif
@@ -125,8 +133,13 @@ namespace RFLink {
 #if defined(ESP32) || (ESP8266)
       RFLink::Config::setup();
 #endif
+      RFLink::Metrics::setup();
       RFLink::Radio::setup();
       RFLink::Signal::setup();
+      RFLink::TX::setup();
+      RFLink::Messages::setup();
+      RFLink::Binary::setup();
+      RFLink::Cache::setup();
 
 #if defined(RFLINK_WIFI_ENABLED)
       RFLink::Wifi::setup();
@@ -135,6 +148,7 @@ namespace RFLink {
       #endif // RFLINK_PORTAL_DISABLED
       #ifndef RFLINK_MQTT_DISABLED
       RFLink::Mqtt::setup_MQTT();
+      RFLink::Outbox::setup();
       #endif // RFLINK_MQTT_DISABLED
       RFLink::Serial2Net::setup();
 #endif // RFLINK_WIFI_ENABLED
@@ -159,6 +173,7 @@ namespace RFLink {
 #endif
 
       pbuffer[0] = 0;
+      Messages::clear();
       Radio::set_Radio_mode(Radio::Radio_RX);
 
 
@@ -176,7 +191,11 @@ namespace RFLink {
       #ifndef RFLINK_MQTT_DISABLED
       RFLink::Mqtt::checkMQTTloop();
       #endif // RFLINK_MQTT_DISABLED
+      RFLink::TX::mainLoop(); // requests received by checkMQTTloop() leave in the same loop
       RFLink::sendMsgFromBuffer();
+#ifdef OLED_ENABLED
+      loop_OLED();
+#endif
 
 #if defined(RFLINK_WIFI_ENABLED)
       RFLink::Wifi::mainLoop();
@@ -203,34 +222,19 @@ namespace RFLink {
 
       Radio::mainLoop();
       OTA::mainLoop();
+      Metrics::mainLoop();
     }
 
     void sendMsgFromBuffer() {
-      if (pbuffer[0] != 0) {
-
-#ifdef SERIAL_ENABLED
-        Serial.print(pbuffer);
-#endif
-
-#ifndef RFLINK_MQTT_DISABLED
-        RFLink::Mqtt::publishMsg();
-#endif // !RFLINK_MQTT_DISABLED
-
-
-#ifndef RFLINK_SERIAL2NET_DISABLED
-        RFLink::Serial2Net::broadcastMessage(pbuffer);
-#endif // !RFLINK_SERIAL2NET_DISABLED
-
-#ifdef OLED_ENABLED
-        print_OLED();
-#endif
-
-        pbuffer[0] = 0;
-      }
+      // a message left without footer is still sent, as it used to be
+      Messages::commitBuffer();
+      // each output sends what it can without blocking, the rest is left for the next call
+      Messages::drain();
     }
 
     void sendRawPrint(const char *buf, bool end_of_line) {
       if (buf[0] != 0) {
+        Messages::catchUpRawSinks();
 
 #ifdef SERIAL_ENABLED
         Serial.print(buf);
@@ -246,58 +250,74 @@ namespace RFLink {
       }
     }
 
+    // Numbers are formatted in a stack buffer: String(n) would hit the heap for every pulse of a debug dump
     void sendRawPrint(long n)
     {
-#ifdef SERIAL_ENABLED
-      Serial.print(n);
-#endif
-#ifndef RFLINK_SERIAL2NET_DISABLED
-      RFLink::Serial2Net::broadcastMessage(String(n).c_str());
-#endif // !RFLINK_SERIAL2NET_DISABLED
+      char buffer[12];
+      ltoa(n, buffer, 10);
+      sendRawPrint(buffer);
     }
 
     void sendRawPrint(unsigned long n)
     {
-#ifdef SERIAL_ENABLED
-      Serial.print(n);
-#endif
-#ifndef RFLINK_SERIAL2NET_DISABLED
-      RFLink::Serial2Net::broadcastMessage(String(n).c_str());
-#endif // !RFLINK_SERIAL2NET_DISABLED
+      char buffer[12];
+      ultoa(n, buffer, 10);
+      sendRawPrint(buffer);
     }
 
     void sendRawPrint(int n)
     {
-#ifdef SERIAL_ENABLED
-      Serial.print(n);
-#endif
-#ifndef RFLINK_SERIAL2NET_DISABLED
-      RFLink::Serial2Net::broadcastMessage(String(n).c_str());
-#endif // !RFLINK_SERIAL2NET_DISABLED
+      sendRawPrint((long) n);
     }
 
     void sendRawPrint(unsigned int n)
     {
-#ifdef SERIAL_ENABLED
-      Serial.print(n);
-#endif
-#ifndef RFLINK_SERIAL2NET_DISABLED
-      RFLink::Serial2Net::broadcastMessage(String(n).c_str());
-#endif // !RFLINK_SERIAL2NET_DISABLED
+      sendRawPrint((unsigned long) n);
     }
 
-  void sendRawPrint(float f)
-  {
-#ifdef SERIAL_ENABLED
-    Serial.print(f);
-#endif
-#ifndef RFLINK_SERIAL2NET_DISABLED
-    RFLink::Serial2Net::broadcastMessage(String(f).c_str());
-#endif // !RFLINK_SERIAL2NET_DISABLED
-  }
+    void sendRawPrint(float f)
+    {
+      char buffer[48];
+      dtostrf(f, 1, 2, buffer); // same 2 decimals as Print::print(float)
+      sendRawPrint(buffer);
+    }
+
+    void sendRawPrint(const uint16_t *pulses, int count, uint16_t multiply, bool hexadecimal)
+    {
+      char chunk[128];
+      size_t length = 0;
+
+      for (int i = 0; i < count; i++)
+      {
+        if (length > sizeof(chunk) - 12) // room left for a separator, 10 digits and the null
+        {
+          chunk[length] = 0;
+          sendRawPrint(chunk);
+          length = 0;
+        }
+
+        if (hexadecimal)
+        {
+          if (pulses[i] < 0x10)
+            chunk[length++] = '0';
+          utoa(pulses[i], &chunk[length], 16);
+        }
+        else
+        {
+          if (i > 0)
+            chunk[length++] = ',';
+          ultoa((unsigned long) pulses[i] * multiply, &chunk[length], 10);
+        }
+        length += strlen(&chunk[length]);
+      }
+
+      chunk[length] = 0;
+      sendRawPrint(chunk);
+    }
 
     void sendRawPrint(char c)
     {
+      Messages::catchUpRawSinks();
 #ifdef SERIAL_ENABLED
       Serial.write(c);
 #endif
@@ -307,6 +327,7 @@ namespace RFLink {
     }
 
     void sendRawPrint(const __FlashStringHelper *buf, bool end_of_line){
+      Messages::catchUpRawSinks();
       #ifdef SERIAL_ENABLED
       Serial.print(buf);
       if(end_of_line)
@@ -319,11 +340,22 @@ namespace RFLink {
       #endif // !RFLINK_SERIAL2NET_DISABLED
     };
 
-    bool executeCliCommand(char *cmd) {
+    bool transmitCommand(const char *cmd) {
+      Radio::set_Radio_mode(Radio::Radio_TX);
+      bool success = TX::sendCommand(cmd);
+      Radio::set_Radio_mode(Radio::Radio_RX);
+      return success;
+    }
+
+    bool executeCliCommand(char *cmd, bool modulesAllowed) {
       static byte ValidCommand = 0;
+      uint8_t previousClass = Messages::setClass(Messages::Class_Reply);
 
       // Copy input command to InputBuffer_Serial, because many plugins are based on it !
-      memcpy(InputBuffer_Serial, cmd, INPUT_COMMAND_SIZE);
+      if (cmd != InputBuffer_Serial) {
+        strncpy(InputBuffer_Serial, cmd, INPUT_COMMAND_SIZE - 1);
+        InputBuffer_Serial[INPUT_COMMAND_SIZE - 1] = 0;
+      }
 
       if (strlen(cmd) > 7) { // need to see minimal 8 characters on the serial port
         // 10;....;..;ON;
@@ -404,22 +436,35 @@ namespace RFLink {
             display_Header();
             display_Splash();
             display_Footer();
+          } else if (!modulesAllowed && strncasecmp(cmd + 3, "tx;batch;", 9) != 0) {
+            ValidCommand = transmitCommand(cmd) ? 1 : 2;
           } else if (strncasecmp(cmd + 3, "signal", 6) == 0) {
             Signal::executeCliCommand(cmd + 3 + 6 + 1);
           } else if (strncasecmp(cmd + 3, "config", 6) == 0) {
             Config::executeCliCommand(cmd + 3 + 6 + 1);
+          } else if (strncasecmp(cmd + 3, "tx;", 3) == 0) {
+            TX::executeCliCommand(cmd + 3 + 3);
+          } else if (strncasecmp(cmd + 3, "messages;", 9) == 0) {
+            Messages::executeCliCommand(cmd + 3 + 9);
+          } else if (strncasecmp(cmd + 3, "cache;", 6) == 0) {
+            Cache::executeCliCommand(cmd + 3 + 6);
+          } else if (strncasecmp(cmd + 3, "metrics;", 8) == 0) {
+            Metrics::executeCliCommand(cmd + 3 + 8);
+#ifndef RFLINK_MQTT_DISABLED
+          } else if (strncasecmp(cmd + 3, "mqtt;", 5) == 0) {
+            Mqtt::executeCliCommand(cmd + 3 + 5);
+          } else if (strncasecmp(cmd + 3, "outbox;", 7) == 0) {
+            Outbox::executeCliCommand(cmd + 3 + 7);
+#endif // RFLINK_MQTT_DISABLED
+#ifndef RFLINK_PORTAL_DISABLED
+          } else if (strncasecmp(cmd + 3, "events;", 7) == 0) {
+            Events::executeCliCommand(cmd + 3 + 7);
+#endif // RFLINK_PORTAL_DISABLED
           } else {
             // -------------------------------------------------------
             // Handle Generic Commands / Translate protocol data into Nodo text commands
             // -------------------------------------------------------
-            Radio::set_Radio_mode(Radio::Radio_TX);
-
-            if (PluginTXCall(0, cmd))
-              ValidCommand = 1;
-            else // Answer that an invalid command was received?
-              ValidCommand = 2;
-
-            Radio::set_Radio_mode(Radio::Radio_RX);
+            ValidCommand = transmitCommand(cmd) ? 1 : 2; // 2 answers that an invalid command was received
           }
         }
       } // if > 7
@@ -433,6 +478,7 @@ namespace RFLink {
       }
       ValidCommand = 0;
       sendMsgFromBuffer(); // in case there is a response waiting to be sent
+      Messages::setClass(previousClass);
       return true;
     }
 
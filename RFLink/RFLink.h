@@ -55,7 +55,7 @@
 #ifndef RFLink_default_MQTT_SSL_ENABLED
   #define RFLink_default_MQTT_SSL_ENABLED false // Send MQTT messages over SSL
 #endif
-#define MQTT_LOOP_MS 1000     // MQTTClient.loop(); call period (in mSec)
+#define MQTT_LOOP_MS 1000     // keepalive and connection check period (in mSec), inbound commands do not wait for it
 #define MQTT_RETAINED_0 false // Retained option
 #ifndef RFLink_default_MQTT_LWT              // Let know if Module is Online or Offline via MQTT Last Will message
   #define RFLink_default_MQTT_LWT true
@@ -85,7 +85,11 @@ namespace RFLink {
     void setup();
     void mainLoop();
 
-    bool executeCliCommand(char *cmd);
+    /**
+     * @param modulesAllowed false for sources which may only run device commands (ping, reboot, debug toggles,
+     * version), protocol TX commands and TX batches: module commands (config, signal ...) go to the plugins then
+     * */
+    bool executeCliCommand(char *cmd, bool modulesAllowed=true);
     void sendMsgFromBuffer();
     void sendRawPrint(const char *buf, bool end_of_line=false);
     void sendRawPrint(const __FlashStringHelper *buf, bool end_of_line=false) ;
@@ -95,6 +99,8 @@ namespace RFLink {
     void sendRawPrint(unsigned int n);
     void sendRawPrint(float f);
     void sendRawPrint(char c);
+    // prints count pulses, multiplied and comma separated, or as concatenated 2 digits hex values (QRFDEBUG)
+    void sendRawPrint(const uint16_t *pulses, int count, uint16_t multiply=1, bool hexadecimal=false);
     inline void sendRawPrintln() {sendRawPrint(F("\r\n"));};
     //static void sendRawPrintf(const char *format, va_list args);
     //#define broadcastMessage_P(format, ...) sendRawPrintf(format, __VA_ARGS__)
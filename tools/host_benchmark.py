@@ -0,0 +1,545 @@
+# Host benchmarks of firmware code paths, compiled from the sources in RFLink/ with the host C++ compiler
+#
+#   python3 host_benchmark.py signal-json                 parse time and peak heap of a 1200 pulses sendRF json
+#   python3 host_benchmark.py signal-json --pulses 292    same with the ESP8266 receive buffer size
+#   python3 host_benchmark.py display                     cost of a decoded message built by the 4_Display helpers,
+#                                                         after checking them against the sprintf_P + strcat formats
+#
+# The code under test is cut out of the firmware sources (RFLink next to this script, or --sources) and built with a few
+# stubs of the Arduino API, so the numbers are those of the current tree. Times are host times: compare them with each
+# other, not with an ESP. Heap is counted on every malloc/calloc/realloc/new made by the code under test.
+
+import argparse
+import os
+import re
+import subprocess
+import sys
+import tempfile
+
+HARNESS = r"""
+#include <cctype>
+#include <chrono>
+#include <cstdarg>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+typedef uint8_t byte;
+#define PSTR(s) (s)
+#define F(s) (s)
+#define strcmp_P strcmp
+
+// heap used by the code under test: live bytes, peak and number of allocations
+static size_t heapLive = 0, heapPeak = 0, heapCalls = 0;
+static const size_t heapHeader = sizeof(std::max_align_t);
+
+static void *countedMalloc(size_t size)
+{
+  char *block = (char *) std::malloc(size + heapHeader);
+  if (block == nullptr)
+    return nullptr;
+  *(size_t *) block = size;
+  heapCalls++;
+  heapLive += size;
+  if (heapLive > heapPeak)
+    heapPeak = heapLive;
+  return block + heapHeader;
+}
+
+static void countedFree(void *pointer)
+{
+  if (pointer == nullptr)
+    return;
+  char *block = (char *) pointer - heapHeader;
+  heapLive -= *(size_t *) block;
+  std::free(block);
+}
+
+static void *countedCalloc(size_t count, size_t size)
+{
+  void *pointer = countedMalloc(count * size);
+  if (pointer != nullptr)
+    memset(pointer, 0, count * size);
+  return pointer;
+}
+
+static void *countedRealloc(void *pointer, size_t size)
+{
+  void *moved = countedMalloc(size);
+  if (moved != nullptr && pointer != nullptr) {
+    size_t old = *(size_t *) ((char *) pointer - heapHeader);
+    memcpy(moved, pointer, old < size ? old : size);
+  }
+  countedFree(pointer);
+  return moved;
+}
+
+void *operator new(size_t size) { return countedMalloc(size); }
+void *operator new[](size_t size) { return countedMalloc(size); }
+void operator delete(void *pointer) noexcept { countedFree(pointer); }
+void operator delete[](void *pointer) noexcept { countedFree(pointer); }
+void operator delete(void *pointer, size_t) noexcept { countedFree(pointer); }
+void operator delete[](void *pointer, size_t) noexcept { countedFree(pointer); }
+
+#define malloc countedMalloc
+#define calloc countedCalloc
+#define realloc countedRealloc
+#define free countedFree
+
+// messages of the code under test are kept, the last one is shown when a check fails
+struct SerialStub
+{
+  char last[256] = "";
+  void printf_P(const char *format, ...)
+  {
+    va_list arguments;
+    va_start(arguments, format);
+    vsnprintf(last, sizeof(last), format, arguments);
+    va_end(arguments);
+  }
+  void println(const char *text) { snprintf(last, sizeof(last), "%s\r\n", text); }
+} Serial;
+
+static uint64_t nowNs()
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+"""
+
+SIGNAL_JSON = r"""
+#define RAW_BUFFER_SIZE %(buffer)d
+
+namespace RFLink {
+  namespace Signal {
+    namespace params {
+      unsigned short int sample_rate = 1;
+    }
+
+    struct RawSignalStruct
+    {
+      int Number;
+      byte Repeats;
+      byte Delay;
+      byte Multiply;
+      unsigned long Time;
+      unsigned short int Pulses[RAW_BUFFER_SIZE + 2];
+    };
+
+%(code)s
+  }
+}
+
+using namespace RFLink::Signal;
+
+static RawSignalStruct signal;
+
+int main()
+{
+  const int pulses = %(pulses)d, runs = %(runs)d;
+  static unsigned short int expected[pulses + 1];
+  static char json[64 + pulses * 6];
+
+  // a realistic signal: long sync, then short/long marks and spaces
+  int length = sprintf(json, "{\"repeat\":3,\"delay\":10,\"pulses\":[");
+  unsigned int seed = 1;
+  for (int i = 1; i <= pulses; i++) {
+    seed = seed * 1103515245 + 12345;
+    expected[i] = i == pulses ? 6020 : ((seed >> 16) & 1) ? 1180 + (seed >> 20) %% 40 : 390 + (seed >> 20) %% 30;
+    length += sprintf(&json[length], i == 1 ? "%%u" : ",%%u", expected[i]);
+  }
+  length += sprintf(&json[length], "]}");
+
+  heapLive = heapPeak = heapCalls = 0;
+  if (!getSignalFromJson(signal, json) || signal.Number != pulses || signal.Repeats != 3 || signal.Delay != 10 ||
+      memcmp(&signal.Pulses[1], &expected[1], pulses * sizeof(expected[0])) != 0) {
+    printf("FAILED: %%d pulses read, %%s", signal.Number, Serial.last);
+    return 1;
+  }
+
+  uint64_t best = UINT64_MAX, total = 0;
+  for (int run = 0; run < runs; run++) {
+    uint64_t start = nowNs();
+    getSignalFromJson(signal, json);
+    uint64_t elapsed = nowNs() - start;
+    total += elapsed;
+    if (elapsed < best)
+      best = elapsed;
+  }
+
+  printf("json            %%d bytes, %%d pulses\n", length, pulses);
+  printf("parse           %%.1f us best, %%.1f us mean over %%d runs (%%.1f ns per pulse)\n",
+         best / 1000.0, total / 1000.0 / runs, runs, (double) best / pulses);
+  printf("heap            %%zu bytes peak, %%zu allocations\n", heapPeak, heapCalls);
+  printf("before in-place %%d bytes for the DynamicJsonDocument (strlen * 6)\n", length * 6);
+  return 0;
+}
+"""
+
+
+DISPLAY = r"""
+#if defined(__x86_64__) || defined(__i386__)
+#define COUNTER "cycles"
+static uint64_t counter() { return __rdtsc(); }
+#else
+#define COUNTER "ns"
+static uint64_t counter() { return nowNs(); }
+#endif
+
+typedef bool boolean;
+typedef const char *PGM_P;
+#define PROGMEM
+#define pgm_read_byte(p) (*(const uint8_t *) (p))
+#define PRINT_BUFFER_SIZE @BUFFER@
+#define BUILDNR 0x07
+#define REVNR 0x00
+#define RFLINK_BUILDNAME "benchmark"
+
+@ENUMS@
+
+// the binary frame is not part of this benchmark
+namespace RFLink {
+  namespace Binary {
+    @TAGS@;
+    void beginEvent(uint8_t) {}
+    void addNumber(uint8_t, unsigned long, uint8_t = 1) {}
+    void addText(uint8_t, const char *, bool) {}
+    void addName(const char *) {}
+    void endEvent(uint8_t, float, uint8_t) {}
+  }
+  namespace Signal {
+    struct { float rssi; } RawSignal;
+  }
+  namespace Messages {
+    enum { Class_Decode = 1 };
+    namespace runtime {
+      uint8_t currentClass = Class_Decode, currentPlugin = 0;
+    }
+    bool commitBuffer();
+  }
+}
+namespace Binary = RFLink::Binary;
+
+byte PKSequenceNumber = 0;
+char pbuffer[PRINT_BUFFER_SIZE];
+char committed[PRINT_BUFFER_SIZE];
+
+bool RFLink::Messages::commitBuffer()
+{
+  strcpy(committed, pbuffer);
+  pbuffer[0] = 0;
+  return true;
+}
+
+@CODE@
+
+// the sprintf_P + strcat formatting replaced by the append cursor, with the formats it used
+namespace before {
+  char dbuffer[60];
+  char pbuffer[PRINT_BUFFER_SIZE];
+  char committed[PRINT_BUFFER_SIZE];
+  byte PKSequenceNumber = 0;
+
+  void field(const char *format, const char *label, unsigned int input) { sprintf(dbuffer, format, label, input); strcat(pbuffer, dbuffer); }
+  void fieldLong(const char *format, const char *label, unsigned long input) { sprintf(dbuffer, format, label, input); strcat(pbuffer, dbuffer); }
+  void text(const char *input) { strcat(pbuffer, input); }
+
+  void display_Header(void) { field("%s%02X", "20;", PKSequenceNumber++); }
+  void display_Name(const char *input) { sprintf(dbuffer, ";%s", input); strcat(pbuffer, dbuffer); }
+  void display_Footer(void) { text(";\r\n"); strcpy(committed, pbuffer); pbuffer[0] = 0; }
+  void display_IDn(unsigned long input, byte n)
+  {
+    switch (n) {
+      case 2: fieldLong("%s%02lx", ";ID=", input); break;
+      case 4: fieldLong("%s%04lx", ";ID=", input); break;
+      case 6: fieldLong("%s%06lx", ";ID=", input); break;
+      default: fieldLong("%s%08lx", ";ID=", input);
+    }
+  }
+  void display_IDc(const char *input) { text(";ID="); text(input); }
+  void display_SWITCH(byte input) { field("%s%02x", ";SWITCH=", input); }
+  void display_SWITCHc(const char *input) { text(";SWITCH="); text(input); }
+  void display_CMD(boolean all, byte on)
+  {
+    static const char *const names[] = {"OFF", "ON", "BRIGHT", "DIM", "UNKNOWN", "UP", "DOWN", "STOP", "PAIR"};
+    text(";CMD=");
+    if (all == CMD_All)
+      text("ALL");
+    text(on <= CMD_Pair ? names[on] : "UNKNOWN");
+  }
+  void display_SET_LEVEL(byte input) { field("%s%02d", ";SET_LEVEL=", input); }
+  void display_TEMP(unsigned int input) { field("%s%04x", ";TEMP=", input); }
+  void display_HUM(byte input) { field("%s%02d", ";HUM=", input); }
+  void display_BARO(unsigned int input) { field("%s%04x", ";BARO=", input); }
+  void display_HSTATUS(byte input) { field("%s%02x", ";HSTATUS=", input); }
+  void display_BFORECAST(byte input) { field("%s%02x", ";BFORECAST=", input); }
+  void display_UV(unsigned int input) { field("%s%04x", ";UV=", input); }
+  void display_LUX(unsigned int input) { field("%s%04x", ";LUX=", input); }
+  void display_BAT(boolean input) { text(input ? ";BAT=OK" : ";BAT=LOW"); }
+  void display_RAIN(unsigned int input) { field("%s%04x", ";RAIN=", input); }
+  void display_RAINRATE(unsigned int input) { field("%s%04x", ";RAINRATE=", input); }
+  void display_WINSP(unsigned int input) { field("%s%04x", ";WINSP=", input); }
+  void display_AWINSP(unsigned int input) { field("%s%04x", ";AWINSP=", input); }
+  void display_WINGS(unsigned int input) { field("%s%04x", ";WINGS=", input); }
+  void display_WINDIR(unsigned int input) { field("%s%03d", ";WINDIR=", input); }
+  void display_WINCHL(unsigned int input) { field("%s%04x", ";WINCHL=", input); }
+  void display_WINTMP(unsigned int input) { field("%s%04x", ";WINTMP=", input); }
+  void display_CHIME(unsigned int input) { field("%s%03d", ";CHIME=", input); }
+  void display_SMOKEALERT(boolean input) { text(input == SMOKE_On ? ";SMOKEALERT=ON" : ";SMOKEALERT=OFF"); }
+  void display_PIR(boolean input) { text(input == PIR_On ? ";PIR=ON" : ";PIR=OFF"); }
+  void display_CO2(unsigned int input) { field("%s%04d", ";CO2=", input); }
+  void display_SOUND(unsigned int input) { field("%s%04d", ";SOUND=", input); }
+  void display_KWATT(unsigned int input) { field("%s%04x", ";KWATT=", input); }
+  void display_WATT(unsigned int input) { field("%s%04x", ";WATT=", input); }
+  void display_CURRENT(unsigned int input) { field("%s%04d", ";CURRENT=", input); }
+  void display_DIST(unsigned int input) { field("%s%04d", ";DIST=", input); }
+  void display_METER(unsigned int input) { field("%s%04d", ";METER=", input); }
+  void display_VOLT(unsigned int input) { field("%s%04d", ";VOLT=", input); }
+  void display_RGBW(unsigned int input) { field("%s%04x", ";RGBW=", input); }
+  void display_CHAN(byte channel) { field("%s%04x", ";CHN=", channel); }
+}
+
+static const char *const names[] = {"LaCrosse-TX141THBv2", "Oregon", "X10", "Kaku"};
+static const char *const texts[] = {"A1", "P16", "1a2b3c", ""};
+
+// one random field, the same calls for both implementations (unqualified names resolve in the enclosing namespace)
+// %d formats printed values from 2^31 up as negative numbers, decimal fields are checked below that
+#define RANDOM_FIELD(pick, value)                                                              \
+  switch ((pick) % 36) {                                                                       \
+    case 0: display_IDn(value, 2 + 2 * ((pick) / 36 % 4)); break;                              \
+    case 1: display_IDc(texts[(pick) / 36 % 4]); break;                                        \
+    case 2: display_SWITCH(value); break;                                                      \
+    case 3: display_SWITCHc(texts[(pick) / 36 % 4]); break;                                    \
+    case 4: display_CMD((pick) / 36 % 2, (pick) / 72 % 10); break;                             \
+    case 5: display_SET_LEVEL(value); break;                                                   \
+    case 6: display_TEMP(value); break;                                                        \
+    case 7: display_HUM(value); break;                                                         \
+    case 8: display_BARO(value); break;                                                        \
+    case 9: display_HSTATUS(value); break;                                                     \
+    case 10: display_BFORECAST(value); break;                                                  \
+    case 11: display_UV(value); break;                                                         \
+    case 12: display_LUX(value); break;                                                        \
+    case 13: display_BAT((pick) / 36 % 2); break;                                              \
+    case 14: display_RAIN(value); break;                                                       \
+    case 15: display_RAINRATE(value); break;                                                   \
+    case 16: display_WINSP(value); break;                                                      \
+    case 17: display_AWINSP(value); break;                                                     \
+    case 18: display_WINGS(value); break;                                                      \
+    case 19: display_WINDIR(value & 0x7FFFFFFF); break;                                        \
+    case 20: display_WINCHL(value); break;                                                     \
+    case 21: display_WINTMP(value); break;                                                     \
+    case 22: display_CHIME(value & 0x7FFFFFFF); break;                                         \
+    case 23: display_SMOKEALERT((pick) / 36 % 2); break;                                       \
+    case 24: display_PIR((pick) / 36 % 2); break;                                              \
+    case 25: display_CO2(value & 0x7FFFFFFF); break;                                           \
+    case 26: display_SOUND(value & 0x7FFFFFFF); break;                                         \
+    case 27: display_KWATT(value); break;                                                      \
+    case 28: display_WATT(value); break;                                                       \
+    case 29: display_CURRENT(value & 0x7FFFFFFF); break;                                       \
+    case 30: display_DIST(value & 0x7FFFFFFF); break;                                          \
+    case 31: display_METER(value & 0x7FFFFFFF); break;                                         \
+    case 32: display_VOLT(value & 0x7FFFFFFF); break;                                          \
+    case 33: display_RGBW(value); break;                                                       \
+    case 34: display_CHAN(value); break;                                                       \
+    default: display_IDn(value, 8); break;                                                     \
+  }
+
+// a typical decoded signal: 10 calls, 20;XX;LaCrosse-TX141THBv2;ID=1a2b;SWITCH=01;CMD=ON;TEMP=00e1;HUM=45;BAT=OK;...
+#define TYPICAL_MESSAGE(value)                  \
+  display_Header();                             \
+  display_Name(names[0]);                       \
+  display_IDn(0x1a2b + ((value) & 0xFF), 4);    \
+  display_SWITCH(1);                            \
+  display_CMD(false, (byte) CMD_On);            \
+  display_TEMP(0x00e1 + ((value) & 0x3F));      \
+  display_HUM(45 + ((value) & 0x1F));           \
+  display_BAT(true);                            \
+  display_CHAN(3);                              \
+  display_Footer();
+
+static unsigned int seed = 1;
+static unsigned int random32()
+{
+  seed = seed * 1103515245 + 12345;
+  unsigned int high = seed >> 16;
+  seed = seed * 1103515245 + 12345;
+  return high << 16 | seed >> 16;
+}
+
+// small values most of the time, like sensors send, full range otherwise
+static unsigned int randomValue()
+{
+  unsigned int value = random32();
+  switch (random32() % 4) {
+    case 0: return value & 0xFF;
+    case 1: return value & 0xFFFF;
+    case 2: return value % 100;
+    default: return value;
+  }
+}
+
+namespace before {
+  void randomMessage(const unsigned int *picks, const unsigned int *values, int fields)
+  {
+    display_Header();
+    display_Name(names[picks[0] % 4]);
+    for (int i = 0; i < fields; i++)
+      RANDOM_FIELD(picks[i], values[i])
+    display_Footer();
+  }
+  void typicalMessage(unsigned int value) { TYPICAL_MESSAGE(value) }
+}
+
+void randomMessage(const unsigned int *picks, const unsigned int *values, int fields)
+{
+  display_Header();
+  display_Name(names[picks[0] % 4]);
+  for (int i = 0; i < fields; i++)
+    RANDOM_FIELD(picks[i], values[i])
+  display_Footer();
+}
+void typicalMessage(unsigned int value) { TYPICAL_MESSAGE(value) }
+
+int main()
+{
+  const int messages = @MESSAGES@, runs = @RUNS@;
+
+  // at most 5 fields keep the old code (strcat without bound) within PRINT_BUFFER_SIZE
+  for (int message = 0; message < messages; message++) {
+    unsigned int picks[5], values[5];
+    int fields = random32() % 6;
+    for (int i = 0; i < fields; i++) {
+      picks[i] = random32();
+      values[i] = randomValue();
+    }
+    before::randomMessage(picks, values, fields);
+    randomMessage(picks, values, fields);
+    if (strcmp(before::committed, committed) != 0) {
+      printf("FAILED on message %d\n  before: %s  now:    %s", message, before::committed, committed);
+      return 1;
+    }
+  }
+  printf("check           %d random messages byte-identical to the sprintf_P + strcat formats\n", messages);
+
+  uint64_t bestBefore = UINT64_MAX, bestNow = UINT64_MAX, totalBefore = 0, totalNow = 0;
+  for (int run = 0; run < runs; run++) {
+    uint64_t start = counter();
+    before::typicalMessage(run);
+    uint64_t elapsed = counter() - start;
+    totalBefore += elapsed;
+    if (elapsed < bestBefore)
+      bestBefore = elapsed;
+
+    start = counter();
+    typicalMessage(run);
+    elapsed = counter() - start;
+    totalNow += elapsed;
+    if (elapsed < bestNow)
+      bestNow = elapsed;
+  }
+  if (strcmp(before::committed, committed) != 0) {
+    printf("FAILED on the typical message\n  before: %s  now:    %s", before::committed, committed);
+    return 1;
+  }
+
+  printf("message         %zu bytes, 10 display_* calls: %.*s\n", strlen(committed), (int) strlen(committed) - 2, committed);
+  printf("sprintf+strcat  %llu %s best, %.0f mean over %d runs\n", (unsigned long long) bestBefore, COUNTER,
+         (double) totalBefore / runs, runs);
+  printf("append cursor   %llu %s best, %.0f mean over %d runs\n", (unsigned long long) bestNow, COUNTER,
+         (double) totalNow / runs, runs);
+  return 0;
+}
+"""
+
+
+def skip_literal(text, i):
+    quote = text[i]
+    i += 1
+    while text[i] != quote:
+        i += 2 if text[i] == "\\" else 1
+    return i + 1
+
+
+def block_end(text, i):
+    """index after the block opened by the first { found from i, strings, chars and comments skipped"""
+    depth = 0
+    while i < len(text):
+        if text.startswith("//", i):
+            i = text.index("\n", i)
+        elif text.startswith("/*", i):
+            i = text.index("*/", i) + 2
+        elif text[i] in "\"'":
+            i = skip_literal(text, i)
+        else:
+            if text[i] == "{":
+                depth += 1
+            elif text[i] == "}":
+                depth -= 1
+                if depth == 0:
+                    return i + 1
+            i += 1
+    raise ValueError("unbalanced block")
+
+
+def cut(path, first, last):
+    """source from the line holding first to the end of the block opened after last"""
+    with open(path, encoding="utf-8", errors="replace") as source:
+        text = source.read()
+    start = text.find(first)
+    end = text.find(last, start)
+    if start < 0 or end < 0:
+        sys.exit("%s: '%s' ... '%s' not found, this benchmark needs updating" % (path, first, last))
+    start = text.rfind("\n", 0, start) + 1
+    return text[start:block_end(text, end)]
+
+
+def run(program, options):
+    with tempfile.TemporaryDirectory() as directory:
+        source = os.path.join(directory, "benchmark.cpp")
+        binary = os.path.join(directory, "benchmark")
+        with open(source, "w") as output:
+            output.write(HARNESS + program)
+        build = subprocess.run([options.cxx, "-std=c++11", "-O2", "-w", "-o", binary, source])
+        if build.returncode != 0:
+            sys.exit("build failed (%s)" % options.cxx)
+        return subprocess.run([binary]).returncode
+
+
+def signal_json(options):
+    code = cut(os.path.join(options.sources, "2_Signal.cpp"), "class JsonSignalReader", "bool getSignalFromJson(")
+    return run(SIGNAL_JSON % {"code": code, "pulses": options.pulses, "runs": options.runs or 2000,
+                              "buffer": max(options.pulses, 1200)}, options)
+
+
+def display(options):
+    header = os.path.join(options.sources, "4_Display.h")
+    with open(header, encoding="utf-8", errors="replace") as source:
+        buffer = re.search(r"#define PRINT_BUFFER_SIZE (\d+)", source.read()).group(1)
+    code = cut(os.path.join(options.sources, "4_Display.cpp"), "static size_t pbufferLength", "void display_CHAN(")
+    program = DISPLAY.replace("@CODE@", code).replace("@BUFFER@", buffer)
+    program = program.replace("@ENUMS@", cut(header, "void display_Append(const char *);", "enum PIR_OnOff") + ";")
+    program = program.replace("@TAGS@", cut(os.path.join(options.sources, "16_Binary.h"), "enum Tag {", "enum Tag {"))
+    program = program.replace("@MESSAGES@", str(options.messages)).replace("@RUNS@", str(options.runs or 100000))
+    return run(program, options)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="host benchmarks of RFLink firmware code paths")
+    parser.add_argument("benchmark", choices=["signal-json", "display"])
+    parser.add_argument("--sources", default=os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "RFLink"),
+                        help="firmware sources directory")
+    parser.add_argument("--cxx", default=os.environ.get("CXX", "c++"), help="host C++ compiler")
+    parser.add_argument("--runs", type=int, help="timed runs (signal-json: 2000, display: 100000)")
+    parser.add_argument("--pulses", type=int, default=1200, help="signal-json: pulses in the signal")
+    parser.add_argument("--messages", type=int, default=40000, help="display: random messages compared")
+    options = parser.parse_args()
+    sys.exit(signal_json(options) if options.benchmark == "signal-json" else display(options))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,197 @@
+# Minimal MQTT 3.1.1 broker stand-in to check the RFLink MQTT publisher (QoS 1 window, retransmissions, batching)
+#
+#   python3 mqtt_broker_standin.py                        listen on 1883, print what RFLink publishes
+#   python3 mqtt_broker_standin.py --drop-acks 30         do not acknowledge 30% of the first transmissions
+#   python3 mqtt_broker_standin.py --ack-delay 2000       acknowledge QoS 1 messages 2 s late
+#
+# Then point RFLink to it: 10;config;set;{"mqtt":{"enabled":true,"server":"<this host>","qos":1,"inflight_window":4}}
+# A line typed on standard input is published on the topics RFLink subscribed to (topic_in), e.g. 10;ping;
+# Every client gets its own counters, printed when it disconnects and on Ctrl+C:
+#   reads       TCP reads which brought at least one PUBLISH, fewer than publishes when RFLink batches them
+#   duplicates  PUBLISH received again with the DUP flag (retransmissions)
+#   acked       PUBACK sent
+
+import argparse
+import random
+import select
+import socket
+import struct
+import sys
+import threading
+import time
+
+CONNECT, CONNACK, PUBLISH, PUBACK, SUBSCRIBE, SUBACK = 1, 2, 3, 4, 8, 9
+PINGREQ, PINGRESP, DISCONNECT = 12, 13, 14
+
+
+def encode_length(length):
+    encoded = bytearray()
+    while True:
+        digit, length = length % 128, length // 128
+        encoded.append(digit | (0x80 if length else 0))
+        if not length:
+            return bytes(encoded)
+
+
+def packet(kind, flags, body):
+    return bytes([(kind << 4) | flags]) + encode_length(len(body)) + body
+
+
+class Session:
+    def __init__(self, connection, address, options, sessions):
+        self.connection = connection
+        self.address = address
+        self.options = options
+        self.sessions = sessions
+        self.buffer = bytearray()
+        self.subscriptions = []
+        self.lock = threading.Lock()
+        self.counters = {"publishes": 0, "reads": 0, "duplicates": 0, "acked": 0, "dropped_acks": 0}
+        self.seen = set()
+
+    def send(self, data):
+        with self.lock:
+            self.connection.sendall(data)
+
+    def packets(self):
+        """Complete packets of the buffer, as (type, flags, body)"""
+        while len(self.buffer) >= 2:
+            length, multiplier, position = 0, 1, 1
+            while True:
+                if position >= len(self.buffer):
+                    return
+                digit = self.buffer[position]
+                length += (digit & 0x7F) * multiplier
+                multiplier *= 128
+                position += 1
+                if not digit & 0x80:
+                    break
+            if len(self.buffer) < position + length:
+                return
+            header = self.buffer[0]
+            body = bytes(self.buffer[position:position + length])
+            del self.buffer[:position + length]
+            yield header >> 4, header & 0x0F, body
+
+    def acknowledge(self, packet_id):
+        if self.options.ack_delay:
+            time.sleep(self.options.ack_delay / 1000.0)
+        try:
+            self.send(packet(PUBACK, 0, struct.pack(">H", packet_id)))
+            self.counters["acked"] += 1
+        except OSError:
+            pass
+
+    def on_publish(self, flags, body):
+        qos, duplicate = (flags >> 1) & 3, bool(flags & 8)
+        topic_length = struct.unpack(">H", body[:2])[0]
+        topic = body[2:2 + topic_length].decode("utf-8", "replace")
+        position = 2 + topic_length
+        packet_id = None
+        if qos > 0:
+            packet_id = struct.unpack(">H", body[position:position + 2])[0]
+            position += 2
+        payload = body[position:].decode("utf-8", "replace").rstrip("\r\n")
+        self.counters["publishes"] += 1
+        if duplicate:
+            self.counters["duplicates"] += 1
+        print("%s qos%d%s %s %s" % (self.address[0], qos, " DUP" if duplicate else "", topic, payload), flush=True)
+
+        if qos == 1:
+            first_time = packet_id not in self.seen
+            self.seen.add(packet_id)
+            if first_time and random.uniform(0, 100) < self.options.drop_acks:
+                self.counters["dropped_acks"] += 1
+                return
+            if self.options.ack_delay:
+                threading.Thread(target=self.acknowledge, args=(packet_id,), daemon=True).start()
+            else:
+                self.acknowledge(packet_id)
+
+    def run(self):
+        print("%s connected" % self.address[0], flush=True)
+        try:
+            while True:
+                data = self.connection.recv(4096)
+                if not data:
+                    break
+                self.buffer += data
+                brought_publish = False
+                for kind, flags, body in self.packets():
+                    if kind == CONNECT:
+                        self.send(packet(CONNACK, 0, b"\x00\x00"))
+                    elif kind == PUBLISH:
+                        brought_publish = True
+                        self.on_publish(flags, body)
+                    elif kind == SUBSCRIBE:
+                        packet_id, position, granted = body[:2], 2, bytearray()
+                        while position < len(body):
+                            topic_length = struct.unpack(">H", body[position:position + 2])[0]
+                            self.subscriptions.append(body[position + 2:position + 2 + topic_length].decode())
+                            granted.append(min(body[position + 2 + topic_length], 1))
+                            position += 3 + topic_length
+                        self.send(packet(SUBACK, 0, packet_id + bytes(granted)))
+                        print("%s subscribed to %s" % (self.address[0], ", ".join(self.subscriptions)), flush=True)
+                    elif kind == PINGREQ:
+                        self.send(packet(PINGRESP, 0, b""))
+                    elif kind == DISCONNECT:
+                        return
+                if brought_publish:
+                    self.counters["reads"] += 1
+        except OSError:
+            pass
+        finally:
+            self.connection.close()
+            self.sessions.remove(self)
+            print("%s disconnected %s" % (self.address[0], self.summary()), flush=True)
+
+    def summary(self):
+        return " ".join("%s=%d" % item for item in self.counters.items())
+
+
+def forward_stdin(sessions):
+    for line in sys.stdin:
+        line = line.strip()
+        if not line:
+            continue
+        for session in list(sessions):
+            for topic in session.subscriptions:
+                encoded = topic.encode()
+                session.send(packet(PUBLISH, 0, struct.pack(">H", len(encoded)) + encoded + line.encode()))
+                print("-> %s %s %s" % (session.address[0], topic, line), flush=True)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="MQTT broker stand-in for RFLink publisher checks")
+    parser.add_argument("--port", type=int, default=1883)
+    parser.add_argument("--drop-acks", type=float, default=0, metavar="PERCENT",
+                        help="first transmissions of QoS 1 messages left without PUBACK")
+    parser.add_argument("--ack-delay", type=int, default=0, metavar="MS", help="delay before each PUBACK")
+    parser.add_argument("--seed", type=int, help="random seed, to replay the same dropped acknowledgements")
+    options = parser.parse_args()
+    if options.seed is not None:
+        random.seed(options.seed)
+
+    server = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+    server.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    server.bind(("", options.port))
+    server.listen(4)
+    print("listening on port %d" % options.port, flush=True)
+
+    sessions = []
+    threading.Thread(target=forward_stdin, args=(sessions,), daemon=True).start()
+    try:
+        while True:
+            if not select.select([server], [], [], 1)[0]:
+                continue
+            connection, address = server.accept()
+            session = Session(connection, address, options, sessions)
+            sessions.append(session)
+            threading.Thread(target=session.run, daemon=True).start()
+    except KeyboardInterrupt:
+        for session in list(sessions):
+            print("%s %s" % (session.address[0], session.summary()))
+
+
+if __name__ == "__main__":
+    main()
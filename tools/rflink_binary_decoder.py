@@ -0,0 +1,237 @@
+# Reference decoder for the RFLink binary framed output (see RFLink/16_Binary.h)
+#
+#   python3 rflink_binary_decoder.py capture.bin          decode frames saved from Serial
+#   python3 rflink_binary_decoder.py --tcp 192.168.1.10   decode a Serial2Net stream (sends 10;serial2net;format;binary;)
+#   python3 rflink_binary_decoder.py --benchmark          compare size and parsing time with the 20;XX;... text lines
+#
+# Bytes which are not part of a valid frame (boot messages, debug text printed before the switch ...) are skipped:
+# the decoder looks for SYNC, checks the CRC, and moves one byte forward when it does not match.
+#
+# Protocol names of decoded signals are sent as a 16 bits id, mapped back to the names found in the plugins sources
+# (RFLink/Plugins next to this script, or --sources). Ids missing from them are shown as "#xxxx".
+
+import argparse
+import binascii
+import glob
+import json
+import os
+import re
+import socket
+import struct
+import sys
+import time
+
+SYNC = 0xA5
+
+CLASSES = {0x01: "decode", 0x02: "reply", 0x04: "debug", 0x08: "pulses"}
+
+TAGS = {
+    0x01: "SEQ", 0x02: "NAME", 0x03: "ID", 0x04: "ID", 0x05: "SWITCH", 0x06: "SWITCH", 0x07: "CMD",
+    0x08: "SET_LEVEL", 0x09: "NAME", 0x10: "TEMP", 0x11: "HUM", 0x12: "BARO", 0x13: "HSTATUS", 0x14: "BFORECAST", 0x15: "UV",
+    0x16: "LUX", 0x17: "BAT", 0x18: "RAIN", 0x19: "RAINRATE", 0x1A: "WINSP", 0x1B: "AWINSP", 0x1C: "WINGS",
+    0x1D: "WINDIR", 0x1E: "WINCHL", 0x1F: "WINTMP", 0x20: "CHIME", 0x21: "SMOKEALERT", 0x22: "PIR", 0x23: "CO2",
+    0x24: "SOUND", 0x25: "KWATT", 0x26: "WATT", 0x27: "CURRENT", 0x28: "DIST", 0x29: "METER", 0x2A: "VOLT",
+    0x2B: "RGBW", 0x2C: "CHN", 0x40: "RSSI", 0x41: "TIMESTAMP", 0x42: "PLUGIN",
+}
+TEXT_TAGS = {0x02, 0x04, 0x06}
+SIGNED_TAGS = {0x10, 0x1E, 0x1F}  # sign in bit 15, value in tenths
+
+CMDS = {0: "OFF", 1: "ON", 2: "BRIGHT", 3: "DIM", 4: "UNKNOWN", 5: "UP", 6: "DOWN", 7: "STOP", 8: "PAIR"}
+
+
+NAMES = {}  # name id -> protocol name, see load_names()
+
+
+def crc16(data):
+    """CRC-16/CCITT-FALSE, crc_hqx is the same polynomial and takes the 0xFFFF initial value as argument"""
+    return binascii.crc_hqx(data, 0xFFFF)
+
+
+def name_id(name):
+    """Same as Binary::nameId(): FNV-1a 32 bits of the name, upper and lower halves xored"""
+    value = 0x811C9DC5
+    for byte in name.encode("ascii"):
+        value = ((value ^ byte) * 0x01000193) & 0xFFFFFFFF
+    return (value >> 16) ^ (value & 0xFFFF)
+
+
+def load_names(directory):
+    """Fills NAMES with the string literals of the plugins, protocol names being among them"""
+    for path in glob.glob(os.path.join(directory, "*.c")):
+        with open(path, encoding="ascii", errors="replace") as source:
+            text = source.read()
+        for name in re.findall(r'PSTR\("([^"]*)"\)', text) + re.findall(r'#define\s+PLUGIN_\d+_ID\s+"([^"]*)"', text):
+            NAMES.setdefault(name_id(name), name)
+
+
+def decode_payload(kind, payload):
+    event = {"class": CLASSES.get(kind, kind)}
+    i = 0
+    while i + 2 <= len(payload):
+        tag, size = payload[i], payload[i + 1]
+        value = payload[i + 2:i + 2 + size]
+        i += 2 + size
+        name = TAGS.get(tag) or "0x%02X" % tag
+        if tag in TEXT_TAGS:
+            event[name] = value.decode("ascii", "replace")
+        elif tag == 0x09:
+            number = int.from_bytes(value, "little")
+            event[name] = NAMES.get(number) or "#%04x" % number
+        elif tag == 0x40:
+            event[name] = struct.unpack("<h", value)[0] / 10.0
+        elif tag == 0x41:
+            seconds, milliseconds = struct.unpack("<IH", value)
+            event[name] = seconds + milliseconds / 1000.0
+        else:
+            number = int.from_bytes(value, "little")
+            if tag in SIGNED_TAGS:
+                event[name] = (-(number & 0x7FFF) if number & 0x8000 else number) / 10.0
+            elif tag == 0x07:
+                event[name] = ("ALL" if number & 0x80 else "") + CMDS.get(number & 0x7F, "UNKNOWN")
+            elif tag in (0x17, 0x21, 0x22):
+                event[name] = ("OK" if number else "LOW") if tag == 0x17 else ("ON" if number else "OFF")
+            else:
+                event[name] = number
+    return event
+
+
+class Decoder:
+    def __init__(self):
+        self.buffer = bytearray()
+        self.skipped = 0
+        self.bad_crc = 0
+
+    def feed(self, data):
+        """Adds received bytes, returns the events of the frames completed by them"""
+        buffer = self.buffer
+        buffer += data
+        events = []
+        position = 0
+        while True:
+            start = buffer.find(SYNC, position)
+            if start < 0:
+                self.skipped += len(buffer) - position
+                position = len(buffer)
+                break
+            self.skipped += start - position
+            position = start
+            if len(buffer) < position + 2:
+                break
+            end = position + 2 + buffer[position + 1] + 2
+            if len(buffer) < end:
+                break
+            crc = buffer[end - 2] | (buffer[end - 1] << 8)
+            if buffer[position + 1] < 1 or crc16(buffer[position + 1:end - 2]) != crc:
+                self.bad_crc += 1
+                self.skipped += 1
+                position += 1
+                continue
+            events.append(decode_payload(buffer[position + 2], bytes(buffer[position + 3:end - 2])))
+            position = end
+        del buffer[:position]
+        return events
+
+
+def parse_text_line(line):
+    """What a consumer of the text protocol has to do for each line"""
+    fields = line.rstrip(";\r\n").split(";")
+    event = {"SEQ": int(fields[1], 16), "NAME": fields[2]}
+    for field in fields[3:]:
+        key, _, value = field.partition("=")
+        if key in ("TEMP", "WINCHL", "WINTMP"):
+            number = int(value, 16)
+            event[key] = (-(number & 0x7FFF) if number & 0x8000 else number) / 10.0
+        elif key in ("HUM", "WINDIR", "CHIME", "CO2", "SOUND", "CURRENT", "DIST", "METER", "VOLT", "SET_LEVEL"):
+            event[key] = int(value)
+        elif key in ("BARO", "UV", "LUX", "RAIN", "RAINRATE", "WINSP", "AWINSP", "WINGS", "KWATT", "WATT"):
+            event[key] = int(value, 16)
+        else:
+            event[key] = value
+    return event
+
+
+def encode_frame(kind, fields):
+    payload = bytearray()
+    for tag, value in fields:
+        if isinstance(value, str):
+            raw = value.encode("ascii")
+        elif tag == 0x41:
+            raw = struct.pack("<IH", int(value), 0)
+        elif tag == 0x09:
+            raw = struct.pack("<H", value)
+        else:
+            raw = value.to_bytes(max(1, (value.bit_length() + 7) // 8), "little")
+        payload += bytes([tag, len(raw)]) + raw
+    body = bytes([1 + len(payload), kind]) + payload
+    crc = crc16(body)
+    return bytes([SYNC]) + body + bytes([crc & 0xFF, crc >> 8])
+
+
+def benchmark(count):
+    name = "LaCrosse-TX141THBv2"
+    text, binary, same_fields = bytearray(), bytearray(), bytearray()
+    for seq in range(count):
+        temp, hum, sensor = 200 + seq % 50, 40 + seq % 30, 0x1A00 + seq % 8
+        text += ("20;%02X;%s;ID=%04x;TEMP=%04x;HUM=%02d;BAT=OK;\r\n" % (seq & 0xFF, name, sensor, temp, hum)).encode()
+        fields = [(0x01, seq & 0xFF), (0x09, name_id(name)), (0x03, sensor), (0x10, temp), (0x11, hum), (0x17, 1)]
+        same_fields += encode_frame(0x01, fields)
+        binary += encode_frame(0x01, fields + [(0x40, (-735) & 0xFFFF), (0x41, 1700000000 + seq), (0x42, 49)])
+
+    started = time.perf_counter()
+    parsed = [parse_text_line(line) for line in text.decode().splitlines()]
+    text_time = time.perf_counter() - started
+
+    timings = []
+    for stream in (same_fields, binary):
+        started = time.perf_counter()
+        decoded = Decoder().feed(stream)
+        timings.append(time.perf_counter() - started)
+        assert len(decoded) == count and all(event["NAME"] == name for event in decoded)
+
+    assert len(parsed) == count
+    print("%d events" % count)
+    print("text   : %5.1f bytes/event, %6.2f us/event (no RSSI, timestamp nor plugin)"
+          % (len(text) / count, text_time * 1e6 / count))
+    print("binary : %5.1f bytes/event, %6.2f us/event (same fields as text, including CRC check)"
+          % (len(same_fields) / count, timings[0] * 1e6 / count))
+    print("binary : %5.1f bytes/event, %6.2f us/event (with RSSI, timestamp and plugin, including CRC check)"
+          % (len(binary) / count, timings[1] * 1e6 / count))
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Decodes the RFLink binary framed output")
+    parser.add_argument("file", nargs="?", help="capture to decode, standard input if omitted")
+    parser.add_argument("--tcp", metavar="HOST", help="Serial2Net server to connect to")
+    parser.add_argument("--port", type=int, default=1900, help="Serial2Net port (default 1900)")
+    parser.add_argument("--benchmark", type=int, nargs="?", const=10000, metavar="EVENTS")
+    parser.add_argument("--sources", metavar="DIR", help="plugins sources to read protocol names from",
+                        default=os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "RFLink", "Plugins"))
+    args = parser.parse_args()
+
+    load_names(args.sources)
+
+    if args.benchmark:
+        benchmark(args.benchmark)
+        return
+
+    decoder = Decoder()
+    if args.tcp:
+        connection = socket.create_connection((args.tcp, args.port))
+        connection.sendall(b"10;serial2net;format;binary;\r\n")
+        read = lambda: connection.recv(4096)
+    else:
+        stream = open(args.file, "rb") if args.file else sys.stdin.buffer
+        read = lambda: stream.read1(4096) if hasattr(stream, "read1") else stream.read(4096)
+
+    while True:
+        data = read()
+        if not data:
+            break
+        for event in decoder.feed(data):
+            print(json.dumps(event))
+    if decoder.skipped:
+        print("%d bytes skipped, %d CRC mismatches" % (decoder.skipped, decoder.bad_crc), file=sys.stderr)
+
+
+if __name__ == "__main__":
+    main()